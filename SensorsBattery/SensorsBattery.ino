@@ -37,6 +37,17 @@
  */
 //#define ENABLE_LOW_RATE
 
+/*
+ * ### ADAPTIVE DATA RATE ###
+ *
+ * Define whether node should use the data rate recommended by gateway. Nodes close to gateway can then
+ * use faster data rates and spend only a fraction of time on air. Node starts at the slowest data rate and
+ * falls back one step slower after every failed transmit.
+ *
+ * Gateway must have ENABLE_ADR as well. Overrides ENABLE_LOW_RATE. To disable, comment out ENABLE_ADR.
+ */
+//#define ENABLE_ADR
+
 /*
  * ### FREQUENCY ###
  *
@@ -92,6 +103,16 @@
 #define SLEEP_TIME    600
 #define FORCE_SEND    30
 
+/*
+ * ### TRANSMIT SLOTS ###
+ *
+ * Define whether node should follow transmit slot assigned by gateway. Gateway tells in acks how much to shift
+ * the next wake up to hit the slot of the node, which reduces collisions in large networks. Node learns the error
+ * of its watchdog timer from successive shifts, so it takes a few messages to settle in the slot.
+ * Works best when sleep time is a multiple of gateway SLOT_FRAME. To disable, comment out ENABLE_SLOTS.
+ */
+//#define ENABLE_SLOTS
+
 /*
  * ### THRESHOLDS ###
  *
@@ -110,6 +131,41 @@
 #define HUMIDITY_TH     30
 #define PRESSURE_TH     10
 
+/*
+ * ### BATCHING ###
+ *
+ * In batching mode node takes a sample every SLEEP_TIME but sends samples to gateway only after BATCH_SAMPLES samples
+ * have been collected, all in one message. This saves a lot of battery as radio is used only once per batch.
+ *
+ * Samples are sent as 8 bit deltas against the first sample of the batch, so if a value differs more than
+ * ±12.7 from it, the batch is sent early and a new one started. Pressing the button also sends the batch right away.
+ * Thresholds are not used in batching mode.
+ *
+ * Set to 0 to disable batching. Limited to 2-9.
+ */
+#define BATCH_SAMPLES   0
+
+/*
+ * ### COMPACT MESSAGES ###
+ *
+ * Define whether node should send compact messages. Compact messages include only values that have changed
+ * since the last acknowledged message, which cuts time on air and battery usage, especially with low rate transmits.
+ * Every KEYFRAME_INTERVAL:th message, as well as forced messages and batches, are still sent in full.
+ *
+ * Gateway must support compact messages. KEYFRAME_INTERVAL is limited to 1-255.
+ */
+//#define ENABLE_COMPACT
+#define KEYFRAME_INTERVAL 10
+
+/*
+ * ### REMOTE CONFIGURATION ###
+ *
+ * Define whether node takes configuration written to gateway, so that sleep time, force send and thresholds
+ * can be changed without reprogramming. Configuration arrives in the ack of the next message and is saved to EEPROM,
+ * where it overrides the settings above until it is written again. To disable, comment out ENABLE_REMOTE_CONFIG.
+ */
+//#define ENABLE_REMOTE_CONFIG
+
 /*
  * ####################
  * ### END SETTINGS ###
@@ -135,6 +191,15 @@
 #include <SI7021.h>
 #include <SparkFunBME280.h>
 #include <NTCSensor.h>
+#include <SI7021Conversion.h>
+
+#ifdef ENABLE_COMPACT
+#include <CompactPayload.h>
+#endif
+
+#ifdef ENABLE_REMOTE_CONFIG
+#include <EEPROM.h>
+#endif
 
 #define MODE_NO_SENSOR  0
 #define MODE_SI7021     1
@@ -148,8 +213,26 @@
 #define JMP_PIN         9
 
 #define PAYLOAD_LEN     11
+#define BATCH_PAYLOAD_LEN 39
+#define BATCH_MAX_SAMPLES 9
 #define MAX_PAYLOAD_LEN 40
 #define GATEWAYID       254
+#define NR_OF_RATES     3
+#define SI7021_ADDRESS  0x40
+#define SI7021_RH_START 0xF5 // Measure humidity without holding I2C bus
+#define SI7021_TEMP_READ 0xE0 // Read temperature measured along with previous humidity
+#define SENSOR_TIMEOUT  100 // Milliseconds to wait for humidity sensor conversion
+#define VREF_SETTLE_TIME 2  // Milliseconds for bandgap reference to settle
+#ifdef ENABLE_REMOTE_CONFIG
+#define ACK_AIR_LENGTH  20  // Longest ack on air: RadioHead header plus extended ack with configuration padded to encryption blocks
+#else
+#define ACK_AIR_LENGTH  12  // Longest ack on air: RadioHead header plus extended ack padded to one encryption block
+#endif
+#define CONFIG_START    760 // EEPROM address of configuration from gateway, 2 bytes per parameter (0xFFFF = not set)
+#define CONFIG_PARAMETERS 5 // Sleep time | force send | sensor1 threshold | sensor2 threshold | sensor3 threshold
+#define CONFIG_FLAGS    0x0F // Application flags in radio header, parameter + 1 of an applied configuration write
+#define CONFIG_MIN_SLEEP 60 // Shortest sleep time in seconds taken from gateway (radio duty cycle, slot frame is up to 60 s)
+#define ACK_MARGIN      100 // Milliseconds for gateway to notice message and start sending ack
 #define TX_MAX_PWR      20
 #define TX_MIN_PWR      2
 
@@ -159,7 +242,7 @@ const uint8_t encryptKey[17] = ENCRYPT_KEY; // Encryption key for communication
 #endif
 uint8_t maxNrOfSends = RETRIES + 1; // Maximum amount of transmits after which to give in and try again after sleepTime (1-5)
 uint16_t sleepTime = SLEEP_TIME; // Sleep time between wake ups in seconds
-const uint16_t forceTransmitInterval = FORCE_SEND; // How often at least should a packet be transmitted regardless of threshold (minutes)
+uint16_t forceTransmitInterval = FORCE_SEND; // How often at least should a packet be transmitted regardless of threshold (minutes)
 
 uint16_t sensor1Threshold = TEMPERATURE_TH; // Threshold for sending sensor1 in tenths of degree C (0 = send always)
 uint16_t sensor2Threshold = HUMIDITY_TH; // Threshold for sending sensor2 in tenths of RH% (0 = send always)
@@ -179,20 +262,61 @@ SI7021 sensorSI7021; // SI7021 instance
 BME280 sensorBME280; // BME280 instance
 NTCSensor sensorNTC(NTC_ENABLE_PIN, NTC_PIN); // NTC instance
 
+#ifdef ENABLE_ADR
+// Data rates from the slowest to the fastest, same as in gateway
+const RH_RF95::ModemConfig dataRates[NR_OF_RATES] = {
+  {0x78, 0xc4, 0x0c}, // SF12, 125 kHz, CR 4/8 (same as low rate)
+  {0x72, 0x94, 0x04}, // SF9, 125 kHz, CR 4/5
+  {0x72, 0x74, 0x04}  // SF7, 125 kHz, CR 4/5 (same as default)
+};
+// Preamble lengths in symbols, long enough for gateway to detect while scanning the other data rates
+const uint16_t ratePreambles[NR_OF_RATES] = {8, 40, 160};
+uint8_t dataRate = 0; // Data rate in use
+uint8_t recommendedRate = 0; // Data rate recommended by gateway in the last ack
+#elif defined ENABLE_LOW_RATE
+const RH_RF95::ModemConfig modemConfig = {0x78, 0xc4, 0x0c}; // Registers of Bw125Cr48Sf4096
+#else
+const RH_RF95::ModemConfig modemConfig = {0x72, 0x74, 0x04}; // Registers of default Bw125Cr45Sf128
+#endif
+
+uint16_t ackTimeout; // How long to wait for ack in milliseconds
+uint16_t ackLatency = 0; // Milliseconds from sent message to received ack in the last successful transmit (for debugging)
+
 // Payload buffer
 // Header | Battery_MSB | Battery_LSB | TransmitPower | TransmitInterval | Sensor1_MSB | Sensor1_LSB | Sensor2_MSB | Sensor2_LSB | Sensor3_MSB | Sensor3_LSB
 uint8_t payloadBuffer[MAX_PAYLOAD_LEN];
 
+#ifdef ENABLE_COMPACT
+// Sizes of the fields following the header
+const uint8_t compactFields[] = {2, 1, 1, 2, 2, 2};
+CompactPayload compactPayload(compactFields, sizeof(compactFields));
+uint8_t compactBuffer[PAYLOAD_LEN];
+uint8_t referenceBuffer[PAYLOAD_LEN]; // Last acknowledged message
+bool hasReference = false;
+uint8_t compactSinceKeyframe = 0; // Compact messages sent since the last full message
+#endif
+
 uint16_t neededSleepCycles; // How many 8 second sleep cycles are needed for full sleep time
 uint8_t transmitInterval; // How often should gateway expect transmit (in minutes)
 uint16_t lastTransmittedCycles; // Sleep cycles from last transmitted packet
+int16_t slotShift = 0; // Milliseconds to shift next wake up as told by gateway
+#ifdef ENABLE_SLOTS
+int32_t slotCorrection = 0; // Milliseconds added to every sleep, learned watchdog error
+uint8_t slotSleeps = 0; // Full sleeps since the last shift from gateway (reset when a sleep is cut short)
+#endif
 bool previousTransmitOk = false; // Was previous transmit successful
 bool hasFailedTransmit = false; // Is there at least one failed transmit (for decreasing transmit power faster after boot up)
 bool isImportant = false; // When node is marked important, it triggers gateway to set external interrupt
 
 bool isDebugMode = false;
 bool isThresholdMode = false;
+bool isFullRequested = false; // Gateway could not decode compact message and asks for a full one
 volatile bool forceSend = false;
+uint8_t messageSequence = 0; // Sequence number of the latest message (1 = first since startup, then 2-255 in turn)
+#ifdef ENABLE_REMOTE_CONFIG
+uint8_t appliedConfig = 0; // Parameter + 1 of a configuration write applied but not yet confirmed to gateway
+#endif
+volatile bool timerElapsed = false; // Timer2 wait in sleepMillis() has elapsed
 uint16_t neededForceCycles; // How many sleep cycles at max between force transmits
 uint8_t nodeId; // Node ID
 uint8_t sensorMode = MODE_NO_SENSOR;
@@ -204,6 +328,12 @@ int16_t sensor1Value = 0;
 int16_t sensor2Value = 0;
 int16_t sensor3Value = 0;
 
+// Batch of samples. The first sample is kept as is and the others as deltas against it.
+bool isBatchMode = false;
+uint8_t batchCount = 0; // Samples in the batch
+int16_t batchBase[3]; // First sample of the batch
+int8_t batchDeltas[(BATCH_MAX_SAMPLES - 1) * 3]; // Deltas of the following samples
+
 uint16_t batteryVoltage = 0;
 int8_t transmitPower = ((TX_MAX_PWR - TX_MIN_PWR) / 4) + TX_MIN_PWR; // Set initial transmit power to low medium
 uint8_t transmitPowerRaw = 25;
@@ -293,9 +423,14 @@ void setup() {
   
   rf95Driver.setFrequency(frequency);
   rf95Driver.setTxPower(transmitPower); // 5-23 dBm
+  #if defined ENABLE_ADR
+  setDataRate(0);
+  #else
   #ifdef ENABLE_LOW_RATE
   rf95Driver.setModemConfig(RH_RF95::Bw125Cr48Sf4096);
   #endif
+  ackTimeout = ACK_MARGIN + getTimeOnAir(&modemConfig, ACK_AIR_LENGTH, 8);
+  #endif
 
   // Set button interrupt
   attachInterrupt(digitalPinToInterrupt(BTN_PIN), wakeUpFromBtn, FALLING);
@@ -306,20 +441,25 @@ void setup() {
 
 void loop() {
 
-  // Read sensor values
-  if (sensorMode & MODE_SI7021) {
-    readSI7021();
-  }
-  else if (sensorMode & MODE_BME280) {
-    readBME280();
-  }
-  if (sensorMode & MODE_NTC) {
-    readNTC();
-  }
+  // Read sensor values and battery voltage
+  readSensors();
 
   
+  // If batching mode is active...
+  if (isBatchMode) {
+    // If sample does not fit the batch, send the batch and start a new one with this sample
+    if (!addBatchSample()) {
+      constructAndSendBatch();
+      addBatchSample();
+    }
+    
+    // Send batch if full or send is forced
+    if ((batchCount >= BATCH_SAMPLES) || forceSend) {
+      constructAndSendBatch();
+    }
+  }
   // If send threshold mode is active and send is not forced...
-  if (isThresholdMode && !forceSend) {
+  else if (isThresholdMode && !forceSend) {
     
     // If it has been too long time from last transmit ...
     if (lastTransmittedCycles >= neededForceCycles) {
@@ -341,23 +481,9 @@ void loop() {
 }
 
 bool constructAndSendPacket() {
-  // Read battery voltage
-  readBatteryVoltage();
-  
   // Construct payload
   
-  if (sensorMode == MODE_SI7021) {
-    payloadBuffer[0] = B00010001;
-  }
-  else if (sensorMode == MODE_BME280) {
-    payloadBuffer[0] = B00010100;
-  }
-  else if (sensorMode == MODE_NTC) {
-    payloadBuffer[0] = B00010101;
-  }
-  else if (sensorMode == (MODE_SI7021 | MODE_NTC)) {
-    payloadBuffer[0] = B00010110;
-  }
+  payloadBuffer[0] = getNodeType();
   
   if (isImportant) {
     payloadBuffer[0] |= B00100000;
@@ -366,6 +492,11 @@ bool constructAndSendPacket() {
   // Set expect ack bit
   payloadBuffer[0] |= B01000000;
   
+  #if defined ENABLE_SLOTS || defined ENABLE_ADR || defined ENABLE_REMOTE_CONFIG
+  // Ask for extended ack with transmit slot, data rate and configuration
+  payloadBuffer[0] |= B10000000;
+  #endif
+  
   payloadBuffer[1] = batteryVoltage >> 8;
   payloadBuffer[2] = batteryVoltage;
   payloadBuffer[3] = transmitPowerRaw;
@@ -376,24 +507,156 @@ bool constructAndSendPacket() {
   payloadBuffer[8] = sensor2Value;
   payloadBuffer[9] = sensor3Value >> 8;
   payloadBuffer[10] = sensor3Value;
+  
+  return transmitPayload(PAYLOAD_LEN);
+}
+
+bool constructAndSendBatch() {
+  // Construct payload
+  // Header | Battery_MSB | Battery_LSB | TransmitPower | TransmitInterval | NodeType | Samples | SampleInterval_MSB | SampleInterval_LSB |
+  // Sensor1_MSB | Sensor1_LSB | Sensor2_MSB | Sensor2_LSB | Sensor3_MSB | Sensor3_LSB | Sample2_Sensor1_Delta | Sample2_Sensor2_Delta | ...
+  
+  payloadBuffer[0] = B00010111;
+  
+  if (isImportant) {
+    payloadBuffer[0] |= B00100000;
+  }
+  
+  // Set expect ack bit
+  payloadBuffer[0] |= B01000000;
+  
+  #if defined ENABLE_SLOTS || defined ENABLE_ADR || defined ENABLE_REMOTE_CONFIG
+  // Ask for extended ack with transmit slot, data rate and configuration
+  payloadBuffer[0] |= B10000000;
+  #endif
+  
+  payloadBuffer[1] = batteryVoltage >> 8;
+  payloadBuffer[2] = batteryVoltage;
+  payloadBuffer[3] = transmitPowerRaw;
+  payloadBuffer[4] = transmitInterval;
+  payloadBuffer[5] = getNodeType();
+  payloadBuffer[6] = batchCount;
+  payloadBuffer[7] = sleepTime >> 8;
+  payloadBuffer[8] = sleepTime;
+  for (uint8_t i = 0; i < 3; i++) {
+    payloadBuffer[9 + i * 2] = batchBase[i] >> 8;
+    payloadBuffer[10 + i * 2] = batchBase[i];
+  }
+  // Unused deltas are sent as zero
+  for (uint8_t i = 0; i < sizeof(batchDeltas); i++) {
+    payloadBuffer[15 + i] = (i < ((batchCount - 1) * 3)) ? batchDeltas[i] : 0;
+  }
+  
+  // Start a new batch regardless of the result, as there is no room to keep old samples
+  batchCount = 0;
+  
+  return transmitPayload(BATCH_PAYLOAD_LEN);
+}
+
+bool addBatchSample() {
+  int16_t values[3] = {sensor1Value, sensor2Value, sensor3Value};
+  
+  // First sample is the base of the batch
+  if (batchCount == 0) {
+    for (uint8_t i = 0; i < 3; i++) {
+      batchBase[i] = values[i];
+    }
+    batchCount = 1;
+    return true;
+  }
+  
+  // Check that all deltas fit in 8 bits
+  for (uint8_t i = 0; i < 3; i++) {
+    int16_t delta = values[i] - batchBase[i];
+    if ((delta < -127) || (delta > 127)) {
+      return false;
+    }
+  }
+  
+  for (uint8_t i = 0; i < 3; i++) {
+    batchDeltas[(batchCount - 1) * 3 + i] = values[i] - batchBase[i];
+  }
+  batchCount++;
+  
+  return true;
+}
+
+uint8_t getNodeType() {
+  if (sensorMode == MODE_SI7021) {
+    return B00010001;
+  }
+  else if (sensorMode == MODE_BME280) {
+    return B00010100;
+  }
+  else if (sensorMode == MODE_NTC) {
+    return B00010101;
+  }
+  else if (sensorMode == (MODE_SI7021 | MODE_NTC)) {
+    return B00010110;
+  }
+  return 0;
+}
 
+bool transmitPayload(uint8_t length) {
   // If in force mode, set maximum transmit power
   if (forceSend) {
     rf95Driver.setTxPower(TX_MAX_PWR);
     payloadBuffer[3] = 100;
   }
   
+  // Number every new message, retransmits keep the same number so that gateway can drop duplicates
+  messageSequence = (messageSequence < 255) ? messageSequence + 1 : 2;
+  radioManager.setHeaderId(messageSequence);
+  
+  // Confirm an applied configuration write to gateway in radio header flags
+  #ifdef ENABLE_REMOTE_CONFIG
+  uint8_t confirmedConfig = appliedConfig;
+  radioManager.setHeaderFlags(confirmedConfig, CONFIG_FLAGS);
+  appliedConfig = 0;
+  #endif
+  
   bool transmitOk = false;
   for (uint8_t i = 0; i < maxNrOfSends; i++) {
+    uint8_t* message = payloadBuffer;
+    uint8_t messageLength = length;
+    
+    #ifdef ENABLE_COMPACT
+    // Send only changes unless full message is due (batches are always sent in full).
+    // Encode again on every retry as transmit power may have changed.
+    if ((length == PAYLOAD_LEN) && hasReference && !forceSend && (compactSinceKeyframe < KEYFRAME_INTERVAL)) {
+      uint8_t compactLength = compactPayload.encode(payloadBuffer, referenceBuffer, compactBuffer);
+      if (compactLength) {
+        message = compactBuffer;
+        messageLength = compactLength;
+      }
+    }
+    #endif
+    
     // Send packet
-    transmitOk = sendPacket();
+    transmitOk = sendPacket(message, messageLength);
+    
+    // If gateway asked for a full message, the link itself works
+    bool linkOk = transmitOk || isFullRequested;
     
     // Update transmit power based on transmit result if not in force send (force sends are always sent at full power and don't count for APC)
     if (!forceSend) {
-      updateTransmitPower(transmitOk);
-      previousTransmitOk = transmitOk;
+      updateTransmitPower(linkOk);
+      previousTransmitOk = linkOk;
+    }
+    
+    #ifdef ENABLE_COMPACT
+    if (isFullRequested) {
+      hasReference = false;
     }
     
+    // Gateway now has the same message to decode the next compact message against
+    if (transmitOk && (length == PAYLOAD_LEN)) {
+      memcpy(referenceBuffer, payloadBuffer, PAYLOAD_LEN);
+      hasReference = true;
+      compactSinceKeyframe = (message == payloadBuffer) ? 0 : compactSinceKeyframe + 1;
+    }
+    #endif
+    
     // If transmit was successful, reset and break from retransmit loop
     if (transmitOk) {
       lastTransmittedCycles = 0;
@@ -404,6 +667,28 @@ bool constructAndSendPacket() {
     }
   }
   
+  // Confirm again with the next message if this one did not get through (unless a new write was applied)
+  #ifdef ENABLE_REMOTE_CONFIG
+  if (!transmitOk && (appliedConfig == 0)) {
+    appliedConfig = confirmedConfig;
+  }
+  #endif
+  
+  #ifdef ENABLE_ADR
+  // Follow gateway one step at a time if message got through, otherwise fall back to a slower data rate
+  if (transmitOk || isFullRequested) {
+    if (recommendedRate > dataRate) {
+      setDataRate(dataRate + 1);
+    }
+    else if (recommendedRate < dataRate) {
+      setDataRate(dataRate - 1);
+    }
+  }
+  else if (dataRate > 0) {
+    setDataRate(dataRate - 1);
+  }
+  #endif
+  
   // Return to normal transmit power after force send
   if (forceSend) {
     rf95Driver.setTxPower(transmitPower);
@@ -424,34 +709,73 @@ bool constructAndSendPacket() {
   return transmitOk;
 }
 
-bool sendPacket() {
+bool sendPacket(uint8_t* message, uint8_t length) {
+  isFullRequested = false;
+  
   // If packet accepted by radio
-  if (radioManager.sendto(payloadBuffer, PAYLOAD_LEN, GATEWAYID)) {
+  if (radioManager.sendto(message, length, GATEWAYID)) {
     
     // Wait for packet to be sent
     radioManager.waitPacketSent();
 
-    #ifdef ENABLE_LOW_RATE
-    uint16_t timeout = 3500;
-    #else
-    uint16_t timeout = 200;
-    #endif
-
     uint32_t sendTime = millis();
 
-    uint8_t len = MAX_PAYLOAD_LEN;
+    // Receive ack to its own buffer so that message is kept intact for retransmits
+    uint8_t ackBuffer[9];
+    uint8_t len;
     uint8_t from;
     uint8_t to;
     
-    // Wait ack
-    while ((millis() - sendTime) < timeout) {
+    // Wait ack, sleeping until radio (or millis timer) interrupt
+    while ((millis() - sendTime) < ackTimeout) {
+      len = sizeof(ackBuffer);
+      
+      if (!radioManager.available()) {
+        idleMCU();
+      }
       // If received packet from gateway
-      if (radioManager.recvfrom(payloadBuffer, &len, &from, &to)) {
-        if ((from == GATEWAYID) && (to == nodeId) && (len == 2)) {
+      else if (radioManager.recvfrom(ackBuffer, &len, &from, &to)) {
+        if ((from == GATEWAYID) && (to == nodeId) && ((len == 2) || (len == 5) || (len == 8))) {
           // If this really is ack
-          if (payloadBuffer[0] & B00000001) {
+          if (ackBuffer[0] & B00000001) {
+            ackLatency = millis() - sendTime;
+            
             // Save RSSI reported by gateway for future use
-            lastReportedRSSI = payloadBuffer[1];
+            lastReportedRSSI = ackBuffer[1];
+            
+            // Extended ack includes shift to the next wake up and recommended data rate if gateway uses them
+            if (len >= 5) {
+              #ifdef ENABLE_SLOTS
+              if (ackBuffer[0] & B00000100) {
+                slotShift = (ackBuffer[2] << 8) | ackBuffer[3];
+                
+                // Sleeps since the previous shift already had the correction, so what is still left
+                // is the systematic error of the watchdog. Learn half of it per sleep.
+                if (slotSleeps > 0) {
+                  slotCorrection = constrain(slotCorrection + (slotShift / slotSleeps) / 2, -(int32_t)sleepTime * 125, (int32_t)sleepTime * 125);
+                }
+                slotSleeps = 0;
+              }
+              #endif
+              #ifdef ENABLE_ADR
+              if ((ackBuffer[0] & B00001000) && (ackBuffer[4] < NR_OF_RATES)) {
+                recommendedRate = ackBuffer[4];
+              }
+              #endif
+            }
+            
+            // Configuration written to gateway
+            #ifdef ENABLE_REMOTE_CONFIG
+            if ((len == 8) && (ackBuffer[0] & B00010000)) {
+              applyConfig(ackBuffer[5], (ackBuffer[6] << 8) | ackBuffer[7]);
+            }
+            #endif
+            
+            // Message was received but gateway could not decode it
+            if (ackBuffer[0] & B00000010) {
+              isFullRequested = true;
+              return false;
+            }
             return true;
           }
         }
@@ -461,6 +785,55 @@ bool sendPacket() {
   return false;
 }
 
+void idleMCU() {
+  // Idle mode keeps timers and radio interrupt running, so the first of them wakes up
+  set_sleep_mode(SLEEP_MODE_IDLE);
+  sleep_enable();
+  sleep_cpu();
+  sleep_disable();
+}
+
+#ifdef ENABLE_ADR
+void setDataRate(uint8_t rate) {
+  dataRate = rate;
+  recommendedRate = rate;
+  rf95Driver.setModemRegisters(&dataRates[rate]);
+  rf95Driver.setPreambleLength(ratePreambles[rate]);
+  
+  // Gateway sends ack with the same data rate but default preamble
+  ackTimeout = ACK_MARGIN + getTimeOnAir(&dataRates[rate], ACK_AIR_LENGTH, 8);
+}
+#endif
+
+uint16_t getTimeOnAir(const RH_RF95::ModemConfig* config, uint8_t length, uint16_t preamble) {
+  // Bandwidths in Hz by register value
+  const uint32_t bandwidths[10] = {7800, 10400, 15600, 20800, 31250, 41700, 62500, 125000, 250000, 500000};
+  
+  // Decode modem registers (see SX1276 datasheet)
+  uint8_t spreadingFactor = config->reg_1e >> 4;
+  uint8_t codingRate = (config->reg_1d >> 1) & B00000111; // 1-4 for 4/5-4/8
+  bool isImplicitHeader = config->reg_1d & B00000001;
+  bool hasCRC = config->reg_1e & B00000100;
+  bool isLowDataRate = config->reg_26 & B00001000;
+  uint32_t bandwidth = bandwidths[constrain(config->reg_1d >> 4, 0, 9)];
+  
+  // Symbol time in microseconds
+  uint32_t symbolTime = (1UL << spreadingFactor) * 1000000UL / bandwidth;
+  
+  // Number of payload symbols as in Semtech LoRa modem designer's guide
+  int16_t bits = (8 * length) - (4 * spreadingFactor) + 28 + (hasCRC ? 16 : 0) - (isImplicitHeader ? 20 : 0);
+  uint8_t bitsPerSymbol = 4 * (spreadingFactor - (isLowDataRate ? 2 : 0));
+  uint16_t payloadSymbols = 8;
+  if (bits > 0) {
+    payloadSymbols += ((bits + bitsPerSymbol - 1) / bitsPerSymbol) * (codingRate + 4);
+  }
+  
+  // Preamble takes 4.25 symbols more than its length
+  uint32_t microseconds = ((((uint32_t)preamble * 4) + 17) * symbolTime / 4) + (payloadSymbols * symbolTime);
+  
+  return microseconds / 1000;
+}
+
 void updateTransmitPower(bool lastTransmitOk) {
   
   // Default power change. Increase to make APC more aggressive.
@@ -526,24 +899,62 @@ void sleepNode() {
   // Make sure force send flag is cleared
   forceSend = false;
   
+  // Shift wake up towards the slot assigned by gateway. Skip full cycles to wake up earlier.
+  uint16_t sleepCycles = neededSleepCycles;
+  int32_t shift = slotShift;
+  slotShift = 0;
+  #ifdef ENABLE_SLOTS
+  shift += slotCorrection;
+  #endif
+  while ((shift < 0) && (sleepCycles > 1)) {
+    sleepCycles--;
+    shift += 8000;
+  }
+  
+  // Sleep the rest of the shift with shorter watchdog periods (8 seconds halved for every step)
+  for (int8_t period = WDTO_4S; period >= WDTO_15MS; period--) {
+    int16_t periodLength = 8000 >> (WDTO_8S - period);
+    while (shift >= periodLength) {
+      sleepMCU(period);
+      shift -= periodLength;
+      
+      // If button pressed, fall through to main loop
+      if (forceSend) {
+        #ifdef ENABLE_SLOTS
+        slotSleeps = 0;
+        #endif
+        return;
+      }
+    }
+  }
+  
   // Sleep uC for sufficient number of 8 second sleep cycles
-  for(uint16_t i = 0; i < neededSleepCycles; i++) {
-    sleepMCU();
+  for(uint16_t i = 0; i < sleepCycles; i++) {
+    sleepMCU(WDTO_8S);
     lastTransmittedCycles++;
     
-    // If button pressed, fall through to main loop
+    // If button pressed, fall through to main loop. Shift after a cut sleep tells nothing of the watchdog.
     if (forceSend) {
+      #ifdef ENABLE_SLOTS
+      slotSleeps = 0;
+      #endif
       return;
     }
   }
+  
+  #ifdef ENABLE_SLOTS
+  if (slotSleeps < 255) {
+    slotSleeps++;
+  }
+  #endif
 }
 
-void sleepMCU() {
+void sleepMCU(uint8_t period) {
   // Disable ADC
   ADCSRA &= ~_BV(ADEN);
 
-  // Set watchdog timer to 8s and interrupt only mode
-  wdt_enable(WDTO_8S);
+  // Set watchdog timer to given period (WDTO_*) and interrupt only mode
+  wdt_enable(period);
   WDTCSR |= _BV(WDIE);
   
   // Initiate actual sleep
@@ -566,11 +977,69 @@ ISR (WDT_vect) {
   wdt_disable();
 }
 
+void sleepMillis(uint8_t ms) {
+  // Watchdog is too coarse for short waits and without a 32 kHz crystal Timer2 cannot wake up from power-save,
+  // so idle with Timer2 counting system clock (clk/1024). At 1 MHz one tick is ~1 ms, at most ~32 ms at 8 MHz.
+  // Round up so that a wait is never shorter than asked (2 ms at 1 MHz would otherwise be 1 tick)
+  uint32_t ticks = ((F_CPU / 1024) * ms + 999) / 1000;
+  
+  timerElapsed = false;
+  TCCR2A = _BV(WGM21); // CTC mode
+  TCCR2B = 0;
+  TCNT2 = 0;
+  OCR2A = (ticks > 0) ? (ticks - 1) : 0;
+  TIFR2 = _BV(OCF2A);
+  TIMSK2 = _BV(OCIE2A);
+  TCCR2B = _BV(CS22) | _BV(CS21) | _BV(CS20);
+  
+  while (!timerElapsed) {
+    idleMCU();
+  }
+  
+  TCCR2B = 0;
+  TIMSK2 = 0;
+}
+
+// Handle Timer2 compare match interrupt
+ISR (TIMER2_COMPA_vect) {
+  timerElapsed = true;
+}
+
 void wakeUpFromBtn() {
   forceSend = true;
 }
 
+#ifdef ENABLE_REMOTE_CONFIG
+void applyConfig(uint8_t parameter, uint16_t value) {
+  // Too short sleep time or zero force send interval is not valid (0xFFFF returns to the setting)
+  if ((parameter >= CONFIG_PARAMETERS) || ((parameter == 0) && (value < CONFIG_MIN_SLEEP)) || ((parameter == 1) && (value == 0))) {
+    return;
+  }
+  
+  EEPROM.put(CONFIG_START + parameter * 2, value);
+  setTimings();
+  appliedConfig = parameter + 1;
+}
+
+uint16_t getConfig(uint8_t parameter, uint16_t value) {
+  uint16_t config;
+  EEPROM.get(CONFIG_START + parameter * 2, config);
+  
+  // Erased EEPROM means parameter has not been written
+  return (config == 0xFFFF) ? value : config;
+}
+#endif
+
 void setTimings() {
+  // Take configuration written to gateway instead of settings
+  #ifdef ENABLE_REMOTE_CONFIG
+  sleepTime = getConfig(0, SLEEP_TIME);
+  forceTransmitInterval = getConfig(1, FORCE_SEND);
+  sensor1Threshold = getConfig(2, TEMPERATURE_TH);
+  sensor2Threshold = getConfig(3, HUMIDITY_TH);
+  sensor3Threshold = getConfig(4, (sensorMode == (MODE_SI7021 | MODE_NTC)) ? TEMPERATURE_TH : PRESSURE_TH);
+  #endif
+  
   // Change sleepTime to one sleep cycle if in debug mode, else use provided value
   if (isDebugMode) {
     sleepTime = 8;
@@ -582,11 +1051,17 @@ void setTimings() {
     neededSleepCycles = 1;
   }
   
+  // Check if we are in batching mode
+  isBatchMode = ((BATCH_SAMPLES >= 2) && (BATCH_SAMPLES <= BATCH_MAX_SAMPLES) && !isDebugMode);
+  
   // Check if we are in threshold mode
-  isThresholdMode = (((sensor1Threshold > 0) || (sensor2Threshold > 0) || (sensor3Threshold > 0)) && !isDebugMode);
+  isThresholdMode = (((sensor1Threshold > 0) || (sensor2Threshold > 0) || (sensor3Threshold > 0)) && !isDebugMode && !isBatchMode);
 
   // Calculate advertised transmit interval
-  if (isThresholdMode) {
+  if (isBatchMode) {
+    transmitInterval = ceil(sleepTime * BATCH_SAMPLES / 60.0);
+  }
+  else if (isThresholdMode) {
     transmitInterval = forceTransmitInterval;
   }
   else {
@@ -647,21 +1122,75 @@ void readIds() {
   }
 }
 
-void readSI7021() {
-  si7021_env data = sensorSI7021.getHumidityAndTemperature();
-  sensor1Value = round(data.celsiusHundredths / 10.0);
-  sensor2Value = round(data.humidityBasisPoints / 10.0);
+void readSensors() {
+  // Slow conversions are started first and everything else is done while they are running, sleeping
+  // in between. This way node is awake only about as long as the slowest conversion takes.
+  uint32_t conversionStarted = millis();
+  
+  if (sensorMode & MODE_SI7021) {
+    startSI7021();
+  }
+  else if (sensorMode & MODE_BME280) {
+    sensorBME280.setMode(MODE_FORCED); // Wake BME280 and start measurement
+  }
+  
+  // Let NTC voltage divider settle
+  if (sensorMode & MODE_NTC) {
+    sensorNTC.powerUp();
+    sleepMillis(NTC_SETTLE_TIME);
+    readNTC();
+  }
+  
+  // Bandgap is selected only after NTC is read, as it needs ADC multiplexer for itself while settling
+  selectBandgap();
+  sleepMillis(VREF_SETTLE_TIME);
+  readBatteryVoltage();
+  
+  // Wait for the rest of humidity sensor conversion (with timeout)
+  if (sensorMode & MODE_SI7021) {
+    while (!readSI7021() && ((millis() - conversionStarted) < SENSOR_TIMEOUT)) {
+      sleepMillis(1);
+    }
+  }
+  else if (sensorMode & MODE_BME280) {
+    while (sensorBME280.isMeasuring() && ((millis() - conversionStarted) < SENSOR_TIMEOUT)) {
+      sleepMillis(1);
+    }
+    readBME280();
+  }
+}
+
+void startSI7021() {
+  // SI7021 library only measures in hold master mode, which keeps uC busy on clock stretched I2C bus,
+  // so start measurement directly and read it when ready
+  Wire.beginTransmission(SI7021_ADDRESS);
+  Wire.write(SI7021_RH_START);
+  Wire.endTransmission();
 }
 
-void readBME280() {
-  sensorBME280.setMode(MODE_FORCED); // Wake BME280 and start measurement
-  delay(8); // According to datasheet, typical temp, hum and pressure conversion is 8ms
+bool readSI7021() {
+  // SI7021 does not acknowledge reads until measurement is done
+  if (Wire.requestFrom(SI7021_ADDRESS, 2) != 2) {
+    return false;
+  }
+  uint16_t humidityRaw = ((uint16_t)Wire.read() << 8) | Wire.read();
   
-  uint32_t timeout = millis();
-  while (sensorBME280.isMeasuring() && ((millis() - timeout) < 100)) { // Wait more (with timeout) if conversion is still in progress
-    delay(1);
+  // Temperature is measured along with humidity, so it is ready right away
+  Wire.beginTransmission(SI7021_ADDRESS);
+  Wire.write(SI7021_TEMP_READ);
+  Wire.endTransmission();
+  if (Wire.requestFrom(SI7021_ADDRESS, 2) != 2) {
+    return false;
   }
+  uint16_t temperatureRaw = ((uint16_t)Wire.read() << 8) | Wire.read();
+  
+  sensor1Value = si7021Temperature(temperatureRaw);
+  sensor2Value = si7021Humidity(humidityRaw);
+  return true;
+}
 
+void readBME280() {
+  // Conversion has been started by readSensors()
   sensor1Value = round(sensorBME280.readTempC() * 10.0);
   sensor2Value = round(sensorBME280.readFloatHumidity() * 10.0);
   sensor3Value = round(sensorBME280.readFloatPressure() / 10.0);
@@ -676,7 +1205,7 @@ void readNTC() {
   }
 }
 
-void readBatteryVoltage() {
+void selectBandgap() {
   // Read 1.1V reference against AVcc
   // set the reference to Vcc and the measurement to the internal 1.1V reference
   #if defined(__AVR_ATmega32U4__) || defined(__AVR_ATmega1280__) || defined(__AVR_ATmega2560__)
@@ -688,8 +1217,10 @@ void readBatteryVoltage() {
   #else
     ADMUX = _BV(REFS0) | _BV(MUX3) | _BV(MUX2) | _BV(MUX1);
   #endif  
- 
-  delay(2); // Wait for Vref to settle
+}
+
+void readBatteryVoltage() {
+  // Bandgap must have been selected at least VREF_SETTLE_TIME earlier
   ADCSRA |= _BV(ADSC); // Start conversion
   while (bit_is_set(ADCSRA,ADSC)); // measuring
  
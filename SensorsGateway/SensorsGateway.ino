@@ -37,6 +37,18 @@
  */
 //#define ENABLE_LOW_RATE
 
+/*
+ * ### ADAPTIVE DATA RATE ###
+ *
+ * Define whether gateway should listen to all data rates and recommend nodes the fastest data rate their link allows.
+ * Gateway scans data rates one at a time using channel activity detection, which may delay Modbus responses by
+ * up to 70 ms. Nodes must have ENABLE_ADR as well. Overrides ENABLE_LOW_RATE. To disable, comment out ENABLE_ADR.
+ *
+ * ADR_MARGIN: How many dB of SNR is needed above the demodulation limit of a data rate to use it.
+ */
+//#define ENABLE_ADR
+#define ADR_MARGIN    10
+
 /*
  * ### FREQUENCY ###
  *
@@ -64,6 +76,32 @@
  */
 #define DELETE_OLD_NODES  0
 
+/*
+ * ### TRANSMIT SLOTS ###
+ *
+ * Define length in seconds of the frame over which node transmits are spread. Every node gets its own slot
+ * in the frame based on its ID, and acks tell nodes how much to shift their next transmit to hit the slot.
+ * This reduces collisions in large networks. Node intervals should be multiples of the frame length.
+ * Only nodes asking for slots are affected.
+ *
+ * Set to zero to disable. Limited to 0-60.
+ */
+#define SLOT_FRAME        0
+
+/*
+ * ### PULSE DEBOUNCE ###
+ *
+ * Define for every pulse input how many microseconds must pass between pulses at least. Falling edges
+ * closer to the previous pulse are treated as contact bounce and ignored. This also limits the highest
+ * countable pulse rate: 1000000 allows 1 pulse per second, 50000 allows 20 pulses per second.
+ *
+ * Meters with open collector (S0) outputs do not bounce and can use short times, reed switches
+ * usually need longer ones.
+ */
+#define P1_DEBOUNCE     1000000
+#define P2_DEBOUNCE     1000000
+#define P3_DEBOUNCE     1000000
+
 /*
  * ### EXTERNAL INTERRUPT ###
  *
@@ -74,10 +112,40 @@
  * trigger external interrupt. Otherwise every new message will trigger the interrupt.
  * Define EXT_INTERRUPT_USE_INT_PULLUP to use internal (weak) Atmega328P pull-up resistor, otherwise
  * make sure to have pull-up resistor in the upstream device.
+ *
+ * Define EXT_INTERRUPT_RULES if you want the interrupt to be triggered only when a threshold rule fires.
+ * Each rule is {node id, register, condition, value, hysteresis}, where register is relative to the first
+ * register of the node (for example 1 is temperature of a battery node) and condition is one of '>', '<', '='
+ * and '!' (not equal). A rule fires when its condition becomes true and is armed again after the value has
+ * moved hysteresis back over the value. At most 16 rules. Rules are kept in EEPROM and written there from
+ * this list when gateway is started with programming jumper set. Fired rules are in gateway register 25.
  */
 //#define ENABLE_EXT_INTERRUPT
 //#define EXT_INTERRUPT_ONLY_IMPORTANT
 //#define EXT_INTERRUPT_USE_INT_PULLUP
+//#define EXT_INTERRUPT_RULES {1, 1, '>', 250, 10}, {2, 3, '<', 2800, 50}
+
+/*
+ * ### PUSH MODE ###
+ *
+ * Define ENABLE_PUSH_MODE to send every new node message over the serial port as soon as it has been saved,
+ * so that the upstream device does not need to poll. The link must be listener only: gateway can not know when
+ * a master is going to send a request, so a polling master may get a pushed message instead of its response,
+ * and with RS-485 its request may be lost while gateway is sending. Pushes are held for PUSH_HOLD_TIME after
+ * every Modbus request, which makes occasional reads with retries work, but do not poll regularly in push mode.
+ * Use only when gateway is the only device on the line (for example connected directly to Raspberry Pi headers).
+ * See read_push.py for the frame format and reading messages.
+ */
+//#define ENABLE_PUSH_MODE
+
+/*
+ * ### TIMING INSTRUMENTATION ###
+ *
+ * Define ENABLE_TIMING to measure how long the main loop and its tasks take, how long Modbus requests
+ * wait for a response and radio messages for an ack. Results can be read from Modbus registers 21000-21111.
+ * Takes about 250 bytes of SRAM, which without external SRAM leaves less room for node data.
+ */
+//#define ENABLE_TIMING
 
 /*
  * ####################
@@ -95,6 +163,8 @@
 #include <EEPROM.h>
 #include <NTCSensor.h>
 #include <SensorsMemoryHandler.h>
+#include <CompactPayload.h>
+#include <PulseJournal.h>
 
 #ifdef ENCRYPT_KEY
 #include <RHEncryptedDriver.h>
@@ -113,15 +183,54 @@
 #define GATEWAYID       254     // Gateway ID in radio network, DO NOT CHANGE!
 #define TX_MAX_PWR      20      // Radio dependant, this is for RFM95
 #define TX_MIN_PWR      2       // Radio dependant, this is for RFM95
-#define MAX_PAYLOAD_BUF 50      // This needs to be at least 50 to be on the safe side!
-#define PULSE_MIN       1000    // How many ms between pulses at least
-#define EEPROM_SAVE     3600000 // How often in ms to save pulse values to EEPROM
+#define MAX_PAYLOAD_BUF 58      // This needs to be at least 58 to be on the safe side!
+#define PULSE_IDLE_TIME 3600000000UL // How many us without pulses until input is idle (rate below 1 per hour)
+#define JOURNAL_START   40      // EEPROM journal of pulse values (older firmware saved them to 10, 20 and 30)
+#define JOURNAL_LENGTH  720     // 48 records, rest of EEPROM is used for settings
+#define JOURNAL_SAVE    900000  // How often in ms to save pulse values if they have changed
+#define JOURNAL_PULSES  1000    // Save sooner if a pulse value has grown this much...
+#define JOURNAL_MIN     120000  // ... but not sooner than this many ms after the previous save (every record lasts 48 saves)
+#define RULES_START     760     // EEPROM table of external interrupt rules, right after the journal
+#define RULE_LENGTH     7       // Node id | register | condition | value (2) | hysteresis (2)
+#define MAX_RULES       16      // One bit of every rule in fired and active rules registers
 #define MAX_NR_OF_NODES 100     // Absolute maximum number of nodes (SRAM may limit this even lower)
+#define RX_QUEUE_LENGTH 4       // How many received radio messages can wait to be processed
+#define HISTORY_REGISTER 40000  // History of node id starts at HISTORY_REGISTER + id * HISTORY_REGISTERS
+#define HISTORY_REGISTERS 200   // Room for the whole history ring of any node type (at most 2 + 5 * 35 registers)
+#define LINK_REGISTER   40      // First link statistics register of a node relative to node's first register
+#define LINK_REGISTERS  6
+#define LINK_STATS_LENGTH 9     // Link statistics saved after the record of a node (only with external SRAM)
+#define CHANGED_REGISTER 20000  // First register of changed nodes block
+#define UPDATED_REGISTER 30     // First register of updated nodes bitmap
+#define UPDATED_REGISTERS ((MAX_NR_OF_NODES / 16) + 1) // 16 nodes per register
+#define COUNTER_REGISTER 40     // First register of node update counters
+#define COUNTER_REGISTERS ((MAX_NR_OF_NODES / 2) + 1)  // 2 nodes per register
+#define MB_LARGE_BUFFER 256     // Modbus frame buffer size with external SRAM (Modbus maximum)
+#define MB_SMALL_BUFFER (MAX_PAYLOAD_BUF + 5) // Modbus frame buffer size without external SRAM, fits all of payloadBuffer
+#define NR_OF_RATES     3       // Data rates in adaptive data rate
+#define TIMING_REGISTER 21000   // First register of timing instrumentation
+#define TIMING_RESET_REGISTER 21200 // Same registers, reading them resets the metrics read
+#define TIMING_METRICS  7       // Measured times, see TIMING_LOOP...TIMING_ACK
+#define TIMING_BUCKETS  12      // Histogram buckets of every metric, doubling from 64 us
+#define TIMING_METRIC_REGISTERS (4 + TIMING_BUCKETS) // Maximum, average and histogram
+#define TIMING_REGISTERS (TIMING_METRICS * TIMING_METRIC_REGISTERS)
+#define CONFIG_REGISTER 22000   // First register of node configuration writes, node id * 10 + parameter
+#define CONFIG_PARAMETERS 5     // Configuration parameters of a node, see README for the list
+#define CONFIG_QUEUE_LENGTH 4   // How many configuration writes can wait for the nodes to send
+#define CONFIG_TRIES    3       // How many acks to send a configuration write in before giving up
+#define CONFIG_FLAGS    0x0F    // Application flags in radio header, parameter + 1 of a write node has applied
+#define RATE_LOCK_TIME  500     // How many ms to listen to a data rate after detecting activity on it
 
 // Payload lengths for different nodes, DO NOT CHANGE!
 #define NODE_TYPE_BATT_LENGTH    11
-#define NODE_TYPE_PULSE_K_LENGTH 39
-#define NODE_TYPE_PULSE_LENGTH   15
+#define NODE_TYPE_PULSE_K_LENGTH 45
+#define NODE_TYPE_PULSE_LENGTH   21
+#define NODE_TYPE_BATCH_LENGTH   39
+#define PULSE_RATES_LENGTH       6 // Pulse rates at the end of pulse messages, left out by older nodes
+#define PUSH_FUNCTION   100     // User defined Modbus function code of pushed messages, sent from address 0
+#define PUSH_HEADER_LENGTH 7    // Address | function | node id | sequence | RSSI | SNR | message length
+#define PUSH_HOLD_TIME  1000    // Milliseconds to hold pushes after a Modbus request, in case master sends more
+#define PUSH_BUFFER_SIZE (PUSH_HEADER_LENGTH + NODE_TYPE_PULSE_K_LENGTH + 2) // Frame buffer needed for the longest message
 
 /* ### SETTINGS ### */
 const float frequency = FREQUENCY; // Radio transmit frequency (depends on module in use and legislation)
@@ -146,11 +255,137 @@ RHDatagram radioManager(rf95Driver);
 SimpleModbusAsync modbus;
 
 // NTC instance
-NTCSensor sensorNTC(NTC_NO_ENABLE_PIN, P3_PIN);
+NTCSensor sensorNTC(NTC_NO_ENABLE_PIN, P3_PIN, false); // No sleep sampling as it would stop Modbus serial
 
 // Memory handler instance
 SensorsMemoryHandler memoryHandler(SRAM_NSS);
 
+/*
+ * Register maps of node types. Every register is described by two bytes: offset of the source byte(s)
+ * in the saved record and how the register is formed. Saved record is the received payload with received
+ * time (in minutes) added to bytes 1-2.
+ */
+#define REG_BYTE      0 // One byte, 8 MSB are zero
+#define REG_WORD      1 // Two bytes, MSB first
+#define REG_LAST_SEEN 2 // Minutes since received time in the two bytes
+#define REG_DELTA     0x80 // Signed 8 bit delta added to the word at offset given in 7 LSB
+
+// Battery types
+const uint8_t batteryRegisterMap[] PROGMEM = {
+  1, REG_LAST_SEEN, // Last received
+  3, REG_WORD,      // Battery voltage
+  5, REG_BYTE,      // Transmit power
+  6, REG_BYTE,      // Transmit interval
+  0, REG_BYTE,      // Header
+  7, REG_WORD,      // Temperature
+  9, REG_WORD,      // Relative humidity
+  11, REG_WORD      // Pressure / temperature
+};
+
+// Pulse with Kamstrup
+const uint8_t pulseKRegisterMap[] PROGMEM = {
+  1, REG_LAST_SEEN, // Last received
+  3, REG_BYTE,      // Transmit power
+  4, REG_BYTE,      // Transmit interval
+  0, REG_BYTE,      // Header
+  5, REG_WORD,      // Pulse 1
+  7, REG_WORD,
+  9, REG_WORD,      // Pulse 2
+  11, REG_WORD,
+  13, REG_WORD,     // Pulse 3 / temperature
+  15, REG_WORD,
+  17, REG_WORD,     // Heat energy
+  19, REG_WORD,
+  21, REG_WORD,     // Actual flow
+  23, REG_WORD,
+  25, REG_WORD,     // Volume
+  27, REG_WORD,
+  29, REG_WORD,     // Actual power
+  31, REG_WORD,
+  33, REG_WORD,     // Actual t1
+  35, REG_WORD,
+  37, REG_WORD,     // Actual t2
+  39, REG_WORD,
+  41, REG_WORD,     // Pulse 1 rate
+  43, REG_WORD,     // Pulse 2 rate
+  45, REG_WORD      // Pulse 3 rate
+};
+
+// Pulse
+const uint8_t pulseRegisterMap[] PROGMEM = {
+  1, REG_LAST_SEEN, // Last received
+  3, REG_BYTE,      // Transmit power
+  4, REG_BYTE,      // Transmit interval
+  0, REG_BYTE,      // Header
+  5, REG_WORD,      // Pulse 1
+  7, REG_WORD,
+  9, REG_WORD,      // Pulse 2
+  11, REG_WORD,
+  13, REG_WORD,     // Pulse 3 / temperature
+  15, REG_WORD,
+  17, REG_WORD,     // Pulse 1 rate
+  19, REG_WORD,     // Pulse 2 rate
+  21, REG_WORD      // Pulse 3 rate
+};
+
+// Battery batch
+const uint8_t batchRegisterMap[] PROGMEM = {
+  1, REG_LAST_SEEN, // Last received
+  3, REG_WORD,      // Battery voltage
+  5, REG_BYTE,      // Transmit power
+  6, REG_BYTE,      // Transmit interval
+  0, REG_BYTE,      // Header
+  7, REG_BYTE,      // Header of the sampling node type
+  8, REG_BYTE,      // Samples in batch
+  9, REG_WORD,      // Sample interval
+  11, REG_WORD,     // Sample 1 (oldest)
+  13, REG_WORD,
+  15, REG_WORD,
+  17, REG_DELTA | 11, // Sample 2
+  18, REG_DELTA | 13,
+  19, REG_DELTA | 15,
+  20, REG_DELTA | 11, // Sample 3
+  21, REG_DELTA | 13,
+  22, REG_DELTA | 15,
+  23, REG_DELTA | 11, // Sample 4
+  24, REG_DELTA | 13,
+  25, REG_DELTA | 15,
+  26, REG_DELTA | 11, // Sample 5
+  27, REG_DELTA | 13,
+  28, REG_DELTA | 15,
+  29, REG_DELTA | 11, // Sample 6
+  30, REG_DELTA | 13,
+  31, REG_DELTA | 15,
+  32, REG_DELTA | 11, // Sample 7
+  33, REG_DELTA | 13,
+  34, REG_DELTA | 15,
+  35, REG_DELTA | 11, // Sample 8
+  36, REG_DELTA | 13,
+  37, REG_DELTA | 15,
+  38, REG_DELTA | 11, // Sample 9
+  39, REG_DELTA | 13,
+  40, REG_DELTA | 15
+};
+
+#ifdef ENABLE_ADR
+// Data rates from the slowest to the fastest, DO NOT CHANGE as nodes have the same table
+const RH_RF95::ModemConfig dataRates[NR_OF_RATES] = {
+  {0x78, 0xc4, 0x0c}, // SF12, 125 kHz, CR 4/8 (same as low rate)
+  {0x72, 0x94, 0x04}, // SF9, 125 kHz, CR 4/5
+  {0x72, 0x74, 0x04}  // SF7, 125 kHz, CR 4/5 (same as default)
+};
+// Lowest SNR in dB each data rate can demodulate
+const int8_t rateLimits[NR_OF_RATES] = {-20, -12, -7};
+#endif
+
+// Sizes of the payload fields following the header for decoding compact messages
+const uint8_t batteryCompactFields[] = {2, 1, 1, 2, 2, 2};
+const uint8_t pulseKCompactFields[] = {1, 1, 4, 4, 4, 4, 4, 4, 4, 4, 4, 2, 2, 2};
+const uint8_t pulseCompactFields[] = {1, 1, 4, 4, 4, 2, 2, 2};
+CompactPayload batteryCompact(batteryCompactFields, sizeof(batteryCompactFields));
+CompactPayload pulseKCompact(pulseKCompactFields, sizeof(pulseKCompactFields));
+CompactPayload pulseCompact(pulseCompactFields, sizeof(pulseCompactFields));
+
 // Struct to hold gateway metadata
 struct {
   uint16_t errors;
@@ -170,23 +405,108 @@ struct {
   bool outOfMemory;
   uint16_t uptime;
   uint8_t lastRcvdNode;
+  uint16_t droppedMessages;
+  uint16_t configsApplied;
+  uint16_t configsFailed;
 } gwMetaData;
 
+#ifdef ENABLE_TIMING
+// Timing instrumentation metrics
+#define TIMING_LOOP     0 // Period of loop()
+#define TIMING_RADIO    1 // Time spent in checkRadio()
+#define TIMING_PROCESS  2 // Time spent in processReceived()
+#define TIMING_MODBUS   3 // Time spent in checkModbus()
+#define TIMING_SWEEP    4 // Time spent in updateLastReceived()
+#define TIMING_RESPONSE 5 // From received Modbus request to sent response
+#define TIMING_ACK      6 // From received radio message to sent ack
+struct {
+  uint32_t max;                        // Longest time in microseconds
+  uint32_t sum;                        // Sum of times for average, halved with count when either gets full
+  uint16_t count;
+  uint16_t histogram[TIMING_BUCKETS];  // Bucket 0 is under 64 us, bucket n from 32 << n us, the last one has the rest
+} timings[TIMING_METRICS];
+uint32_t loopStarted;      // micros() at the start of the previous loop()
+uint32_t requestReceived;  // micros() when the latest Modbus request was received
+#endif
+
+// Queue of received radio messages waiting to be processed
+struct {
+  uint8_t from;
+  uint8_t length;
+  uint8_t sequence; // Message sequence number in radio header (0 = node does not number messages)
+  int8_t rssi;
+  int8_t snr;
+  uint8_t data[NODE_TYPE_PULSE_K_LENGTH + 1]; // One extra byte to detect too long messages
+} rxQueue[RX_QUEUE_LENGTH];
+uint8_t rxQueueTail = 0;  // Oldest message in the queue
+uint8_t rxQueueCount = 0; // Messages in the queue
+
+// Queue of configuration writes waiting to be sent to nodes in acks
+struct {
+  uint8_t node;     // 0 = free
+  uint8_t parameter;
+  uint16_t value;
+  uint8_t tries;    // Acks the write has been sent in
+} configQueue[CONFIG_QUEUE_LENGTH];
+
 // Various variables
 uint8_t nodeId; // Node ID for Modbus
 uint8_t payloadBuffer[MAX_PAYLOAD_BUF];
 uint8_t blinkMode = 0;
 uint32_t blinkUpdated = 0;
 bool hasNTC;
-volatile uint32_t pulse1LastFall = 0;
-volatile uint32_t pulse2LastFall = 0;
-volatile uint32_t pulse3LastFall = 0;
-volatile bool pulse1LastValue = true;
-volatile bool pulse2LastValue = true;
-volatile bool pulse3LastValue = true;
+// Pulse capture state of every input
+struct PulseInput {
+  volatile uint32_t* counter; // Pulse counter of the input
+  uint8_t mask;               // Bit of the input in its port
+  uint32_t debounce;          // Minimum microseconds between pulses
+  uint32_t lastFall;          // micros() of the last counted pulse
+  uint32_t interval;          // Microseconds between the last two pulses (0 = not known)
+  bool isIdle;                // No pulses during PULSE_IDLE_TIME, lastFall is not valid
+};
+volatile PulseInput pulseInputs[3] = {
+  {&gwMetaData.pulse1, B01000000, P1_DEBOUNCE, 0, 0, true}, // P1 (port D)
+  {&gwMetaData.pulse2, B10000000, P2_DEBOUNCE, 0, 0, true}, // P2 (port D)
+  {&gwMetaData.pulse3, B00000010, P3_DEBOUNCE, 0, 0, true}  // P3 (port C)
+};
+volatile uint8_t lastPortC; // Port states in the previous pin change interrupt
+volatile uint8_t lastPortD;
 uint32_t lastSaveToEEPROM = 0;
+PulseJournal pulseJournal(JOURNAL_START, JOURNAL_LENGTH);
+uint32_t savedPulses[3] = {0, 0, 0}; // Pulse values in the latest journal record
 uint32_t lastReceivedUpdated = 0;
+uint8_t seenNodes[MAX_NR_OF_NODES]; // Node ids in the order they were last seen, oldest first
+uint8_t seenCount = 0; // Nodes in seenNodes
+const uint16_t seenWindows[3] = {60, 720, 1440}; // Node statistics windows (1 hour, 12 hours, 24 hours) in minutes
+uint8_t seenWindowStarts[3]; // First node in seenNodes seen during each window
+uint8_t lowBatteryNodes[(MAX_NR_OF_NODES / 8) + 1]; // Battery nodes reporting low voltage
+uint8_t changedNodes[(MAX_NR_OF_NODES / 8) + 1]; // Nodes updated since last reported in changed nodes block
+uint8_t reportedChangedNodes[(MAX_NR_OF_NODES / 8) + 1]; // Nodes in the changed nodes block being sent
+struct {
+  uint8_t* payload;      // Block in Modbus frame buffer
+  uint8_t nrOfRegisters; // Registers requested
+  uint8_t position;      // Next free byte
+  uint8_t records;       // Records added
+  uint8_t pending;       // Changed nodes that did not fit
+  uint8_t type;          // Node type being read
+} changedBlock; // Changed nodes block being built by addChangedNode()
+uint8_t updatedNodes[UPDATED_REGISTERS * 2]; // Nodes updated since last sent in updated nodes bitmap
+uint8_t reportedNodes[UPDATED_REGISTERS * 2]; // Nodes in the bitmap response being sent
+uint8_t updateCounters[COUNTER_REGISTERS * 2]; // Incremented every time node data is saved
 uint8_t millisOverflows = 0;
+uint16_t firedRules = 0; // External interrupt rules fired since last read from gateway register 25
+uint16_t reportedRules = 0; // Fired rules in the response being sent
+uint16_t activeRules = 0; // External interrupt rules whose condition is currently true
+#ifdef ENABLE_PUSH_MODE
+uint8_t pushNodes[(MAX_NR_OF_NODES / 8) + 1]; // Nodes whose latest message could not be pushed yet
+bool isPushSending = false; // Frame being sent is a pushed message, not a Modbus response
+uint32_t lastModbusRequest = 0; // millis() of the latest Modbus request
+#endif
+#ifdef ENABLE_ADR
+uint8_t listenedRate = 0; // Data rate radio is currently listening to
+bool isRateLocked = false; // Activity was detected on the listened data rate
+uint32_t rateLockedMillis = 0; // When activity was detected
+#endif
 
 void setup() {
   // Check if pulse 3 is NTC
@@ -222,6 +542,11 @@ void setup() {
     if (!digitalRead(BTN_PIN)) {
       clearPulsesFromEEPROM();
     }
+    
+    // Write external interrupt rules from settings to EEPROM
+    #ifdef EXT_INTERRUPT_RULES
+    writeRulesToEEPROM();
+    #endif
   }
   pinMode(JMP_PIN, INPUT);
   
@@ -236,13 +561,17 @@ void setup() {
   }
   rf95Driver.setFrequency(frequency);
   rf95Driver.setTxPower(TX_MAX_PWR); // 5-23 dBm
-  #ifdef ENABLE_LOW_RATE
+  #if defined ENABLE_ADR
+  rf95Driver.setModemRegisters(&dataRates[listenedRate]);
+  #elif defined ENABLE_LOW_RATE
   rf95Driver.setModemConfig(RH_RF95::Bw125Cr48Sf4096);
   #endif
   
   readPulsesFromEEPROM();
   
   // Set pulse input interrupts
+  lastPortC = PINC;
+  lastPortD = PIND;
   PCICR |= B00000100; // P1 and P2 (port D)
   if (!hasNTC) {
     PCICR |= B00000010; // P3 (port C)
@@ -256,6 +585,9 @@ void setup() {
     PCMSK1 |= B00000010;  // P3
   }
   
+  // Initialize memory handler (before Modbus as frame buffer size depends on memory available)
+  memoryHandler.init();
+  
   // Initialize Modbus
   
   // Read Modbus address if not already set
@@ -265,38 +597,83 @@ void setup() {
   nodeId = MB_ADDRESS;
   #endif
   
-  modbus.setComms(&Serial, 38400, MAX_DE_PIN);
+  // With external SRAM internal SRAM is not needed for node data, so use it for large frames. Without it,
+  // frames must still fit the longest response (all gateway registers) and pushed messages.
+  #ifdef ENABLE_PUSH_MODE
+  modbus.setComms(&Serial, 38400, MAX_DE_PIN, memoryHandler.hasExternalSRAM() ? MB_LARGE_BUFFER : max(MB_SMALL_BUFFER, PUSH_BUFFER_SIZE));
+  #else
+  modbus.setComms(&Serial, 38400, MAX_DE_PIN, memoryHandler.hasExternalSRAM() ? MB_LARGE_BUFFER : MB_SMALL_BUFFER);
+  #endif
   modbus.setAddress(nodeId);
   
-  // Initialize memory handler
-  memoryHandler.init();
-  
   // Initialize external interrupt pin if in use
   #ifdef ENABLE_EXT_INTERRUPT
   setExternalInterrupt(false);
   #endif
+  
+  #ifdef ENABLE_TIMING
+  loopStarted = micros();
+  #endif
 }
 
 void loop() {
+  #ifdef ENABLE_TIMING
+  uint32_t timingStart = recordTiming(TIMING_LOOP, loopStarted);
+  loopStarted = timingStart;
+  #endif
   
-  // Check radio status and handle possible messages
+  // Check radio status, ack and queue possible messages
   checkRadio();
+  #ifdef ENABLE_TIMING
+  timingStart = recordTiming(TIMING_RADIO, timingStart);
+  #endif
+  
+  // Handle one queued message
+  processReceived();
+  #ifdef ENABLE_TIMING
+  timingStart = recordTiming(TIMING_PROCESS, timingStart);
+  #endif
   
   // Check Modbus status and handle possible frames
   checkModbus();
+  #ifdef ENABLE_TIMING
+  timingStart = recordTiming(TIMING_MODBUS, timingStart);
+  #endif
+  
+  // Check radio again so that a burst of messages is not kept waiting behind the other tasks
+  checkRadio();
+  #ifdef ENABLE_TIMING
+  recordTiming(TIMING_RADIO, timingStart);
+  #endif
+  
+  // Push messages that could not be pushed when they were received
+  #ifdef ENABLE_PUSH_MODE
+  updatePush();
+  #endif
   
   // Update led blink
   updateBlink();
   
-  // Save current pulse values to EEPROM if enough time has passed
-  if ((millis() - lastSaveToEEPROM) > (uint32_t)EEPROM_SAVE) {
+  // Notice long pauses in pulses
+  updatePulseInputs();
+  
+  // Save pulse values to EEPROM journal if they have changed enough or for long enough
+  if (isPulseSaveNeeded()) {
     savePulsesToEEPROM();
-    lastSaveToEEPROM = millis();
   }
   
+  // Continue writing journal record in the background
+  pulseJournal.update();
+  
   // Update last received times and check battery levels
   if ((millis() - lastReceivedUpdated) > 10000) {
+    #ifdef ENABLE_TIMING
+    timingStart = micros();
+    #endif
     updateLastReceived();
+    #ifdef ENABLE_TIMING
+    recordTiming(TIMING_SWEEP, timingStart);
+    #endif
     lastReceivedUpdated = millis();
   }
   
@@ -307,130 +684,449 @@ void loop() {
 }
 
 void checkRadio() {
+  #ifdef ENABLE_ADR
+  scanDataRates();
+  #endif
+  
   if (radioManager.available()) {
-    uint8_t len = MAX_PAYLOAD_BUF;
     uint8_t from;
     uint8_t to;
+    uint8_t sequence;
+    uint8_t flags;
+    #ifdef ENABLE_TIMING
+    uint32_t messageReceived = micros();
+    #endif
+    
+    // If queue is full, receive only the header to free the radio and do not ack, so the node will retransmit
+    if (rxQueueCount == RX_QUEUE_LENGTH) {
+      uint8_t header;
+      uint8_t len = 1;
+      
+      if (radioManager.recvfrom(&header, &len, &from, &to) && (to == GATEWAYID)) {
+        gwMetaData.droppedMessages++;
+      }
+      return;
+    }
+    
+    // Receive straight to the first free slot in the queue
+    uint8_t slot = (rxQueueTail + rxQueueCount) % RX_QUEUE_LENGTH;
+    uint8_t len = sizeof(rxQueue[slot].data);
     
     // If received a message sent to us
-    if (radioManager.recvfrom(payloadBuffer, &len, &from, &to)) {
+    if (radioManager.recvfrom(rxQueue[slot].data, &len, &from, &to, &sequence, &flags)) {
       
       // Ignore broadcasts
       if (to != GATEWAYID) {
         return;
       }
       
+      uint8_t header = rxQueue[slot].data[0];
+      
+      // Decode compact message back into a normal one in place
+      if (header & COMPACT_FLAG) {
+        len = expandCompact(from, rxQueue[slot].data, len);
+      }
+      
       // Ack immediately if ack is requested
-      if (payloadBuffer[0] & B01000000) {
-        uint8_t tempBuffer[2];
+      if (header & B01000000) {
+        uint8_t tempBuffer[8];
+        uint8_t ackLength = 2;
         
         // Set this is ack bit
         tempBuffer[0] = B00000001;
+        // If compact message could not be decoded, ask node to send a full message
+        if (len == 0) {
+          tempBuffer[0] |= B00000010;
+        }
         // Report back received RSSI
         tempBuffer[1] = rf95Driver.lastRssi();
         
+        // If node asks for extended ack, add fields in use and mark them valid
+        if (header & B10000000) {
+          memset(tempBuffer + 2, 0, 3);
+          ackLength = 5;
+          
+          #if SLOT_FRAME > 0
+          // Shift to the next transmit
+          int16_t slotShift = getSlotShift(from);
+          tempBuffer[0] |= B00000100;
+          tempBuffer[2] = (slotShift >> 8);
+          tempBuffer[3] = slotShift;
+          #endif
+          
+          #ifdef ENABLE_ADR
+          // Recommended data rate
+          tempBuffer[0] |= B00001000;
+          tempBuffer[4] = getRecommendedRate(listenedRate);
+          #endif
+          
+          // Configuration write waiting for the node
+          int8_t config = getNodeConfig(from, flags & CONFIG_FLAGS);
+          if (config >= 0) {
+            tempBuffer[0] |= B00010000;
+            tempBuffer[5] = configQueue[config].parameter;
+            tempBuffer[6] = (configQueue[config].value >> 8);
+            tempBuffer[7] = configQueue[config].value;
+            ackLength = 8;
+          }
+        }
+        
         // Send ack
-        radioManager.sendto(tempBuffer, 2, from);
+        radioManager.sendto(tempBuffer, ackLength, from);
+        #ifdef ENABLE_TIMING
+        recordTiming(TIMING_ACK, messageReceived);
+        #endif
+      }
+      
+      // Check that ID is valid and message is not empty or longer than any known type, otherwise no need to queue it
+      if ((from > MAX_NR_OF_NODES) || (len == 0) || (len > NODE_TYPE_PULSE_K_LENGTH)) {
+        return;
+      }
+      
+      // Queue message, it is processed later in processReceived()
+      rxQueue[slot].from = from;
+      rxQueue[slot].length = len;
+      rxQueue[slot].sequence = sequence;
+      rxQueue[slot].rssi = rf95Driver.lastRssi();
+      rxQueue[slot].snr = rf95Driver.lastSNR();
+      rxQueueCount++;
+    }
+  }
+}
+
+#ifdef ENABLE_ADR
+void scanDataRates() {
+  // Do not disturb sending an ack or a received message waiting to be acked with the same data rate
+  if ((rf95Driver.mode() == RHGenericDriver::RHModeTx) || radioManager.available()) {
+    return;
+  }
+  
+  // Keep listening after detected activity until reception would have started and as long as it goes on
+  if (isRateLocked) {
+    if (((millis() - rateLockedMillis) < RATE_LOCK_TIME) || (rf95Driver.spiRead(RH_RF95_REG_18_MODEM_STAT) & B00001011)) {
+      return;
+    }
+    isRateLocked = false;
+  }
+  
+  // Move to the next data rate and check for activity. Radio is set back to receive in checkRadio().
+  listenedRate = (listenedRate + 1) % NR_OF_RATES;
+  rf95Driver.setModeIdle();
+  rf95Driver.setModemRegisters(&dataRates[listenedRate]);
+  
+  if (rf95Driver.isChannelActive()) {
+    isRateLocked = true;
+    rateLockedMillis = millis();
+  }
+}
+
+uint8_t getRecommendedRate(uint8_t rate) {
+  int8_t snr = rf95Driver.lastSNR();
+  
+  // Step faster if the next data rate would still have enough margin
+  if ((rate < (NR_OF_RATES - 1)) && ((snr - rateLimits[rate + 1]) >= ADR_MARGIN)) {
+    return rate + 1;
+  }
+  // Step slower if margin has dropped clearly (3 dB hysteresis to avoid toggling)
+  if ((rate > 0) && ((snr - rateLimits[rate]) < (ADR_MARGIN - 3))) {
+    return rate - 1;
+  }
+  
+  return rate;
+}
+#endif
+
+#if SLOT_FRAME > 0
+int16_t getSlotShift(uint8_t id) {
+  const uint32_t frame = SLOT_FRAME * 1000UL;
+  
+  // Slots are spread evenly over the frame by node ID
+  uint32_t slot = (uint32_t)id * frame / (MAX_NR_OF_NODES + 1);
+  
+  // Milliseconds from now to the slot, taking the shorter way
+  int32_t shift = (slot + frame - (millis() % frame)) % frame;
+  if (shift > (int32_t)(frame / 2)) {
+    shift -= frame;
+  }
+  
+  return shift;
+}
+#endif
+
+uint8_t expandCompact(uint8_t from, uint8_t* message, uint8_t length) {
+  uint8_t type = message[0] & B00000111;
+  CompactPayload* compact = getCompactPayload(type);
+  
+  if ((compact == NULL) || (from > MAX_NR_OF_NODES)) {
+    return 0;
+  }
+  
+  uint8_t payloadLength = compact->getPayloadLength();
+  
+  // Compact message is never as long as the full one
+  if (length >= payloadLength) {
+    return 0;
+  }
+  
+  // Reference is the latest message from the node. Look first from the queue, newest first.
+  bool isQueued = false;
+  for (uint8_t i = rxQueueCount; i > 0; i--) {
+    uint8_t slot = (rxQueueTail + i - 1) % RX_QUEUE_LENGTH;
+    if (rxQueue[slot].from == from) {
+      if (rxQueue[slot].length != payloadLength) {
+        return 0;
       }
+      memcpy(payloadBuffer, rxQueue[slot].data, payloadLength);
+      isQueued = true;
+      break;
+    }
+  }
+  
+  // If not queued, use the saved record without the received time
+  if (!isQueued) {
+    if (memoryHandler.getNodeData(from, payloadLength + 2, payloadBuffer, 0) != (payloadLength + 2)) {
+      return 0;
+    }
+    memmove(payloadBuffer + 1, payloadBuffer + 3, payloadLength - 1);
+  }
+  
+  // Reference must be of the same type
+  if ((payloadBuffer[0] & B00000111) != type) {
+    return 0;
+  }
+  
+  // Decode from a copy as the result replaces the compact message
+  uint8_t compactMessage[NODE_TYPE_PULSE_K_LENGTH];
+  memcpy(compactMessage, message, length);
+  
+  return compact->decode(compactMessage, length, payloadBuffer, message);
+}
+
+CompactPayload* getCompactPayload(uint8_t type) {
+  // Battery types
+  if ((type == B00000001) || (type == B00000100) || (type == B00000101) || (type == B00000110)) {
+    return &batteryCompact;
+  }
+  // Pulse with Kamstrup
+  else if (type == B00000010) {
+    return &pulseKCompact;
+  }
+  // Pulse
+  else if (type == B00000011) {
+    return &pulseCompact;
+  }
+  
+  return NULL;
+}
+
+void processReceived() {
+  // If nothing queued
+  if (rxQueueCount == 0) {
+    return;
+  }
+  
+  // Take the oldest message from the queue to payloadBuffer which has room for received time
+  uint8_t from = rxQueue[rxQueueTail].from;
+  uint8_t len = rxQueue[rxQueueTail].length;
+  uint8_t sequence = rxQueue[rxQueueTail].sequence;
+  int8_t rssi = rxQueue[rxQueueTail].rssi;
+  int8_t snr = rxQueue[rxQueueTail].snr;
+  memcpy(payloadBuffer, rxQueue[rxQueueTail].data, len);
+  rxQueueTail = (rxQueueTail + 1) % RX_QUEUE_LENGTH;
+  rxQueueCount--;
+  
+  // Pulse nodes without pulse rates are still accepted, their rates are zero
+  if (((len == (NODE_TYPE_PULSE_LENGTH - PULSE_RATES_LENGTH)) && ((payloadBuffer[0] & B00000111) == B00000011)) ||
+      ((len == (NODE_TYPE_PULSE_K_LENGTH - PULSE_RATES_LENGTH)) && ((payloadBuffer[0] & B00000111) == B00000010))) {
+    memset(payloadBuffer + len, 0, PULSE_RATES_LENGTH);
+    len += PULSE_RATES_LENGTH;
+  }
+  
+  // Process packet
+  
+  // DEBUG - WHAT HAPPENS IF RECEIVED MESSAGE ENCRYPTED WITH WRONG KEY? (can header and length still match?)
+  // Length doesn't seem to match (at least not consistently)
+  // Add CRC8 checksum byte to payload?
+  
+  // Check which type node the message is from to determine data length that is saved to SRAM.
+  // Length is payload plus 2 bytes (last received is added by gateway).
+  
+  uint8_t length = 0;
+  
+  // If length matches battery type message
+  if (len == NODE_TYPE_BATT_LENGTH) {
+    // Sanity check: if header matches any battery type node
+    uint8_t type = payloadBuffer[0] & B00000111;
+    if ((type == B00000001) || (type == B00000100) || (type == B00000101) || (type == B00000110)) {
+      length = NODE_TYPE_BATT_LENGTH + 2;
+    }
+  }
+  // If length matches pulse with Kamstrup type message
+  else if (len == NODE_TYPE_PULSE_K_LENGTH) {
+  // Sanity check: if header matches node type pulse with Kamstrup message
+    if ((payloadBuffer[0] & B00000111) == B00000010) {
+      length = NODE_TYPE_PULSE_K_LENGTH + 2;
+    }
+  }
+  // If length matches pulse type message
+  else if (len == NODE_TYPE_PULSE_LENGTH) {
+  // Sanity check: if header matches node type pulse message
+    if ((payloadBuffer[0] & B00000111) == B00000011) {
+      length = NODE_TYPE_PULSE_LENGTH + 2;
+    }
+  }
+  // If length matches battery batch type message (same as pulse with Kamstrup from older nodes, but those were padded above)
+  else if (len == NODE_TYPE_BATCH_LENGTH) {
+  // Sanity check: if header matches node type battery batch message
+    if ((payloadBuffer[0] & B00000111) == B00000111) {
+      length = NODE_TYPE_BATCH_LENGTH + 2;
+    }
+  }
+  
+  // If the message was from a known type node, save it to memory
+  if (length != 0) {
+    
+    // Check if the node is marked as important
+    bool isImportant = payloadBuffer[0] & B00100000;
+
+    // Reuse the same payloadBuffer to save SRAM
+    
+    // If too much data (sanity check, this should never be possible)
+    if ((length + LINK_STATS_LENGTH) > MAX_PAYLOAD_BUF) {
+      return;
+    }
+    
+    // Move data two indices forward
+    for (uint8_t i = length-1; i > 2; i--) {
+      payloadBuffer[i] = payloadBuffer[i-2];
+    }
+    
+    // Add received time
+    uint16_t tempTime = millis() / 60000; // Convert into minutes
+    payloadBuffer[1] = (tempTime >> 8);
+    payloadBuffer[2] = tempTime;
+    
+    // Add link statistics after the record (internal SRAM has no room for them)
+    uint8_t saveLength = length;
+    bool isDuplicate = false;
+    if (memoryHandler.hasExternalSRAM()) {
+      isDuplicate = updateLinkStats(from, length, sequence, rssi, snr, payloadBuffer + length);
+      saveLength += LINK_STATS_LENGTH;
+    }
+    
+    // Save data to memory
+    uint8_t savedBytes = memoryHandler.saveNodeData(from, saveLength, payloadBuffer);
+    
+    // If saved data differs from the actual data, gateway is out of memory so flag it
+    // Note that this is only updated every time a message is received.
+    if (savedBytes != saveLength) {
+      gwMetaData.outOfMemory = true;
+      
+      // Blink led to indicate received but not saved message
+      setBlink(2);
+    }
+    else {
+      gwMetaData.outOfMemory = false;
       
-      // Process packet
+      // Blink led to indicate received and successfully saved message
+      setBlink(1);
       
-      // DEBUG - WHAT HAPPENS IF RECEIVED MESSAGE ENCRYPTED WITH WRONG KEY? (can header and length still match?)
-      // Length doesn't seem to match (at least not consistently)
-      // Add CRC8 checksum byte to payload?
+      // Set last received node id to gateway metadata
+      gwMetaData.lastRcvdNode = from;
       
-      // Check that ID is valid
-      if (from > MAX_NR_OF_NODES) {
+      // Node was seen now, so keep seenNodes in the order of the received times in records
+      updateSeenNode(from, payloadBuffer);
+      
+      // Retransmit of a message already saved (its ack was lost) only refreshes the record,
+      // it is not a new update. Node uses the retransmit as reference for compact messages.
+      if (isDuplicate) {
         return;
       }
       
-      // Check which type node the message is from to determine data length that is saved to SRAM.
-      // Length is payload plus 2 bytes (last received is added by gateway).
+      // Mark node to be reported in changed nodes block
+      bitSet(changedNodes[from / 8], from % 8);
+      bitClear(reportedChangedNodes[from / 8], from % 8);
       
-      uint8_t length = 0;
+      // Count update and mark node updated. If the node is in a bitmap response being sent,
+      // make sure this update is not cleared once that response has been sent.
+      updateCounters[from]++;
+      bitSet(updatedNodes[from / 8], from % 8);
+      bitClear(reportedNodes[from / 8], from % 8);
       
-      // If length matches battery type message
-      if (len == NODE_TYPE_BATT_LENGTH) {
-        // Sanity check: if header matches any battery type node
-        uint8_t type = payloadBuffer[0] & B00000111;
-        if ((type == B00000001) || (type == B00000100) || (type == B00000101) || (type == B00000110)) {
-          length = NODE_TYPE_BATT_LENGTH + 2;
-        }
-      }
-      // If length matches pulse with Kamstrup type message
-      else if (len == NODE_TYPE_PULSE_K_LENGTH) {
-      // Sanity check: if header matches node type pulse with Kamstrup message
-        if ((payloadBuffer[0] & B00000111) == B00000010) {
-          length = NODE_TYPE_PULSE_K_LENGTH + 2;
-        }
-      }
-      // If length matches pulse type message
-      else if (len == NODE_TYPE_PULSE_LENGTH) {
-      // Sanity check: if header matches node type pulse message
-        if ((payloadBuffer[0] & B00000111) == B00000011) {
-          length = NODE_TYPE_PULSE_LENGTH + 2;
-        }
-      }
+      // Keep the record also in history (only with external SRAM)
+      memoryHandler.appendNodeHistory(from, length, payloadBuffer);
       
-      // If the message was from a known type node, save it to memory
-      if (length != 0) {
-        
-        // Check if the node is marked as important
-        bool isImportant = payloadBuffer[0] & B00100000;
-
-        // Reuse the same payloadBuffer to save SRAM
-        
-        // If too much data (sanity check, this should never be possible)
-        if (length > MAX_PAYLOAD_BUF) {
-          return;
-        }
-        
-        // Move data two indices forward
-        for (uint8_t i = length-1; i > 2; i--) {
-          payloadBuffer[i] = payloadBuffer[i-2];
-        }
-        
-        // Add received time
-        uint16_t tempTime = millis() / 60000; // Convert into minutes
-        payloadBuffer[1] = (tempTime >> 8);
-        payloadBuffer[2] = tempTime;
-        
-        // Save data to memory
-        uint8_t savedBytes = memoryHandler.saveNodeData(from, length, payloadBuffer);
-        
-        // If saved data differs from the actual data, gateway is out of memory so flag it
-        // Note that this is only updated every time a message is received.
-        if (savedBytes != length) {
-          gwMetaData.outOfMemory = true;
-          
-          // Blink led to indicate received but not saved message
-          setBlink(2);
+      // Push message right away, or later from memory if Modbus is busy
+      #ifdef ENABLE_PUSH_MODE
+      bitWrite(pushNodes[from / 8], from % 8, !pushRecord(from, payloadBuffer, length, sequence, rssi, snr));
+      #endif
+      
+      // Set external interrupt pin if it is in use
+      #ifdef ENABLE_EXT_INTERRUPT
+        // If pin is to be used only when a threshold rule fires
+        #if defined EXT_INTERRUPT_RULES
+        if (checkRules(from, payloadBuffer)) {
+          setExternalInterrupt(true);
         }
-        else {
-          gwMetaData.outOfMemory = false;
-          
-          // Blink led to indicate received and successfully saved message
-          setBlink(1);
-          
-          // Set last received node id to gateway metadata
-          gwMetaData.lastRcvdNode = from;
-          
-          // Set external interrupt pin if it is in use
-          #ifdef ENABLE_EXT_INTERRUPT
-            // If pin is to be used only with nodes marked as important
-            #ifdef EXT_INTERRUPT_ONLY_IMPORTANT
-            if (isImportant) {
-              setExternalInterrupt(true);
-            }
-            // Else always set the pin
-            #else
-            setExternalInterrupt(true);
-            #endif
-          #endif
+        // If pin is to be used only with nodes marked as important
+        #elif defined EXT_INTERRUPT_ONLY_IMPORTANT
+        if (isImportant) {
+          setExternalInterrupt(true);
         }
-      }
+        // Else always set the pin
+        #else
+        setExternalInterrupt(true);
+        #endif
+      #endif
+    }
+  }
+}
+
+bool updateLinkStats(uint8_t from, uint8_t recordLength, uint8_t sequence, int8_t rssi, int8_t snr, uint8_t* linkStats) {
+  // Link statistics: last sequence | RSSI | SNR | received (2) | lost (2) | duplicates (2)
+  // Continue from the saved statistics unless node is new or its type has changed
+  if ((getRecordLength(getRequestedType(from)) != recordLength) ||
+      (memoryHandler.getNodeData(from, LINK_STATS_LENGTH, linkStats, recordLength) != LINK_STATS_LENGTH)) {
+    memset(linkStats, 0, LINK_STATS_LENGTH);
+  }
+  
+  uint16_t received = (linkStats[3] << 8) | linkStats[4];
+  uint16_t lost = (linkStats[5] << 8) | linkStats[6];
+  uint16_t duplicates = (linkStats[7] << 8) | linkStats[8];
+  bool isDuplicate = false;
+  
+  // Nodes number messages 2-255 in turn after the first one (1) since startup. 0 means node does not number
+  // its messages, so neither duplicates nor losses can be told.
+  if ((sequence > 1) && (linkStats[0] != 0)) {
+    uint8_t gap = (sequence >= linkStats[0]) ? (sequence - linkStats[0]) : (sequence + 254 - linkStats[0]);
+    
+    // Same number again is a retransmit whose ack was lost, skipped numbers were lost
+    if (gap == 0) {
+      isDuplicate = true;
+    }
+    else {
+      lost += gap - 1;
     }
   }
+  
+  if (isDuplicate) {
+    duplicates++;
+  }
+  else {
+    received++;
+  }
+  
+  linkStats[0] = sequence;
+  linkStats[1] = rssi;
+  linkStats[2] = snr;
+  linkStats[3] = (received >> 8);
+  linkStats[4] = received;
+  linkStats[5] = (lost >> 8);
+  linkStats[6] = lost;
+  linkStats[7] = (duplicates >> 8);
+  linkStats[8] = duplicates;
+  
+  return isDuplicate;
 }
 
 void checkModbus() {
@@ -453,53 +1149,44 @@ void checkModbus() {
     setBlink(4);
   }
   else if (response == FRAME_RECEIVED) {
+    #ifdef ENABLE_TIMING
+    requestReceived = micros();
+    #endif
+    #ifdef ENABLE_PUSH_MODE
+    lastModbusRequest = millis();
+    #endif
     
-    // Calculate node id from requested register address
-    uint8_t requestedId = startRegister / 100;
-    
-    // Check what type of node the requested id is
-    uint8_t requestedType = 255;
-    
-    // Gateway
-    if (requestedId == 0) {
-      requestedType = 0;
-    }
-    // ID over maximum supported number of nodes
-    else if (requestedId > MAX_NR_OF_NODES) {
-      requestedType = 255;
-    }
-    // Is at least legal ID
-    else {
-      uint8_t type = memoryHandler.getNodeHeader(requestedId) & B00000111;
+    // Configuration write to a node is answered right away and sent to the node in the next ack
+    if (functionCode == 6) {
+      uint8_t error = queueNodeConfig(startRegister, nrOfRegisters);
       
-      // Any battery type
-      if ((type == B00000001) || (type == B00000100) || (type == B00000101) || (type == B00000110)) {
-        requestedType = 1;
-      }
-      // Pulse with Kamstrup
-      else if (type == B00000010) {
-        requestedType = 2;
+      if ((error == 0) && modbus.sendWriteResponse(functionCode)) {
+        gwMetaData.framesReceived++;
+        
+        // Blink led to indicate successful Modbus write
+        setBlink(3);
       }
-      // Pulse
-      else if (type == B00000011) {
-        requestedType = 3;
+      else {
+        modbus.sendErrorResponse(functionCode, (error == 0) ? ERROR_ILLEGAL_ADDRESS : error);
+        gwMetaData.illegalAddressReads++;
+        
+        // Blink led to indicate failed Modbus write
+        setBlink(4);
       }
+      return;
     }
     
+    // Calculate node id from requested register address (history blocks above 25599 have no id of this kind)
+    uint8_t requestedId = (startRegister < 25600) ? (startRegister / 100) : 255;
+    
+    // Check what type of node the requested id is
+    uint8_t requestedType = getRequestedType(requestedId);
+    
+    // First requested register relative to the first register of the ID
+    uint16_t startAddress = startRegister - requestedId * 100;
+    
     // Calculate how many registers it is possible to read based on type
-    uint8_t maxNrOfRegistersToRead = 0;
-    if (requestedType == 0) {
-      maxNrOfRegistersToRead = 21;
-    }
-    else if (requestedType == 1) {
-      maxNrOfRegistersToRead = 8;
-    }
-    else if (requestedType == 2) {
-      maxNrOfRegistersToRead = 22;
-    }
-    else if (requestedType == 3) {
-      maxNrOfRegistersToRead = 10;
-    }
+    uint8_t maxNrOfRegistersToRead = getMaxRegisters(requestedType);
     
     // Construct Modbus payload
     
@@ -547,150 +1234,75 @@ void checkModbus() {
       payloadBuffer[39] = gwMetaData.pulse3;
       payloadBuffer[40] = 0;
       payloadBuffer[41] = gwMetaData.lastRcvdNode;
-    }
-    // Battery type
-    else if (requestedType == 1) {
-      uint8_t tempBuffer[NODE_TYPE_BATT_LENGTH + 2];
-      uint8_t readBytes = memoryHandler.getNodeData(requestedId, NODE_TYPE_BATT_LENGTH + 2, tempBuffer, 0);
-      
-      if (readBytes == NODE_TYPE_BATT_LENGTH + 2) {
-        uint16_t lastSeen = (millis() / 60000) - ((tempBuffer[1] << 8) | tempBuffer[2]);
-        
-        payloadBuffer[0] = (lastSeen >> 8);
-        payloadBuffer[1] = lastSeen;
-        payloadBuffer[2] = tempBuffer[3];
-        payloadBuffer[3] = tempBuffer[4];
-        payloadBuffer[4] = 0;
-        payloadBuffer[5] = tempBuffer[5];
-        payloadBuffer[6] = 0;
-        payloadBuffer[7] = tempBuffer[6];
-        payloadBuffer[8] = 0;
-        payloadBuffer[9] = tempBuffer[0];
-        payloadBuffer[10] = tempBuffer[7];
-        payloadBuffer[11] = tempBuffer[8];
-        payloadBuffer[12] = tempBuffer[9];
-        payloadBuffer[13] = tempBuffer[10];
-        payloadBuffer[14] = tempBuffer[11];
-        payloadBuffer[15] = tempBuffer[12];
-      }
-      else {
-        maxNrOfRegistersToRead = 0;
+      payloadBuffer[42] = (gwMetaData.droppedMessages >> 8);
+      payloadBuffer[43] = gwMetaData.droppedMessages;
+      for (uint8_t i = 0; i < 3; i++) {
+        uint16_t rate = getPulseRate(i);
+        payloadBuffer[44 + i * 2] = (rate >> 8);
+        payloadBuffer[45 + i * 2] = rate;
       }
+      payloadBuffer[50] = (firedRules >> 8);
+      payloadBuffer[51] = firedRules;
+      payloadBuffer[52] = (activeRules >> 8);
+      payloadBuffer[53] = activeRules;
+      payloadBuffer[54] = (gwMetaData.configsApplied >> 8);
+      payloadBuffer[55] = gwMetaData.configsApplied;
+      payloadBuffer[56] = (gwMetaData.configsFailed >> 8);
+      payloadBuffer[57] = gwMetaData.configsFailed;
     }
-    // Pulse with Kamstrup
-    else if (requestedType == 2) {
-      uint8_t tempBuffer[NODE_TYPE_PULSE_K_LENGTH + 2];
-      uint8_t readBytes = memoryHandler.getNodeData(requestedId, NODE_TYPE_PULSE_K_LENGTH + 2, tempBuffer, 0);
-      
-      if (readBytes == NODE_TYPE_PULSE_K_LENGTH + 2) {
-        uint16_t lastSeen = (millis() / 60000) - ((tempBuffer[1] << 8) | tempBuffer[2]);
-        
-        payloadBuffer[0] = (lastSeen >> 8);
-        payloadBuffer[1] = lastSeen;
-        payloadBuffer[2] = 0;
-        payloadBuffer[3] = tempBuffer[3];
-        payloadBuffer[4] = 0;
-        payloadBuffer[5] = tempBuffer[4];
-        payloadBuffer[6] = 0;
-        payloadBuffer[7] = tempBuffer[0];
-        payloadBuffer[8] = tempBuffer[5];
-        payloadBuffer[9] = tempBuffer[6];
-        payloadBuffer[10] = tempBuffer[7];
-        payloadBuffer[11] = tempBuffer[8];
-        payloadBuffer[12] = tempBuffer[9];
-        payloadBuffer[13] = tempBuffer[10];
-        payloadBuffer[14] = tempBuffer[11];
-        payloadBuffer[15] = tempBuffer[12];
-        payloadBuffer[16] = tempBuffer[13];
-        payloadBuffer[17] = tempBuffer[14];
-        payloadBuffer[18] = tempBuffer[15];
-        payloadBuffer[19] = tempBuffer[16];
-        payloadBuffer[20] = tempBuffer[17];
-        payloadBuffer[21] = tempBuffer[18];
-        payloadBuffer[22] = tempBuffer[19];
-        payloadBuffer[23] = tempBuffer[20];
-        payloadBuffer[24] = tempBuffer[21];
-        payloadBuffer[25] = tempBuffer[22];
-        payloadBuffer[26] = tempBuffer[23];
-        payloadBuffer[27] = tempBuffer[24];
-        payloadBuffer[28] = tempBuffer[25];
-        payloadBuffer[29] = tempBuffer[26];
-        payloadBuffer[30] = tempBuffer[27];
-        payloadBuffer[31] = tempBuffer[28];
-        payloadBuffer[32] = tempBuffer[29];
-        payloadBuffer[33] = tempBuffer[30];
-        payloadBuffer[34] = tempBuffer[31];
-        payloadBuffer[35] = tempBuffer[32];
-        payloadBuffer[36] = tempBuffer[33];
-        payloadBuffer[37] = tempBuffer[34];
-        payloadBuffer[38] = tempBuffer[35];
-        payloadBuffer[39] = tempBuffer[36];
-        payloadBuffer[40] = tempBuffer[37];
-        payloadBuffer[41] = tempBuffer[38];
-        payloadBuffer[42] = tempBuffer[39];
-        payloadBuffer[43] = tempBuffer[40];
-      }
-      else {
-        maxNrOfRegistersToRead = 0;
-      }
+    
+    bool result = false;
+    
+    // Changed nodes block
+    if (startRegister == CHANGED_REGISTER) {
+      result = sendChangedNodes(functionCode, nrOfRegisters);
     }
-    // Pulse
-    else if (requestedType == 3) {
-      uint8_t tempBuffer[NODE_TYPE_PULSE_LENGTH + 2];
-      uint8_t readBytes = memoryHandler.getNodeData(requestedId, NODE_TYPE_PULSE_LENGTH + 2, tempBuffer, 0);
-      
-      if (readBytes == NODE_TYPE_PULSE_LENGTH + 2) {
-        uint16_t lastSeen = (millis() / 60000) - ((tempBuffer[1] << 8) | tempBuffer[2]);
-        
-        payloadBuffer[0] = (lastSeen >> 8);
-        payloadBuffer[1] = lastSeen;
-        payloadBuffer[2] = 0;
-        payloadBuffer[3] = tempBuffer[3];
-        payloadBuffer[4] = 0;
-        payloadBuffer[5] = tempBuffer[4];
-        payloadBuffer[6] = 0;
-        payloadBuffer[7] = tempBuffer[0];
-        payloadBuffer[8] = tempBuffer[5];
-        payloadBuffer[9] = tempBuffer[6];
-        payloadBuffer[10] = tempBuffer[7];
-        payloadBuffer[11] = tempBuffer[8];
-        payloadBuffer[12] = tempBuffer[9];
-        payloadBuffer[13] = tempBuffer[10];
-        payloadBuffer[14] = tempBuffer[11];
-        payloadBuffer[15] = tempBuffer[12];
-        payloadBuffer[16] = tempBuffer[13];
-        payloadBuffer[17] = tempBuffer[14];
-        payloadBuffer[18] = tempBuffer[15];
-        payloadBuffer[19] = tempBuffer[16];
-      }
-      else {
-        maxNrOfRegistersToRead = 0;
+    #ifdef ENABLE_TIMING
+    // Timing instrumentation
+    else if ((startRegister >= TIMING_REGISTER) && (startRegister < (TIMING_RESET_REGISTER + TIMING_REGISTERS))) {
+      result = sendTiming(functionCode, startRegister, nrOfRegisters);
+    }
+    #endif
+    // History of a node
+    else if (startRegister >= HISTORY_REGISTER) {
+      result = sendHistory(functionCode, startRegister, nrOfRegisters);
+    }
+    // Updated nodes bitmap and update counters
+    else if ((requestedType == 0) && (startAddress >= UPDATED_REGISTER)) {
+      result = sendUpdateInfo(functionCode, startAddress, nrOfRegisters);
+    }
+    // Link statistics of node types
+    else if ((requestedType != 0) && (requestedType != 255) && (startAddress >= LINK_REGISTER)) {
+      result = sendLinkStats(requestedId, requestedType, functionCode, startAddress, nrOfRegisters);
+    }
+    // Latest values of node types, serialized straight from memory to Modbus frame
+    else if ((requestedType != 0) && (requestedType != 255) && (startAddress < LINK_REGISTER)) {
+      if ((startAddress + nrOfRegisters) <= maxNrOfRegistersToRead) {
+        uint8_t* payload = modbus.getResponsePayload(nrOfRegisters * 2);
+        if (payload && serializeRegisters(requestedType, requestedId, NULL, startAddress, nrOfRegisters, payload)) {
+          result = modbus.sendPreparedResponse(functionCode, nrOfRegisters * 2);
+        }
       }
     }
+    else if (((startAddress + nrOfRegisters) <= maxNrOfRegistersToRead) && (requestedType != 255)) {
+      result = modbus.sendNormalResponse(functionCode, payloadBuffer, nrOfRegisters * 2, startAddress * 2);
+    }
     
-    uint16_t startAddress = startRegister - requestedId * 100;
-    
-    if (((startAddress + nrOfRegisters) <= maxNrOfRegistersToRead) && (requestedType != 255)) {
-      bool result = modbus.sendNormalResponse(functionCode, payloadBuffer, nrOfRegisters * 2, startAddress * 2);
+    if (result) {
+      gwMetaData.framesReceived++;
       
-      if (result) {
-        gwMetaData.framesReceived++;
-        
-        // Blink led to indicate successful Modbus read
-        setBlink(3);
-        
-        // Clear external interrupt pin if it was in use
-        #ifdef ENABLE_EXT_INTERRUPT
-        setExternalInterrupt(false);
-        #endif
-      }
-      else {
-        modbus.sendErrorResponse(functionCode, ERROR_ILLEGAL_ADDRESS);
-        gwMetaData.illegalAddressReads++;
-        
-        // Blink led to indicate failed Modbus read
-        setBlink(4);
+      // Fired rules are reported once, they are cleared when the response has been sent
+      if ((requestedType == 0) && (startAddress <= 25) && ((startAddress + nrOfRegisters) > 25)) {
+        reportedRules = firedRules;
       }
+      
+      // Blink led to indicate successful Modbus read
+      setBlink(3);
+      
+      // Clear external interrupt pin if it was in use
+      #ifdef ENABLE_EXT_INTERRUPT
+      setExternalInterrupt(false);
+      #endif
     }
     else {
       modbus.sendErrorResponse(functionCode, ERROR_ILLEGAL_ADDRESS);
@@ -702,9 +1314,533 @@ void checkModbus() {
   }
   else if (response == FRAME_SENT) {
     gwMetaData.framesSent++;
+    
+    // Pushed message was not a response to any request
+    #ifdef ENABLE_PUSH_MODE
+    if (isPushSending) {
+      isPushSending = false;
+      return;
+    }
+    #endif
+    #ifdef ENABLE_TIMING
+    recordTiming(TIMING_RESPONSE, requestReceived);
+    #endif
+    
+    // Nodes in a sent bitmap response have now been reported
+    for (uint8_t i = 0; i < sizeof(updatedNodes); i++) {
+      updatedNodes[i] &= ~reportedNodes[i];
+      reportedNodes[i] = 0;
+    }
+    
+    // Nodes in a sent changed nodes block have now been reported
+    for (uint8_t i = 0; i < sizeof(changedNodes); i++) {
+      changedNodes[i] &= ~reportedChangedNodes[i];
+      reportedChangedNodes[i] = 0;
+    }
+    
+    // Fired rules in a sent response have now been reported
+    firedRules &= ~reportedRules;
+    reportedRules = 0;
+  }
+}
+
+uint8_t queueNodeConfig(uint16_t startRegister, uint16_t value) {
+  int8_t slot = -1;
+  
+  if ((startRegister < (CONFIG_REGISTER + 10)) || (startRegister >= (CONFIG_REGISTER + (MAX_NR_OF_NODES + 1) * 10))) {
+    return ERROR_ILLEGAL_ADDRESS;
+  }
+  
+  uint8_t node = (startRegister - CONFIG_REGISTER) / 10;
+  uint8_t parameter = (startRegister - CONFIG_REGISTER) % 10;
+  
+  if (parameter >= CONFIG_PARAMETERS) {
+    return ERROR_ILLEGAL_ADDRESS;
+  }
+  
+  for (uint8_t i = 0; i < CONFIG_QUEUE_LENGTH; i++) {
+    // A newer write of the same parameter replaces the old one
+    if ((configQueue[i].node == node) && (configQueue[i].parameter == parameter)) {
+      slot = i;
+      break;
+    }
+    if ((configQueue[i].node == 0) && (slot < 0)) {
+      slot = i;
+    }
+  }
+  
+  if (slot < 0) {
+    return ERROR_DEVICE_BUSY;
+  }
+  
+  configQueue[slot].node = node;
+  configQueue[slot].parameter = parameter;
+  configQueue[slot].value = value;
+  configQueue[slot].tries = 0;
+  
+  return 0;
+}
+
+int8_t getNodeConfig(uint8_t from, uint8_t applied) {
+  for (uint8_t i = 0; i < CONFIG_QUEUE_LENGTH; i++) {
+    if (configQueue[i].node != from) {
+      continue;
+    }
+    
+    // Node confirms an applied write in its next message. A write not yet sent (replaced by a newer one)
+    // is not confirmed by it. Give up if node does not confirm, for example because of older firmware,
+    // remote configuration not in use or a parameter the node does not have.
+    if (configQueue[i].tries > 0) {
+      if (applied == (configQueue[i].parameter + 1)) {
+        configQueue[i].node = 0;
+        gwMetaData.configsApplied++;
+        continue;
+      }
+      if (configQueue[i].tries >= CONFIG_TRIES) {
+        configQueue[i].node = 0;
+        gwMetaData.configsFailed++;
+        continue;
+      }
+    }
+    
+    configQueue[i].tries++;
+    return i;
+  }
+  
+  return -1;
+}
+
+uint8_t getRequestedType(uint8_t requestedId) {
+  // Gateway
+  if (requestedId == 0) {
+    return 0;
+  }
+  // ID over maximum supported number of nodes
+  else if (requestedId > MAX_NR_OF_NODES) {
+    return 255;
+  }
+  
+  // Is at least legal ID
+  uint8_t type = memoryHandler.getNodeHeader(requestedId) & B00000111;
+  
+  // Any battery type
+  if ((type == B00000001) || (type == B00000100) || (type == B00000101) || (type == B00000110)) {
+    return 1;
+  }
+  // Pulse with Kamstrup
+  else if (type == B00000010) {
+    return 2;
+  }
+  // Pulse
+  else if (type == B00000011) {
+    return 3;
+  }
+  // Battery batch
+  else if (type == B00000111) {
+    return 4;
+  }
+  return 255;
+}
+
+uint8_t getMaxRegisters(uint8_t requestedType) {
+  if (requestedType == 0) {
+    return 29;
+  }
+  else if (requestedType == 1) {
+    return sizeof(batteryRegisterMap) / 2;
+  }
+  else if (requestedType == 2) {
+    return sizeof(pulseKRegisterMap) / 2;
+  }
+  else if (requestedType == 3) {
+    return sizeof(pulseRegisterMap) / 2;
+  }
+  else if (requestedType == 4) {
+    return sizeof(batchRegisterMap) / 2;
+  }
+  return 0;
+}
+
+const uint8_t* getRegisterMap(uint8_t requestedType) {
+  if (requestedType == 1) {
+    return batteryRegisterMap;
+  }
+  else if (requestedType == 2) {
+    return pulseKRegisterMap;
+  }
+  else if (requestedType == 3) {
+    return pulseRegisterMap;
+  }
+  else if (requestedType == 4) {
+    return batchRegisterMap;
+  }
+  return NULL;
+}
+
+uint8_t getRecordLength(uint8_t requestedType) {
+  // Saved record has payload plus 2 bytes for last received time
+  if (requestedType == 1) {
+    return NODE_TYPE_BATT_LENGTH + 2;
+  }
+  else if (requestedType == 2) {
+    return NODE_TYPE_PULSE_K_LENGTH + 2;
+  }
+  else if (requestedType == 3) {
+    return NODE_TYPE_PULSE_LENGTH + 2;
+  }
+  else if (requestedType == 4) {
+    return NODE_TYPE_BATCH_LENGTH + 2;
+  }
+  return 0;
+}
+
+bool serializeRegisters(uint8_t requestedType, uint8_t requestedId, uint8_t* record, uint8_t firstRegister, uint8_t nrOfRegisters, uint8_t* payload) {
+  const uint8_t* registerMap = getRegisterMap(requestedType);
+  
+  if (!registerMap || ((firstRegister + nrOfRegisters) > getMaxRegisters(requestedType))) {
+    return false;
+  }
+  
+  for (uint8_t i = 0; i < nrOfRegisters; i++) {
+    uint8_t offset = pgm_read_byte(&registerMap[(firstRegister + i) * 2]);
+    uint8_t form = pgm_read_byte(&registerMap[(firstRegister + i) * 2 + 1]);
+    uint8_t* target = payload + i * 2;
+    uint8_t length = 2;
+    
+    // Delta against a base word
+    if (form & REG_DELTA) {
+      int8_t delta;
+      if (!readRecordBytes(requestedId, record, offset, 1, (uint8_t*)&delta) || !readRecordBytes(requestedId, record, form & ~REG_DELTA, 2, target)) {
+        return false;
+      }
+      int16_t value = ((target[0] << 8) | target[1]) + delta;
+      target[0] = (value >> 8);
+      target[1] = value;
+      continue;
+    }
+    else if (form == REG_BYTE) {
+      *target++ = 0;
+      length = 1;
+    }
+    else if (form == REG_WORD) {
+      // Read following registers with the same call while their bytes continue in the record
+      while (((i + 1) < nrOfRegisters) && (pgm_read_byte(&registerMap[(firstRegister + i + 1) * 2 + 1]) == REG_WORD)
+             && (pgm_read_byte(&registerMap[(firstRegister + i + 1) * 2]) == (offset + length))) {
+        length += 2;
+        i++;
+      }
+    }
+    
+    if (!readRecordBytes(requestedId, record, offset, length, target)) {
+      return false;
+    }
+    
+    if (form == REG_LAST_SEEN) {
+      uint16_t lastSeen = (millis() / 60000) - ((target[0] << 8) | target[1]);
+      target[0] = (lastSeen >> 8);
+      target[1] = lastSeen;
+    }
+  }
+  
+  return true;
+}
+
+bool readRecordBytes(uint8_t requestedId, uint8_t* record, uint8_t offset, uint8_t length, uint8_t* target) {
+  // Copy from the given record or read straight from memory
+  if (record) {
+    memcpy(target, record + offset, length);
+    return true;
+  }
+  return memoryHandler.getNodeData(requestedId, length, target, offset) == length;
+}
+
+bool sendHistory(uint8_t functionCode, uint16_t startRegister, uint16_t nrOfRegisters) {
+  uint8_t requestedId = (startRegister - HISTORY_REGISTER) / HISTORY_REGISTERS;
+  uint8_t firstRegister = (startRegister - HISTORY_REGISTER) % HISTORY_REGISTERS;
+  uint8_t requestedType = getRequestedType(requestedId);
+  
+  // Only node types have history and Modbus allows reading 125 registers at most
+  if ((requestedType == 0) || (requestedType == 255) || (nrOfRegisters == 0) || (nrOfRegisters > 125)) {
+    return false;
+  }
+  
+  uint8_t registersPerRecord = getMaxRegisters(requestedType);
+  uint16_t sequence;
+  uint8_t records = memoryHandler.getNodeHistoryInfo(requestedId, &sequence);
+  
+  // Read must be within the records currently in history
+  if ((firstRegister + nrOfRegisters) > (2 + (uint16_t)records * registersPerRecord)) {
+    return false;
+  }
+  
+  // Build response directly in Modbus frame buffer, history of a node would not fit payloadBuffer
+  uint8_t* payload = modbus.getResponsePayload(nrOfRegisters * 2);
+  if (!payload) {
+    return false;
+  }
+  
+  uint8_t record[NODE_TYPE_PULSE_K_LENGTH + 2];
+  uint8_t readRecord = 255;
+  
+  for (uint8_t i = 0; i < nrOfRegisters; i++) {
+    uint8_t requestedRegister = firstRegister + i;
+    uint16_t value = 0;
+    
+    // History sequence
+    if (requestedRegister == 0) {
+      value = sequence;
+    }
+    // Records in history
+    else if (requestedRegister == 1) {
+      value = records;
+    }
+    // Records, newest first
+    else {
+      uint8_t recordIndex = (requestedRegister - 2) / registersPerRecord;
+      uint8_t recordRegister = (requestedRegister - 2) % registersPerRecord;
+      
+      // Read a record only once even if several of its registers are requested
+      if (recordIndex != readRecord) {
+        uint8_t recordLength = getRecordLength(requestedType);
+        if (memoryHandler.getNodeHistory(requestedId, recordIndex, recordLength, record) != recordLength) {
+          return false;
+        }
+        readRecord = recordIndex;
+      }
+      serializeRegisters(requestedType, requestedId, record, recordRegister, 1, payload + i * 2);
+      continue;
+    }
+    
+    payload[i * 2] = (value >> 8);
+    payload[i * 2 + 1] = value;
+  }
+  
+  return modbus.sendPreparedResponse(functionCode, nrOfRegisters * 2);
+}
+
+bool sendChangedNodes(uint8_t functionCode, uint16_t nrOfRegisters) {
+  // Block header must fit and Modbus allows reading 125 registers at most
+  if ((nrOfRegisters < 2) || (nrOfRegisters > 125)) {
+    return false;
+  }
+  
+  // Build response directly in Modbus frame buffer, a large block would not fit payloadBuffer
+  uint8_t* payload = modbus.getResponsePayload(nrOfRegisters * 2);
+  if (!payload) {
+    return false;
+  }
+  
+  changedBlock.payload = payload;
+  changedBlock.nrOfRegisters = nrOfRegisters;
+  changedBlock.position = 4; // Records start after block header
+  changedBlock.records = 0;
+  changedBlock.pending = 0;
+  
+  // Read changed nodes one type at a time, so that every record is read whole with one memory access
+  uint8_t record[NODE_TYPE_PULSE_K_LENGTH + 2];
+  for (uint8_t type = 1; type <= 4; type++) {
+    uint8_t selected[sizeof(changedNodes)];
+    memset(selected, 0, sizeof(selected));
+    
+    for (uint8_t i = 1; i <= MAX_NR_OF_NODES; i++) {
+      if (!bitRead(changedNodes[i / 8], i % 8)) {
+        continue;
+      }
+      
+      uint8_t nodeType = getRequestedType(i);
+      
+      // If node has disappeared, nothing to report
+      if (nodeType == 255) {
+        bitClear(changedNodes[i / 8], i % 8);
+      }
+      else if (nodeType == type) {
+        bitSet(selected[i / 8], i % 8);
+      }
+    }
+    
+    changedBlock.type = type;
+    memoryHandler.getNodesData(1, MAX_NR_OF_NODES, getRecordLength(type), record, addChangedNode, selected);
+  }
+  
+  // Clear unused registers at the end
+  for (uint8_t position = changedBlock.position; position < (nrOfRegisters * 2); position++) {
+    payload[position] = 0;
+  }
+  
+  payload[0] = 0;
+  payload[1] = changedBlock.records;
+  payload[2] = 0;
+  payload[3] = changedBlock.pending;
+  
+  if (!modbus.sendPreparedResponse(functionCode, nrOfRegisters * 2)) {
+    memset(reportedChangedNodes, 0, sizeof(reportedChangedNodes));
+    return false;
+  }
+  return true;
+}
+
+void addChangedNode(uint8_t id, uint8_t* record, uint8_t length) {
+  uint8_t registers = getMaxRegisters(changedBlock.type);
+  
+  // If record does not fit this frame, leave it for the next read but keep looking for smaller ones
+  if (((changedBlock.position / 2) + 1 + registers) > changedBlock.nrOfRegisters) {
+    changedBlock.pending++;
+    return;
+  }
+  
+  // Node is cleared once the response has been sent, a record that could not be read stays changed
+  uint8_t* target = changedBlock.payload + changedBlock.position;
+  if ((length == getRecordLength(changedBlock.type)) && serializeRegisters(changedBlock.type, id, record, 0, registers, target + 2)) {
+    target[0] = id;
+    target[1] = registers;
+    changedBlock.position += 2 + registers * 2;
+    changedBlock.records++;
+    bitSet(reportedChangedNodes[id / 8], id % 8);
+  }
+}
+
+bool sendLinkStats(uint8_t requestedId, uint8_t requestedType, uint8_t functionCode, uint16_t startAddress, uint16_t nrOfRegisters) {
+  uint8_t linkStats[LINK_STATS_LENGTH];
+  
+  // Read must be within the block and statistics are kept only with external SRAM
+  if ((nrOfRegisters == 0) || ((startAddress + nrOfRegisters) > (LINK_REGISTER + LINK_REGISTERS)) || !memoryHandler.hasExternalSRAM()) {
+    return false;
+  }
+  if (memoryHandler.getNodeData(requestedId, LINK_STATS_LENGTH, linkStats, getRecordLength(requestedType)) != LINK_STATS_LENGTH) {
+    return false;
+  }
+  
+  // Received, lost and duplicate messages
+  for (uint8_t i = 0; i < 6; i++) {
+    payloadBuffer[i] = linkStats[3 + i];
+  }
+  // RSSI and SNR of the last message, sign extended
+  payloadBuffer[6] = ((int8_t)linkStats[1] < 0) ? 0xFF : 0;
+  payloadBuffer[7] = linkStats[1];
+  payloadBuffer[8] = ((int8_t)linkStats[2] < 0) ? 0xFF : 0;
+  payloadBuffer[9] = linkStats[2];
+  // Sequence number of the last message
+  payloadBuffer[10] = 0;
+  payloadBuffer[11] = linkStats[0];
+  
+  return modbus.sendNormalResponse(functionCode, payloadBuffer, nrOfRegisters * 2, (startAddress - LINK_REGISTER) * 2);
+}
+
+bool sendUpdateInfo(uint8_t functionCode, uint16_t startAddress, uint16_t nrOfRegisters) {
+  bool isBitmap = (startAddress >= UPDATED_REGISTER) && ((startAddress + nrOfRegisters) <= (UPDATED_REGISTER + UPDATED_REGISTERS));
+  bool isCounters = (startAddress >= COUNTER_REGISTER) && ((startAddress + nrOfRegisters) <= (COUNTER_REGISTER + COUNTER_REGISTERS));
+  
+  // Read must be within one block
+  if ((!isBitmap && !isCounters) || (nrOfRegisters == 0)) {
+    return false;
+  }
+  
+  // Build response directly in Modbus frame buffer, counters would not fit payloadBuffer
+  uint8_t* payload = modbus.getResponsePayload(nrOfRegisters * 2);
+  if (!payload) {
+    return false;
   }
+  
+  for (uint8_t i = 0; i < nrOfRegisters; i++) {
+    // Bitmap register has nodes 16 * n ... 16 * n + 15, LSB first
+    if (isBitmap) {
+      uint8_t index = (startAddress + i - UPDATED_REGISTER) * 2;
+      payload[i * 2] = updatedNodes[index + 1];
+      payload[i * 2 + 1] = updatedNodes[index];
+      
+      // Remember what was reported so that it can be cleared once sent
+      reportedNodes[index] = updatedNodes[index];
+      reportedNodes[index + 1] = updatedNodes[index + 1];
+    }
+    // Counter register has node 2 * n in MSB and node 2 * n + 1 in LSB
+    else {
+      uint8_t index = (startAddress + i - COUNTER_REGISTER) * 2;
+      payload[i * 2] = updateCounters[index];
+      payload[i * 2 + 1] = updateCounters[index + 1];
+    }
+  }
+  
+  return modbus.sendPreparedResponse(functionCode, nrOfRegisters * 2);
+}
+
+#ifdef ENABLE_TIMING
+uint32_t recordTiming(uint8_t metric, uint32_t started) {
+  uint32_t now = micros();
+  uint32_t elapsed = now - started;
+  
+  if (elapsed > timings[metric].max) {
+    timings[metric].max = elapsed;
+  }
+  
+  // Keep average over recent times when sum or count would overflow
+  if ((timings[metric].sum > 0x7FFFFFFFUL) || (elapsed > 0x7FFFFFFFUL) || (timings[metric].count == 0xFFFF)) {
+    timings[metric].sum >>= 1;
+    timings[metric].count >>= 1;
+  }
+  timings[metric].sum += elapsed;
+  timings[metric].count++;
+  
+  // Log2 histogram, saturating buckets
+  uint8_t bucket = 0;
+  for (uint32_t i = elapsed >> 6; (i > 0) && (bucket < (TIMING_BUCKETS - 1)); i >>= 1) {
+    bucket++;
+  }
+  if (timings[metric].histogram[bucket] < 0xFFFF) {
+    timings[metric].histogram[bucket]++;
+  }
+  
+  return now;
 }
 
+bool sendTiming(uint8_t functionCode, uint16_t startRegister, uint16_t nrOfRegisters) {
+  bool isReset = (startRegister >= TIMING_RESET_REGISTER);
+  uint16_t firstRegister = startRegister - (isReset ? TIMING_RESET_REGISTER : TIMING_REGISTER);
+  
+  // Read must be within one range
+  if ((nrOfRegisters == 0) || ((firstRegister + nrOfRegisters) > TIMING_REGISTERS)) {
+    return false;
+  }
+  
+  // Build response directly in Modbus frame buffer, all metrics would not fit payloadBuffer
+  uint8_t* payload = modbus.getResponsePayload(nrOfRegisters * 2);
+  if (!payload) {
+    return false;
+  }
+  
+  for (uint8_t i = 0; i < nrOfRegisters; i++) {
+    uint8_t metric = (firstRegister + i) / TIMING_METRIC_REGISTERS;
+    uint8_t metricRegister = (firstRegister + i) % TIMING_METRIC_REGISTERS;
+    uint32_t value;
+    
+    // Maximum and average take two registers, MSW first
+    if (metricRegister < 2) {
+      value = timings[metric].max;
+    }
+    else if (metricRegister < 4) {
+      value = timings[metric].count ? (timings[metric].sum / timings[metric].count) : 0;
+    }
+    else {
+      value = timings[metric].histogram[metricRegister - 4];
+    }
+    if ((metricRegister == 0) || (metricRegister == 2)) {
+      value >>= 16;
+    }
+    
+    payload[i * 2] = (value >> 8);
+    payload[i * 2 + 1] = value;
+  }
+  
+  // Reset every metric that was read
+  if (isReset) {
+    for (uint8_t metric = firstRegister / TIMING_METRIC_REGISTERS; metric <= (firstRegister + nrOfRegisters - 1) / TIMING_METRIC_REGISTERS; metric++) {
+      memset(&timings[metric], 0, sizeof(timings[metric]));
+    }
+  }
+  
+  return modbus.sendPreparedResponse(functionCode, nrOfRegisters * 2);
+}
+#endif
+
 void readIds() {
   // Change correct pinmodes
   pinMode(A2, INPUT_PULLUP);
@@ -743,10 +1879,6 @@ void readIds() {
 
 void updateLastReceived() {
   uint32_t currentTime = millis() / 60000UL; // Convert into minutes
-  gwMetaData.nodesDuringLastHour = 0;
-  gwMetaData.nodesDuringLast12Hours = 0;
-  gwMetaData.nodesDuringLast24Hours = 0;
-  gwMetaData.lowBatteryVoltage = false;
   
   // Calculate gateway uptime with millis() overflow handling
   if (millis() < lastReceivedUpdated) {
@@ -754,51 +1886,91 @@ void updateLastReceived() {
   }
   gwMetaData.uptime = (currentTime / 60) + (millisOverflows * 1193); // millis() overflows every 1193 hours
   
-  uint8_t tempBuffer[5];
-  
   // Cast to 16 bits so that the following calculations work (otherwise seen nodes zero after 2^16 minutes)
-  uint16_t currentTime_16 = (uint16_t)currentTime;
+  uint16_t now = (uint16_t)currentTime;
   
-  // Iterate through all IDs
-  for (uint8_t i = 1; i <= MAX_NR_OF_NODES; i++) {
-    // The first 5 bytes has all the data we need here
-    uint8_t readBytes = memoryHandler.getNodeData(i, 5, tempBuffer, 0);
-    
-    // If the ID is in use
-    if (readBytes == 5) {
-      
-      // Calculate nodes which have been seen during the last...
-      uint16_t lastReceived = (tempBuffer[1] << 8) | tempBuffer[2];
-      // ... hour
-      if ((currentTime_16 - lastReceived) <= 60) {
-        gwMetaData.nodesDuringLastHour++;
-      }
-      // ... 12 hours
-      if ((currentTime_16 - lastReceived) <= 720) {
-        gwMetaData.nodesDuringLast12Hours++;
-      }
-      // ... 24 hours
-      if ((currentTime_16 - lastReceived) <= 1440) {
-        gwMetaData.nodesDuringLast24Hours++;
-      }
-      
-      // Check battery levels for battery nodes
-      uint8_t type = tempBuffer[0] & B00000111;
-      if ((type == B00000001) || (type == B00000100) || (type == B00000101) || (type == B00000110)) {
-        uint16_t voltage = (tempBuffer[3] << 8) | tempBuffer[4];
-        if (voltage < 2100) {
-          gwMetaData.lowBatteryVoltage = true;
-        }
-      }
-      
-      // Delete nodes not seen for a while
-      if (deleteOldNodes != 0) {
-        if ((currentTime_16 - lastReceived) > deleteOldNodes) {
-          memoryHandler.deleteNode(i);
-        }
-      }
+  // Age out nodes from statistics windows. As seenNodes is ordered by last seen, only the first node
+  // seen during each window needs to be checked.
+  for (uint8_t i = 0; i < 3; i++) {
+    while ((seenWindowStarts[i] < seenCount) && (getMinutesSinceSeen(seenNodes[seenWindowStarts[i]], now) > seenWindows[i])) {
+      seenWindowStarts[i]++;
+    }
+  }
+  
+  // Delete nodes not seen for a while, oldest are always first
+  if (deleteOldNodes != 0) {
+    while ((seenCount > 0) && (getMinutesSinceSeen(seenNodes[0], now) > deleteOldNodes)) {
+      uint8_t id = seenNodes[0];
+      removeSeenNode(0);
+      memoryHandler.deleteNode(id);
+      bitClear(changedNodes[id / 8], id % 8);
+      bitClear(reportedChangedNodes[id / 8], id % 8);
+      bitClear(updatedNodes[id / 8], id % 8);
+      bitClear(lowBatteryNodes[id / 8], id % 8);
+    }
+  }
+  
+  updateSeenStatistics();
+}
+
+void updateSeenNode(uint8_t id, uint8_t* record) {
+  // Move node to the end of seenNodes as the most recently seen
+  for (uint8_t i = 0; i < seenCount; i++) {
+    if (seenNodes[i] == id) {
+      removeSeenNode(i);
+      break;
     }
   }
+  seenNodes[seenCount] = id;
+  seenCount++;
+  
+  // Check battery levels for battery nodes
+  uint8_t type = record[0] & B00000111;
+  if ((type == B00000001) || (type == B00000100) || (type == B00000101) || (type == B00000110) || (type == B00000111)) {
+    uint16_t voltage = (record[3] << 8) | record[4];
+    bitWrite(lowBatteryNodes[id / 8], id % 8, voltage < 2100);
+  }
+  else {
+    bitClear(lowBatteryNodes[id / 8], id % 8);
+  }
+  
+  updateSeenStatistics();
+}
+
+void removeSeenNode(uint8_t position) {
+  // If node was before the start of a window, the start moves one back
+  for (uint8_t i = 0; i < 3; i++) {
+    if (position < seenWindowStarts[i]) {
+      seenWindowStarts[i]--;
+    }
+  }
+  
+  memmove(&seenNodes[position], &seenNodes[position + 1], seenCount - position - 1);
+  seenCount--;
+}
+
+void updateSeenStatistics() {
+  gwMetaData.nodesDuringLastHour = seenCount - seenWindowStarts[0];
+  gwMetaData.nodesDuringLast12Hours = seenCount - seenWindowStarts[1];
+  gwMetaData.nodesDuringLast24Hours = seenCount - seenWindowStarts[2];
+  
+  gwMetaData.lowBatteryVoltage = false;
+  for (uint8_t i = 0; i < sizeof(lowBatteryNodes); i++) {
+    if (lowBatteryNodes[i]) {
+      gwMetaData.lowBatteryVoltage = true;
+    }
+  }
+}
+
+uint16_t getMinutesSinceSeen(uint8_t id, uint16_t now) {
+  uint8_t tempBuffer[2];
+  
+  // Received time is in bytes 1-2 of the saved record
+  if (memoryHandler.getNodeData(id, 2, tempBuffer, 1) != 2) {
+    return 0xffff;
+  }
+  
+  return (uint16_t)(now - ((tempBuffer[0] << 8) | tempBuffer[1]));
 }
 
 void enterError(uint8_t blinks) {
@@ -843,70 +2015,158 @@ void enterProgMode() {
 }
 
 ISR(PCINT1_vect) {
-  if (!digitalRead(P3_PIN) && pulse3LastValue) {
-    if ((millis() - pulse3LastFall) > (uint32_t)PULSE_MIN) {
-      gwMetaData.pulse3++;
-      pulse3LastFall = millis();
-    }
-    pulse3LastValue = false;
+  uint32_t now = micros();
+  uint8_t port = PINC;
+  uint8_t falling = lastPortC & ~port & PCMSK1;
+  lastPortC = port;
+  
+  capturePulse(2, falling, now);
+}
+
+ISR(PCINT2_vect) {
+  uint32_t now = micros();
+  uint8_t port = PIND;
+  uint8_t falling = lastPortD & ~port & PCMSK2;
+  lastPortD = port;
+  
+  capturePulse(0, falling, now);
+  capturePulse(1, falling, now);
+}
+
+void capturePulse(uint8_t input, uint8_t falling, uint32_t now) {
+  volatile PulseInput* pulseInput = &pulseInputs[input];
+  
+  if (!(falling & pulseInput->mask)) {
+    return;
   }
-  else if (digitalRead(P3_PIN) && !pulse3LastValue) {
-    pulse3LastValue = true;
+  
+  // First pulse after a long pause has no interval
+  if (pulseInput->isIdle) {
+    pulseInput->isIdle = false;
+    pulseInput->interval = 0;
+  }
+  // Ignore contact bounce
+  else if ((now - pulseInput->lastFall) < pulseInput->debounce) {
+    return;
   }
+  else {
+    pulseInput->interval = now - pulseInput->lastFall;
+  }
+  
+  (*pulseInput->counter)++;
+  pulseInput->lastFall = now;
 }
 
-ISR(PCINT2_vect) {
-  if (!digitalRead(P1_PIN) && pulse1LastValue) {
-    if ((millis() - pulse1LastFall) > (uint32_t)PULSE_MIN) {
-      gwMetaData.pulse1++;
-      pulse1LastFall = millis();
+void updatePulseInputs() {
+  // Mark inputs without pulses idle before micros() wraps around and makes last pulse time ambiguous
+  for (uint8_t i = 0; i < 3; i++) {
+    noInterrupts();
+    if ((micros() - pulseInputs[i].lastFall) > PULSE_IDLE_TIME) {
+      pulseInputs[i].isIdle = true;
     }
-    pulse1LastValue = false;
+    interrupts();
   }
-  else if (digitalRead(P1_PIN) && !pulse1LastValue) {
-    pulse1LastValue = true;
+}
+
+uint16_t getPulseRate(uint8_t input) {
+  noInterrupts();
+  uint32_t sinceLast = micros() - pulseInputs[input].lastFall;
+  uint32_t interval = pulseInputs[input].isIdle ? 0 : pulseInputs[input].interval;
+  interrupts();
+  
+  // Rate is not known before two pulses or after a long pause
+  if ((interval == 0) || (sinceLast > PULSE_IDLE_TIME)) {
+    return 0;
   }
   
-  #ifndef ENABLE_EXT_INTERRUPT
-  if (!digitalRead(P2_PIN) && pulse2LastValue) {
-    if ((millis() - pulse2LastFall) > (uint32_t)PULSE_MIN) {
-      gwMetaData.pulse2++;
-      pulse2LastFall = millis();
-    }
-    pulse2LastValue = false;
+  // Without new pulses rate is at most what time since the last pulse tells
+  if (sinceLast > interval) {
+    interval = sinceLast;
   }
-  else if (digitalRead(P2_PIN) && !pulse2LastValue) {
-    pulse2LastValue = true;
+  
+  // Pulses per hour, limited to 16 bits
+  uint32_t rate = 3600000000UL / interval;
+  return (rate > 0xFFFF) ? 0xFFFF : rate;
+}
+
+bool isPulseSaveNeeded() {
+  uint32_t pulses[3];
+  getPulses(pulses);
+  
+  // Limit how often records are written, as that sets how often every EEPROM cell of the journal wears
+  uint32_t sinceSave = millis() - lastSaveToEEPROM;
+  if (sinceSave <= (uint32_t)JOURNAL_MIN) {
+    return false;
   }
-  #endif
+  
+  // Save sooner if a pulse value has grown a lot, otherwise at regular intervals if anything has changed
+  bool hasChanged = false;
+  for (uint8_t i = 0; i < 3; i++) {
+    uint32_t delta = pulses[i] - savedPulses[i];
+    if (delta >= JOURNAL_PULSES) {
+      return true;
+    }
+    if (delta != 0) {
+      hasChanged = true;
+    }
+  }
+  
+  return hasChanged && (sinceSave > (uint32_t)JOURNAL_SAVE);
 }
 
-void savePulsesToEEPROM() {
-  EEPROM.put(10, gwMetaData.pulse1);
+void getPulses(uint32_t* pulses) {
+  // Inputs not counting pulses keep their saved values
+  memcpy(pulses, savedPulses, sizeof(savedPulses));
+  
+  noInterrupts();
+  pulses[0] = gwMetaData.pulse1;
   #ifndef ENABLE_EXT_INTERRUPT
-  EEPROM.put(20, gwMetaData.pulse2);
+  pulses[1] = gwMetaData.pulse2;
   #endif
   if (!hasNTC) {
-    EEPROM.put(30, gwMetaData.pulse3);
+    pulses[2] = gwMetaData.pulse3;
+  }
+  interrupts();
+}
+
+void savePulsesToEEPROM() {
+  uint32_t pulses[3];
+  getPulses(pulses);
+  
+  // Record is written in the background, try again later if the previous one is not done yet
+  if (pulseJournal.save(pulses)) {
+    memcpy(savedPulses, pulses, sizeof(savedPulses));
+    lastSaveToEEPROM = millis();
   }
 }
 
 void readPulsesFromEEPROM() {
-  EEPROM.get(10, gwMetaData.pulse1);
+  // If journal is still empty, take values saved by older firmware (erased EEPROM reads as 0xFF)
+  if (!pulseJournal.read(savedPulses)) {
+    EEPROM.get(10, savedPulses[0]);
+    EEPROM.get(20, savedPulses[1]);
+    EEPROM.get(30, savedPulses[2]);
+    for (uint8_t i = 0; i < 3; i++) {
+      if (savedPulses[i] == 0xFFFFFFFF) {
+        savedPulses[i] = 0;
+      }
+    }
+  }
+  
+  gwMetaData.pulse1 = savedPulses[0];
   #ifndef ENABLE_EXT_INTERRUPT
-  EEPROM.get(20, gwMetaData.pulse2);
+  gwMetaData.pulse2 = savedPulses[1];
   #endif
   if (!hasNTC) {
-    EEPROM.get(30, gwMetaData.pulse3);
+    gwMetaData.pulse3 = savedPulses[2];
   }
 }
 
 void clearPulsesFromEEPROM() {
-  uint32_t zero = 0;
+  uint32_t zero[3] = {0, 0, 0};
   
-  EEPROM.put(10, zero);
-  EEPROM.put(20, zero);
-  EEPROM.put(30, zero);
+  pulseJournal.save(zero);
+  pulseJournal.flush();
 }
 
 void readNTC() {
@@ -930,6 +2190,143 @@ void setExternalInterrupt(bool status) {
 }
 #endif
 
+#ifdef ENABLE_PUSH_MODE
+bool pushRecord(uint8_t id, uint8_t* record, uint8_t recordLength, uint8_t sequence, int8_t rssi, int8_t snr) {
+  uint8_t frame[PUSH_HEADER_LENGTH + NODE_TYPE_PULSE_K_LENGTH];
+  
+  // Message is sent as the node sent it, so leave out received time added by gateway
+  uint8_t length = recordLength - 2;
+  
+  frame[0] = 0;
+  frame[1] = PUSH_FUNCTION;
+  frame[2] = id;
+  frame[3] = sequence;
+  frame[4] = rssi;
+  frame[5] = snr;
+  frame[6] = length;
+  frame[7] = record[0];
+  memcpy(frame + PUSH_HEADER_LENGTH + 1, record + 3, length - 1);
+  
+  // Master may be reading more
+  if ((millis() - lastModbusRequest) < PUSH_HOLD_TIME) {
+    return false;
+  }
+  
+  if (!modbus.sendFrame(frame, PUSH_HEADER_LENGTH + length)) {
+    return false;
+  }
+  isPushSending = true;
+  
+  return true;
+}
+
+void updatePush() {
+  if (!modbus.isIdle() || ((millis() - lastModbusRequest) < PUSH_HOLD_TIME)) {
+    return;
+  }
+  
+  // Push the first waiting node, the rest wait until it has been sent
+  for (uint8_t id = 1; id <= MAX_NR_OF_NODES; id++) {
+    if (bitRead(pushNodes[id / 8], id % 8)) {
+      uint8_t recordLength = getRecordLength(getRequestedType(id));
+      uint8_t linkStats[LINK_STATS_LENGTH];
+      
+      // Node has been removed meanwhile
+      if ((recordLength == 0) || (memoryHandler.getNodeData(id, recordLength, payloadBuffer, 0) != recordLength)) {
+        bitClear(pushNodes[id / 8], id % 8);
+        return;
+      }
+      
+      // Link statistics of the message are known only with external SRAM
+      if (!memoryHandler.hasExternalSRAM() || (memoryHandler.getNodeData(id, LINK_STATS_LENGTH, linkStats, recordLength) != LINK_STATS_LENGTH)) {
+        memset(linkStats, 0, LINK_STATS_LENGTH);
+      }
+      
+      if (pushRecord(id, payloadBuffer, recordLength, linkStats[0], linkStats[1], linkStats[2])) {
+        bitClear(pushNodes[id / 8], id % 8);
+      }
+      return;
+    }
+  }
+}
+#endif
+
+#ifdef EXT_INTERRUPT_RULES
+bool checkRules(uint8_t from, uint8_t* record) {
+  uint8_t requestedType = getRequestedType(from);
+  bool hasFired = false;
+  
+  for (uint8_t i = 0; i < MAX_RULES; i++) {
+    uint16_t address = RULES_START + i * RULE_LENGTH;
+    
+    // Only rules of this node
+    if (EEPROM.read(address) != from) {
+      continue;
+    }
+    
+    uint8_t ruleRegister = EEPROM.read(address + 1);
+    char condition = EEPROM.read(address + 2);
+    int16_t threshold;
+    uint16_t hysteresis;
+    EEPROM.get(address + 3, threshold);
+    EEPROM.get(address + 5, hysteresis);
+    
+    // Take the value from the record just saved as it would be read from Modbus register
+    uint8_t value[2];
+    if (!serializeRegisters(requestedType, from, record, ruleRegister, 1, value)) {
+      continue;
+    }
+    int32_t current = (int16_t)((value[0] << 8) | value[1]);
+    
+    // Active rule stays active until value has moved hysteresis back over the threshold
+    bool wasActive = bitRead(activeRules, i);
+    bool isActive = false;
+    if (condition == '>') {
+      isActive = current > (wasActive ? ((int32_t)threshold - hysteresis) : threshold);
+    }
+    else if (condition == '<') {
+      isActive = current < (wasActive ? ((int32_t)threshold + hysteresis) : threshold);
+    }
+    else if (condition == '=') {
+      isActive = wasActive ? (abs(current - threshold) <= hysteresis) : (current == threshold);
+    }
+    else if (condition == '!') {
+      isActive = current != threshold;
+    }
+    
+    // Rule fires when its condition becomes true
+    if (isActive && !wasActive) {
+      bitSet(firedRules, i);
+      bitClear(reportedRules, i);
+      hasFired = true;
+    }
+    bitWrite(activeRules, i, isActive);
+  }
+  
+  return hasFired;
+}
+
+void writeRulesToEEPROM() {
+  const int16_t rules[][5] = {EXT_INTERRUPT_RULES};
+  uint8_t nrOfRules = sizeof(rules) / sizeof(rules[0]);
+  
+  // Rules not in settings are cleared (node id 0 never matches)
+  for (uint8_t i = 0; i < MAX_RULES; i++) {
+    uint16_t address = RULES_START + i * RULE_LENGTH;
+    if (i < nrOfRules) {
+      EEPROM.update(address, rules[i][0]);
+      EEPROM.update(address + 1, rules[i][1]);
+      EEPROM.update(address + 2, rules[i][2]);
+      EEPROM.put(address + 3, rules[i][3]);
+      EEPROM.put(address + 5, (uint16_t)rules[i][4]);
+    }
+    else {
+      EEPROM.update(address, 0);
+    }
+  }
+}
+#endif
+
 void startUp() {
   digitalWrite(LED_PIN, HIGH);
   if (MINOR_VERSION & B00001000) {
@@ -45,6 +45,17 @@
  */
 //#define ENABLE_LOW_RATE
 
+/*
+ * ### ADAPTIVE DATA RATE ###
+ *
+ * Define whether node should use the data rate recommended by gateway. Nodes close to gateway can then
+ * use faster data rates and spend only a fraction of time on air. Node starts at the slowest data rate and
+ * falls back one step slower after every failed transmit.
+ *
+ * Gateway must have ENABLE_ADR as well. Overrides ENABLE_LOW_RATE. To disable, comment out ENABLE_ADR.
+ */
+//#define ENABLE_ADR
+
 /*
  * ### FREQUENCY ###
  *
@@ -96,6 +107,29 @@
  */
 #define SEND_INTERVAL   600
 
+/*
+ * ### PULSE DEBOUNCE ###
+ *
+ * Define for every pulse input how many microseconds must pass between pulses at least. Falling edges
+ * closer to the previous pulse are treated as contact bounce and ignored. This also limits the highest
+ * countable pulse rate: 1000000 allows 1 pulse per second, 50000 allows 20 pulses per second.
+ *
+ * Meters with open collector (S0) outputs do not bounce and can use short times, reed switches
+ * usually need longer ones.
+ */
+#define P1_DEBOUNCE     1000000
+#define P2_DEBOUNCE     1000000
+#define P3_DEBOUNCE     1000000
+
+/*
+ * ### TRANSMIT SLOTS ###
+ *
+ * Define whether node should follow transmit slot assigned by gateway. Gateway tells in acks how much to shift
+ * the next transmit to hit the slot of the node, which reduces collisions in large networks.
+ * Works best when send interval is a multiple of gateway SLOT_FRAME. To disable, comment out ENABLE_SLOTS.
+ */
+//#define ENABLE_SLOTS
+
 /*
  * ### MULTICAL 602/603 Modbus slave address ###
  *
@@ -104,6 +138,27 @@
  */
 #define MULTICAL_SLAVE_ADDRESS  15
 
+/*
+ * ### COMPACT MESSAGES ###
+ *
+ * Define whether node should send compact messages. Compact messages include only values that have changed
+ * since the last acknowledged message, which cuts time on air and battery usage, especially with low rate transmits.
+ * Every KEYFRAME_INTERVAL:th message, as well as forced messages, are still sent in full.
+ *
+ * Gateway must support compact messages. KEYFRAME_INTERVAL is limited to 1-255.
+ */
+//#define ENABLE_COMPACT
+#define KEYFRAME_INTERVAL       10
+
+/*
+ * ### REMOTE CONFIGURATION ###
+ *
+ * Define whether node takes configuration written to gateway, so that send interval can be changed without
+ * reprogramming. Configuration arrives in the ack of the next message and is saved to EEPROM, where it overrides
+ * SEND_INTERVAL until it is written again. To disable, comment out ENABLE_REMOTE_CONFIG.
+ */
+//#define ENABLE_REMOTE_CONFIG
+
 /*
  * ####################
  * ### END SETTINGS ###
@@ -120,7 +175,13 @@
 #include <RH_RF95.h>
 #include <RHDatagram.h>
 #include <EEPROM.h>
+#include <avr/sleep.h>
 #include <NTCSensor.h>
+#include <PulseJournal.h>
+
+#ifdef ENABLE_COMPACT
+#include <CompactPayload.h>
+#endif
 
 #ifdef ENCRYPT_KEY
 #include <RHEncryptedDriver.h>
@@ -136,17 +197,35 @@
 #define JMP_PIN         A3
 
 #if defined NODE_TYPE_MULTICAL
-#define PAYLOAD_LEN     39
+#define PAYLOAD_LEN     45
 #elif defined NODE_TYPE_PULSE
-#define PAYLOAD_LEN     15
+#define PAYLOAD_LEN     21
 #endif
-#define MAX_PAYLOAD_LEN 40
+#define MAX_PAYLOAD_LEN 46
 
 #define GATEWAYID       254
+#define NR_OF_RATES     3
+#ifdef ENABLE_REMOTE_CONFIG
+#define ACK_AIR_LENGTH  20  // Longest ack on air: RadioHead header plus extended ack with configuration padded to encryption blocks
+#else
+#define ACK_AIR_LENGTH  12  // Longest ack on air: RadioHead header plus extended ack padded to one encryption block
+#endif
+#define ACK_MARGIN      100 // Milliseconds for gateway to notice message and start sending ack
+#define MODBUS_INTERVAL 10000 // Milliseconds between Multical polls
+#define MODBUS_TIMEOUT  1000  // Milliseconds to wait for Multical to respond
+#define MODBUS_RETRIES  1     // Resends of a request Multical did not respond to
 #define TX_MAX_PWR      20
 #define TX_MIN_PWR      2
-#define PULSE_MIN       1000
-#define EEPROM_SAVE     3600000
+#define PULSE_IDLE_TIME 3600000000UL // Microseconds without pulses after which input is idle (rate below 1 per hour)
+#define JOURNAL_START   40      // EEPROM journal of pulse values (older firmware saved them to 10, 20 and 30)
+#define JOURNAL_LENGTH  720     // 48 records, rest of EEPROM is used for settings
+#define JOURNAL_SAVE    900000  // How often in ms to save pulse values if they have changed
+#define JOURNAL_PULSES  1000    // Save sooner if a pulse value has grown this much...
+#define JOURNAL_MIN     120000  // ... but not sooner than this many ms after the previous save (every record lasts 48 saves)
+#define NTC_INTERVAL    10000   // How often in ms to read NTC temperature
+#define CONFIG_START    760     // EEPROM address of configuration from gateway, right after the journal (0xFFFF = not set)
+#define CONFIG_FLAGS    0x0F    // Application flags in radio header, parameter + 1 of an applied configuration write
+#define CONFIG_MIN_INTERVAL 60  // Shortest send interval in seconds taken from gateway (radio duty cycle, slot frame is up to 60 s)
 
 /* ### SETTINGS ### */
 const float frequency = FREQUENCY; // Radio transmit frequency (depends on module in use and legislation)
@@ -169,21 +248,72 @@ RHDatagram radioManager(rf95Driver);
 
 #if defined NODE_TYPE_MULTICAL
 SimpleModbusAsync modbus;
+
+// Register blocks read from Multical on every poll (function code 4).
+// See Multical Modbus RTU module datasheet for more info.
+const struct {
+  uint16_t start;
+  uint8_t nrOfRegisters;
+} multicalBlocks[] = {
+  {276, 12} // Energy, flow, volume, power, inlet and outlet temperatures
+};
+#define NR_OF_BLOCKS (sizeof(multicalBlocks) / sizeof(multicalBlocks[0]))
+#endif
+
+NTCSensor sensorNTC(NTC_NO_ENABLE_PIN, P3_PIN, false); // No sleep sampling as it would stop timers and serial
+
+#ifdef ENABLE_ADR
+// Data rates from the slowest to the fastest, same as in gateway
+const RH_RF95::ModemConfig dataRates[NR_OF_RATES] = {
+  {0x78, 0xc4, 0x0c}, // SF12, 125 kHz, CR 4/8 (same as low rate)
+  {0x72, 0x94, 0x04}, // SF9, 125 kHz, CR 4/5
+  {0x72, 0x74, 0x04}  // SF7, 125 kHz, CR 4/5 (same as default)
+};
+// Preamble lengths in symbols, long enough for gateway to detect while scanning the other data rates
+const uint16_t ratePreambles[NR_OF_RATES] = {8, 40, 160};
+uint8_t dataRate = 0; // Data rate in use
+uint8_t recommendedRate = 0; // Data rate recommended by gateway in the last ack
+#elif defined ENABLE_LOW_RATE
+const RH_RF95::ModemConfig modemConfig = {0x78, 0xc4, 0x0c}; // Registers of Bw125Cr48Sf4096
+#else
+const RH_RF95::ModemConfig modemConfig = {0x72, 0x74, 0x04}; // Registers of default Bw125Cr45Sf128
 #endif
 
-NTCSensor sensorNTC(NTC_NO_ENABLE_PIN, P3_PIN);
+uint16_t ackTimeout; // How long to wait for ack in milliseconds
+uint16_t ackLatency = 0; // Milliseconds from sent message to received ack in the last successful transmit (for debugging)
 
 // Payload buffer
 uint8_t payloadBuffer[MAX_PAYLOAD_LEN];
 
+#ifdef ENABLE_COMPACT
+// Sizes of the fields following the header
+#if defined NODE_TYPE_MULTICAL
+const uint8_t compactFields[] = {1, 1, 4, 4, 4, 4, 4, 4, 4, 4, 4, 2, 2, 2};
+#elif defined NODE_TYPE_PULSE
+const uint8_t compactFields[] = {1, 1, 4, 4, 4, 2, 2, 2};
+#endif
+CompactPayload compactPayload(compactFields, sizeof(compactFields));
+uint8_t compactBuffer[PAYLOAD_LEN];
+uint8_t referenceBuffer[PAYLOAD_LEN]; // Last acknowledged message
+bool hasReference = false;
+uint8_t compactSinceKeyframe = 0; // Compact messages sent since the last full message
+#endif
+
 uint32_t lastTransmittedMillis = 0; // Milliseconds from last transmitted packet
+uint32_t transmitDelay; // Milliseconds from last transmitted packet to the next one
+int16_t slotShift = 0; // Milliseconds to shift next transmit as told by gateway
 uint8_t transmitInterval; // How often should gateway expect transmit (in minutes)
 
 bool previousTransmitOk = false; // Was previous transmit successful
 bool hasFailedTransmit = false; // Is there at least one failed transmit (for decreasing transmit power faster after boot up)
 bool isImportant = false; // When node is marked important, it triggers gateway to set external interrupt
 bool isDebugMode = false;
+bool isFullRequested = false; // Gateway could not decode compact message and asks for a full one
 volatile bool forceSend = false;
+uint8_t messageSequence = 0; // Sequence number of the latest message (1 = first since startup, then 2-255 in turn)
+#ifdef ENABLE_REMOTE_CONFIG
+uint8_t appliedConfig = 0; // Parameter + 1 of a configuration write applied but not yet confirmed to gateway
+#endif
 uint8_t nodeId; // Node ID
 
 int8_t transmitPower = ((TX_MAX_PWR - TX_MIN_PWR) / 4) + TX_MIN_PWR; // Set initial transmit power to low medium
@@ -205,20 +335,38 @@ uint32_t outletTemp = 0;
 
 bool hasNTC;
 
-volatile uint32_t pulse1LastFall = 0;
-volatile uint32_t pulse2LastFall = 0;
-volatile uint32_t pulse3LastFall = 0;
-volatile bool pulse1LastValue = true;
-volatile bool pulse2LastValue = true;
-volatile bool pulse3LastValue = true;
+// Pulse capture state of every input
+struct PulseInput {
+  volatile uint32_t* counter; // Pulse counter of the input
+  uint8_t mask;               // Bit of the input in its port
+  uint32_t debounce;          // Minimum microseconds between pulses
+  uint32_t lastFall;          // micros() of the last counted pulse
+  uint32_t interval;          // Microseconds between the last two pulses (0 = not known)
+  bool isIdle;                // No pulses during PULSE_IDLE_TIME, lastFall is not valid
+};
+volatile PulseInput pulseInputs[3] = {
+  {&pulse1, B01000000, P1_DEBOUNCE, 0, 0, true}, // P1 (port D)
+  {&pulse2, B10000000, P2_DEBOUNCE, 0, 0, true}, // P2 (port D)
+  {&pulse3, B00000010, P3_DEBOUNCE, 0, 0, true}  // P3 (port C)
+};
+volatile uint8_t lastPortC; // Port states in the previous pin change interrupt
+volatile uint8_t lastPortD;
 uint32_t lastSaveToEEPROM = 0;
+uint32_t lastNTCRead = 0;
+PulseJournal pulseJournal(JOURNAL_START, JOURNAL_LENGTH);
+uint32_t savedPulses[3] = {0, 0, 0}; // Pulse values in the latest journal record
 #if defined NODE_TYPE_MULTICAL
 uint32_t lastModbusRead = 0;
+uint8_t blocksPending = 0; // Blocks of the current poll not yet finished
+bool isPollOk = true;      // All finished blocks of the current poll were read successfully
 #endif
 
 void setup() {
   // Check if pulse 3 is NTC
   hasNTC = sensorNTC.init();
+  if (hasNTC) {
+    readNTC();
+  }
 
   // LED
   pinMode(LED_PIN, OUTPUT);
@@ -292,9 +440,14 @@ void setup() {
   }
   rf95Driver.setFrequency(frequency);
   rf95Driver.setTxPower(transmitPower); // 5-23 dBm
+  #if defined ENABLE_ADR
+  setDataRate(0);
+  #else
   #ifdef ENABLE_LOW_RATE
   rf95Driver.setModemConfig(RH_RF95::Bw125Cr48Sf4096);
   #endif
+  ackTimeout = ACK_MARGIN + getTimeOnAir(&modemConfig, ACK_AIR_LENGTH, 8);
+  #endif
   
   readPulsesFromEEPROM();
   
@@ -302,6 +455,8 @@ void setup() {
   attachInterrupt(digitalPinToInterrupt(BTN_PIN), buttonPressed, FALLING);
   
   // Set pulse input interrupts
+  lastPortC = PINC;
+  lastPortD = PIND;
   PCICR |= B00000100; // P1 and P2 (port D)
   if (!hasNTC) {
     PCICR |= B00000010; // P3 (port C)
@@ -318,74 +473,97 @@ void setup() {
 void loop() {
   
   // Send packet if enough time from last one or force send is set
-  if (((millis() - lastTransmittedMillis) > (uint32_t)(sendInterval * 1000UL)) || forceSend) {
+  if (((millis() - lastTransmittedMillis) > transmitDelay) || forceSend) {
     
+    slotShift = 0;
     constructAndSendPacket();
     
     lastTransmittedMillis = millis();
+    
+    // Shift next transmit towards the slot assigned by gateway
+    int32_t nextDelay = (int32_t)(sendInterval * 1000UL) + slotShift;
+    transmitDelay = (nextDelay > 0) ? nextDelay : 0;
   }
   
   #if defined NODE_TYPE_MULTICAL
-  // Update values from Multical energy meter
-  if ((millis() - lastModbusRead) > 10000UL) {
-    bool result = updateModbus();
+  // Start polling Multical energy meter
+  if (((millis() - lastModbusRead) > MODBUS_INTERVAL) && (blocksPending == 0)) {
+    isPollOk = true;
+    for (uint8_t i = 0; i < NR_OF_BLOCKS; i++) {
+      if (modbus.masterQueueRead(MULTICAL_SLAVE_ADDRESS, 4, multicalBlocks[i].start, multicalBlocks[i].nrOfRegisters, MODBUS_TIMEOUT, MODBUS_RETRIES)) {
+        blocksPending++;
+      }
+      else {
+        isPollOk = false;
+      }
+    }
     
-    if (result) {
+    lastModbusRead = millis();
+  }
+  
+  // Receive values from Multical in the background
+  if (updateModbus()) {
+    if (isPollOk) {
       blinkLed(3, false);
     }
     else {
       blinkLed(4, false);
     }
-    
-    lastModbusRead = millis();
   }
   #endif
 
-  // Save pulse values to EEPROM at regular intervals
-  if ((millis() - lastSaveToEEPROM) > (uint32_t)EEPROM_SAVE) {
+  // Save pulse values to EEPROM journal if they have changed enough or for long enough
+  if (isPulseSaveNeeded()) {
     savePulsesToEEPROM();
-    lastSaveToEEPROM = millis();
   }
   
+  // Continue writing journal record in the background
+  pulseJournal.update();
+  
+  // Notice long pauses in pulses
+  updatePulseInputs();
+  
   // Update NTC temperature (if in use)
-  if (hasNTC) {
+  if (hasNTC && ((millis() - lastNTCRead) > NTC_INTERVAL)) {
     readNTC();
+    lastNTCRead = millis();
   }
 }
 
 #if defined NODE_TYPE_MULTICAL
 bool updateModbus() {
+  byte returnCode = modbus.modbusUpdate(NULL, NULL, NULL);
   
-  // We will request 12 registers which is 24 bytes
-  uint8_t tempRegisters[24] = {0};
+  if ((returnCode != MASTER_RECEIVED) && (returnCode != MASTER_TIMEOUT) && (returnCode != MASTER_ERROR)) {
+    return false;
+  }
   
-  // Send Modbus master request (function code 4, start address 276, number of registers 12).
-  // See Multical Modbus RTU module datasheet for more info.
-  bool result = modbus.masterRead(MULTICAL_SLAVE_ADDRESS, 4, 276, 12);
+  if ((returnCode != MASTER_RECEIVED) || !parseMulticalBlock(modbus.masterGetLastStart())) {
+    isPollOk = false;
+  }
   
-  if (result) {
-    uint32_t requestSent = millis();
-    
-    // Wait for response with timeout
-    byte returnCode = 0;
-    do {
-      returnCode = modbus.modbusUpdate(NULL, NULL, NULL);
-    } while ((returnCode != MASTER_RECEIVED) && ((millis() - requestSent) < 1500));
+  if (blocksPending > 0) {
+    blocksPending--;
+  }
+  
+  return (blocksPending == 0);
+}
+
+bool parseMulticalBlock(uint16_t start) {
+  
+  // Largest block is 12 registers which is 24 bytes
+  uint8_t tempRegisters[24] = {0};
+  uint8_t readBytes = modbus.masterGetLastResponse(tempRegisters, 24);
+  
+  if ((start == 276) && (readBytes == 24)) {
+    energy = ((uint32_t)tempRegisters[0] << 24) | ((uint32_t)tempRegisters[1] << 16) | ((uint32_t)tempRegisters[2] << 8) | (uint32_t)tempRegisters[3];
+    flow = ((uint32_t)tempRegisters[4] << 24) | ((uint32_t)tempRegisters[5] << 16) | ((uint32_t)tempRegisters[6] << 8) | (uint32_t)tempRegisters[7];
+    volume = ((uint32_t)tempRegisters[8] << 24) | ((uint32_t)tempRegisters[9] << 16) | ((uint32_t)tempRegisters[10] << 8) | (uint32_t)tempRegisters[11];
+    power = ((uint32_t)tempRegisters[12] << 24) | ((uint32_t)tempRegisters[13] << 16) | ((uint32_t)tempRegisters[14] << 8) | (uint32_t)tempRegisters[15];
+    inletTemp = ((uint32_t)tempRegisters[16] << 24) | ((uint32_t)tempRegisters[17] << 16) | ((uint32_t)tempRegisters[18] << 8) | (uint32_t)tempRegisters[19];
+    outletTemp = ((uint32_t)tempRegisters[20] << 24) | ((uint32_t)tempRegisters[21] << 16) | ((uint32_t)tempRegisters[22] << 8) | (uint32_t)tempRegisters[23];
     
-    // If we got a valid response, parse it
-    if (returnCode == MASTER_RECEIVED) {
-      uint8_t readBytes = modbus.masterGetLastResponse(tempRegisters, 24);
-      if (readBytes == 24) {
-        energy = ((uint32_t)tempRegisters[0] << 24) | ((uint32_t)tempRegisters[1] << 16) | ((uint32_t)tempRegisters[2] << 8) | (uint32_t)tempRegisters[3];
-        flow = ((uint32_t)tempRegisters[4] << 24) | ((uint32_t)tempRegisters[5] << 16) | ((uint32_t)tempRegisters[6] << 8) | (uint32_t)tempRegisters[7];
-        volume = ((uint32_t)tempRegisters[8] << 24) | ((uint32_t)tempRegisters[9] << 16) | ((uint32_t)tempRegisters[10] << 8) | (uint32_t)tempRegisters[11];
-        power = ((uint32_t)tempRegisters[12] << 24) | ((uint32_t)tempRegisters[13] << 16) | ((uint32_t)tempRegisters[14] << 8) | (uint32_t)tempRegisters[15];
-        inletTemp = ((uint32_t)tempRegisters[16] << 24) | ((uint32_t)tempRegisters[17] << 16) | ((uint32_t)tempRegisters[18] << 8) | (uint32_t)tempRegisters[19];
-        outletTemp = ((uint32_t)tempRegisters[20] << 24) | ((uint32_t)tempRegisters[21] << 16) | ((uint32_t)tempRegisters[22] << 8) | (uint32_t)tempRegisters[23];
-        
-        return true;
-      }
-    }
+    return true;
   }
   
   return false;
@@ -408,6 +586,11 @@ bool constructAndSendPacket() {
   // Set expect ack bit
   payloadBuffer[0] |= B01000000;
   
+  #if defined ENABLE_SLOTS || defined ENABLE_ADR || defined ENABLE_REMOTE_CONFIG
+  // Ask for extended ack with transmit slot, data rate and configuration
+  payloadBuffer[0] |= B10000000;
+  #endif
+  
   payloadBuffer[1] = transmitPowerRaw;
   payloadBuffer[2] = transmitInterval;
   
@@ -458,29 +641,99 @@ bool constructAndSendPacket() {
   payloadBuffer[38] = outletTemp;
   #endif
   
+  // Pulse rates (pulses per hour) at the end of the payload
+  for (uint8_t i = 0; i < 3; i++) {
+    uint16_t rate = getPulseRate(i);
+    payloadBuffer[PAYLOAD_LEN - 6 + i * 2] = rate >> 8;
+    payloadBuffer[PAYLOAD_LEN - 5 + i * 2] = rate;
+  }
+  
   // If in force mode, set maximum transmit power
   if (forceSend) {
     rf95Driver.setTxPower(TX_MAX_PWR);
     payloadBuffer[1] = 100;
   }
   
+  // Number every new message, retransmits keep the same number so that gateway can drop duplicates
+  messageSequence = (messageSequence < 255) ? messageSequence + 1 : 2;
+  radioManager.setHeaderId(messageSequence);
+  
+  // Confirm an applied configuration write to gateway in radio header flags
+  #ifdef ENABLE_REMOTE_CONFIG
+  uint8_t confirmedConfig = appliedConfig;
+  radioManager.setHeaderFlags(confirmedConfig, CONFIG_FLAGS);
+  appliedConfig = 0;
+  #endif
+  
   bool transmitOk = false;
   for (uint8_t i = 0; i < maxNrOfSends; i++) {
+    uint8_t* message = payloadBuffer;
+    uint8_t length = PAYLOAD_LEN;
+    
+    #ifdef ENABLE_COMPACT
+    // Send only changes unless full message is due. Encode again on every retry as transmit power may have changed.
+    if (hasReference && !forceSend && (compactSinceKeyframe < KEYFRAME_INTERVAL)) {
+      uint8_t compactLength = compactPayload.encode(payloadBuffer, referenceBuffer, compactBuffer);
+      if (compactLength) {
+        message = compactBuffer;
+        length = compactLength;
+      }
+    }
+    #endif
+    
     // Send packet
-    transmitOk = sendPacket();
+    transmitOk = sendPacket(message, length);
+    
+    // If gateway asked for a full message, the link itself works
+    bool linkOk = transmitOk || isFullRequested;
     
     // Update transmit power based on transmit result if not in force send (force sends are always sent at full power and don't count for APC)
     if (!forceSend) {
-      updateTransmitPower(transmitOk);
-      previousTransmitOk = transmitOk;
+      updateTransmitPower(linkOk);
+      previousTransmitOk = linkOk;
     }
     
+    #ifdef ENABLE_COMPACT
+    if (isFullRequested) {
+      hasReference = false;
+    }
+    
+    // Gateway now has the same message to decode the next compact message against
+    if (transmitOk) {
+      memcpy(referenceBuffer, payloadBuffer, PAYLOAD_LEN);
+      hasReference = true;
+      compactSinceKeyframe = (message == payloadBuffer) ? 0 : compactSinceKeyframe + 1;
+    }
+    #endif
+    
     // If transmit was successful, reset and break from retransmit loop
     if (transmitOk) {
       break;
     }
   }
   
+  // Confirm again with the next message if this one did not get through (unless a new write was applied)
+  #ifdef ENABLE_REMOTE_CONFIG
+  if (!transmitOk && (appliedConfig == 0)) {
+    appliedConfig = confirmedConfig;
+  }
+  #endif
+  
+  #ifdef ENABLE_ADR
+  // Follow gateway one step at a time if message got through, otherwise fall back to a slower data rate
+  if (transmitOk || isFullRequested) {
+    if (recommendedRate > dataRate) {
+      setDataRate(dataRate + 1);
+    }
+    else if (recommendedRate < dataRate) {
+      setDataRate(dataRate - 1);
+    }
+  }
+  else if (dataRate > 0) {
+    setDataRate(dataRate - 1);
+  }
+  #endif
+  
   // Return to normal transmit power after force send
   if (forceSend) {
     rf95Driver.setTxPower(transmitPower);
@@ -499,34 +752,66 @@ bool constructAndSendPacket() {
   return transmitOk;
 }
 
-bool sendPacket() {
+bool sendPacket(uint8_t* message, uint8_t length) {
+  isFullRequested = false;
+  
   // If packet accepted by radio
-  if (radioManager.sendto(payloadBuffer, PAYLOAD_LEN, GATEWAYID)) {
+  if (radioManager.sendto(message, length, GATEWAYID)) {
     
     // Wait for packet to be sent
     radioManager.waitPacketSent();
 
-    #ifdef ENABLE_LOW_RATE
-    uint16_t timeout = 3500;
-    #else
-    uint16_t timeout = 200;
-    #endif
-
     uint32_t sendTime = millis();
 
-    uint8_t len = MAX_PAYLOAD_LEN;
+    // Receive ack to its own buffer so that message is kept intact for retransmits
+    uint8_t ackBuffer[9];
+    uint8_t len;
     uint8_t from;
     uint8_t to;
     
-    // Wait ack
-    while ((millis() - sendTime) < timeout) {
+    // Wait ack, sleeping until radio (or millis timer) interrupt
+    while ((millis() - sendTime) < ackTimeout) {
+      len = sizeof(ackBuffer);
+      
+      if (!radioManager.available()) {
+        idleMCU();
+      }
       // If received packet from gateway
-      if (radioManager.recvfrom(payloadBuffer, &len, &from, &to)) {
-        if ((from == GATEWAYID) && (to == nodeId) && (len == 2)) {
+      else if (radioManager.recvfrom(ackBuffer, &len, &from, &to)) {
+        if ((from == GATEWAYID) && (to == nodeId) && ((len == 2) || (len == 5) || (len == 8))) {
           // If this really is ack
-          if (payloadBuffer[0] & B00000001) {
+          if (ackBuffer[0] & B00000001) {
+            ackLatency = millis() - sendTime;
+            
             // Save RSSI reported by gateway for future use
-            lastReportedRSSI = payloadBuffer[1];
+            lastReportedRSSI = ackBuffer[1];
+            
+            // Extended ack includes shift to the next transmit and recommended data rate if gateway uses them
+            if (len >= 5) {
+              #ifdef ENABLE_SLOTS
+              if (ackBuffer[0] & B00000100) {
+                slotShift = (ackBuffer[2] << 8) | ackBuffer[3];
+              }
+              #endif
+              #ifdef ENABLE_ADR
+              if ((ackBuffer[0] & B00001000) && (ackBuffer[4] < NR_OF_RATES)) {
+                recommendedRate = ackBuffer[4];
+              }
+              #endif
+            }
+            
+            // Configuration written to gateway
+            #ifdef ENABLE_REMOTE_CONFIG
+            if ((len == 8) && (ackBuffer[0] & B00010000)) {
+              applyConfig(ackBuffer[5], (ackBuffer[6] << 8) | ackBuffer[7]);
+            }
+            #endif
+            
+            // Message was received but gateway could not decode it
+            if (ackBuffer[0] & B00000010) {
+              isFullRequested = true;
+              return false;
+            }
             return true;
           }
         }
@@ -536,6 +821,55 @@ bool sendPacket() {
   return false;
 }
 
+void idleMCU() {
+  // Idle mode keeps timers and radio interrupt running, so the first of them wakes up
+  set_sleep_mode(SLEEP_MODE_IDLE);
+  sleep_enable();
+  sleep_cpu();
+  sleep_disable();
+}
+
+#ifdef ENABLE_ADR
+void setDataRate(uint8_t rate) {
+  dataRate = rate;
+  recommendedRate = rate;
+  rf95Driver.setModemRegisters(&dataRates[rate]);
+  rf95Driver.setPreambleLength(ratePreambles[rate]);
+  
+  // Gateway sends ack with the same data rate but default preamble
+  ackTimeout = ACK_MARGIN + getTimeOnAir(&dataRates[rate], ACK_AIR_LENGTH, 8);
+}
+#endif
+
+uint16_t getTimeOnAir(const RH_RF95::ModemConfig* config, uint8_t length, uint16_t preamble) {
+  // Bandwidths in Hz by register value
+  const uint32_t bandwidths[10] = {7800, 10400, 15600, 20800, 31250, 41700, 62500, 125000, 250000, 500000};
+  
+  // Decode modem registers (see SX1276 datasheet)
+  uint8_t spreadingFactor = config->reg_1e >> 4;
+  uint8_t codingRate = (config->reg_1d >> 1) & B00000111; // 1-4 for 4/5-4/8
+  bool isImplicitHeader = config->reg_1d & B00000001;
+  bool hasCRC = config->reg_1e & B00000100;
+  bool isLowDataRate = config->reg_26 & B00001000;
+  uint32_t bandwidth = bandwidths[constrain(config->reg_1d >> 4, 0, 9)];
+  
+  // Symbol time in microseconds
+  uint32_t symbolTime = (1UL << spreadingFactor) * 1000000UL / bandwidth;
+  
+  // Number of payload symbols as in Semtech LoRa modem designer's guide
+  int16_t bits = (8 * length) - (4 * spreadingFactor) + 28 + (hasCRC ? 16 : 0) - (isImplicitHeader ? 20 : 0);
+  uint8_t bitsPerSymbol = 4 * (spreadingFactor - (isLowDataRate ? 2 : 0));
+  uint16_t payloadSymbols = 8;
+  if (bits > 0) {
+    payloadSymbols += ((bits + bitsPerSymbol - 1) / bitsPerSymbol) * (codingRate + 4);
+  }
+  
+  // Preamble takes 4.25 symbols more than its length
+  uint32_t microseconds = ((((uint32_t)preamble * 4) + 17) * symbolTime / 4) + (payloadSymbols * symbolTime);
+  
+  return microseconds / 1000;
+}
+
 void updateTransmitPower(bool lastTransmitOk) {
   
   // Default power change. Increase to make APC more aggressive.
@@ -593,74 +927,184 @@ void buttonPressed() {
   forceSend = true;
 }
 
-// Functions to calculate pulses
+// Functions to capture pulses
 
 ISR(PCINT1_vect) {
-  if (!digitalRead(P3_PIN) && pulse3LastValue) {
-    if ((millis() - pulse3LastFall) > (uint32_t)PULSE_MIN) {
-      pulse3++;
-      pulse3LastFall = millis();
-    }
-    pulse3LastValue = false;
+  uint32_t now = micros();
+  uint8_t port = PINC;
+  uint8_t falling = lastPortC & ~port & PCMSK1;
+  lastPortC = port;
+  
+  capturePulse(2, falling, now);
+}
+
+ISR(PCINT2_vect) {
+  uint32_t now = micros();
+  uint8_t port = PIND;
+  uint8_t falling = lastPortD & ~port & PCMSK2;
+  lastPortD = port;
+  
+  capturePulse(0, falling, now);
+  capturePulse(1, falling, now);
+}
+
+void capturePulse(uint8_t input, uint8_t falling, uint32_t now) {
+  volatile PulseInput* pulseInput = &pulseInputs[input];
+  
+  if (!(falling & pulseInput->mask)) {
+    return;
+  }
+  
+  // First pulse after a long pause has no interval
+  if (pulseInput->isIdle) {
+    pulseInput->isIdle = false;
+    pulseInput->interval = 0;
   }
-  else if (digitalRead(P3_PIN) && !pulse3LastValue) {
-    pulse3LastValue = true;
+  // Ignore contact bounce
+  else if ((now - pulseInput->lastFall) < pulseInput->debounce) {
+    return;
+  }
+  else {
+    pulseInput->interval = now - pulseInput->lastFall;
   }
+  
+  (*pulseInput->counter)++;
+  pulseInput->lastFall = now;
 }
 
-ISR(PCINT2_vect) {
-  if (!digitalRead(P1_PIN) && pulse1LastValue) {
-    if ((millis() - pulse1LastFall) > (uint32_t)PULSE_MIN) {
-      pulse1++;
-      pulse1LastFall = millis();
+void updatePulseInputs() {
+  // Mark inputs without pulses idle before micros() wraps around and makes last pulse time ambiguous
+  for (uint8_t i = 0; i < 3; i++) {
+    noInterrupts();
+    if ((micros() - pulseInputs[i].lastFall) > PULSE_IDLE_TIME) {
+      pulseInputs[i].isIdle = true;
     }
-    pulse1LastValue = false;
+    interrupts();
   }
-  else if (digitalRead(P1_PIN) && !pulse1LastValue) {
-    pulse1LastValue = true;
+}
+
+uint16_t getPulseRate(uint8_t input) {
+  noInterrupts();
+  uint32_t sinceLast = micros() - pulseInputs[input].lastFall;
+  uint32_t interval = pulseInputs[input].isIdle ? 0 : pulseInputs[input].interval;
+  interrupts();
+  
+  // Rate is not known before two pulses or after a long pause
+  if ((interval == 0) || (sinceLast > PULSE_IDLE_TIME)) {
+    return 0;
   }
   
-  if (!digitalRead(P2_PIN) && pulse2LastValue) {
-    if ((millis() - pulse2LastFall) > (uint32_t)PULSE_MIN) {
-      pulse2++;
-      pulse2LastFall = millis();
+  // Without new pulses rate is at most what time since the last pulse tells
+  if (sinceLast > interval) {
+    interval = sinceLast;
+  }
+  
+  // Pulses per hour, limited to 16 bits
+  uint32_t rate = 3600000000UL / interval;
+  return (rate > 0xFFFF) ? 0xFFFF : rate;
+}
+
+bool isPulseSaveNeeded() {
+  uint32_t pulses[3];
+  getPulses(pulses);
+  
+  // Limit how often records are written, as that sets how often every EEPROM cell of the journal wears
+  uint32_t sinceSave = millis() - lastSaveToEEPROM;
+  if (sinceSave <= (uint32_t)JOURNAL_MIN) {
+    return false;
+  }
+  
+  // Save sooner if a pulse value has grown a lot, otherwise at regular intervals if anything has changed
+  bool hasChanged = false;
+  for (uint8_t i = 0; i < 3; i++) {
+    uint32_t delta = pulses[i] - savedPulses[i];
+    if (delta >= JOURNAL_PULSES) {
+      return true;
+    }
+    if (delta != 0) {
+      hasChanged = true;
     }
-    pulse2LastValue = false;
   }
-  else if (digitalRead(P2_PIN) && !pulse2LastValue) {
-    pulse2LastValue = true;
+  
+  return hasChanged && (sinceSave > (uint32_t)JOURNAL_SAVE);
+}
+
+void getPulses(uint32_t* pulses) {
+  // Inputs not counting pulses keep their saved values
+  memcpy(pulses, savedPulses, sizeof(savedPulses));
+  
+  noInterrupts();
+  pulses[0] = pulse1;
+  pulses[1] = pulse2;
+  if (!hasNTC) {
+    pulses[2] = pulse3;
   }
+  interrupts();
 }
 
 void savePulsesToEEPROM() {
-  EEPROM.put(10, pulse1);
-  EEPROM.put(20, pulse2);
-  if (!hasNTC) {
-    EEPROM.put(30, pulse3);
+  uint32_t pulses[3];
+  getPulses(pulses);
+  
+  // Record is written in the background, try again later if the previous one is not done yet
+  if (pulseJournal.save(pulses)) {
+    memcpy(savedPulses, pulses, sizeof(savedPulses));
+    lastSaveToEEPROM = millis();
   }
 }
 
 void readPulsesFromEEPROM() {
-  EEPROM.get(10, pulse1);
-  EEPROM.get(20, pulse2);
+  // If journal is still empty, take values saved by older firmware (erased EEPROM reads as 0xFF)
+  if (!pulseJournal.read(savedPulses)) {
+    EEPROM.get(10, savedPulses[0]);
+    EEPROM.get(20, savedPulses[1]);
+    EEPROM.get(30, savedPulses[2]);
+    for (uint8_t i = 0; i < 3; i++) {
+      if (savedPulses[i] == 0xFFFFFFFF) {
+        savedPulses[i] = 0;
+      }
+    }
+  }
+  
+  pulse1 = savedPulses[0];
+  pulse2 = savedPulses[1];
   if (!hasNTC) {
-    EEPROM.get(30, pulse3);
+    pulse3 = savedPulses[2];
   }
 }
 
 void clearPulsesFromEEPROM() {
-  uint32_t zero = 0;
+  uint32_t zero[3] = {0, 0, 0};
   
-  EEPROM.put(10, zero);
-  EEPROM.put(20, zero);
-  EEPROM.put(30, zero);
+  pulseJournal.save(zero);
+  pulseJournal.flush();
 }
 
 void readNTC() {
   pulse3 = sensorNTC.readTemperature();
 }
 
+#ifdef ENABLE_REMOTE_CONFIG
+void applyConfig(uint8_t parameter, uint16_t value) {
+  // Pulse node has only send interval, too short interval is not valid (0xFFFF returns to the setting)
+  if ((parameter != 0) || (value < CONFIG_MIN_INTERVAL)) {
+    return;
+  }
+  
+  EEPROM.put(CONFIG_START, value);
+  setTimings();
+  appliedConfig = parameter + 1;
+}
+#endif
+
 void setTimings() {
+  // Take send interval written to gateway instead of setting (erased EEPROM means it has not been written)
+  #ifdef ENABLE_REMOTE_CONFIG
+  uint16_t config;
+  EEPROM.get(CONFIG_START, config);
+  sendInterval = (config == 0xFFFF) ? SEND_INTERVAL : config;
+  #endif
+  
   // Change sendInterval to 8 seconds if in debug mode, else use provided value
   if (isDebugMode) {
     sendInterval = 8;
@@ -669,6 +1113,8 @@ void setTimings() {
   // Calculate advertised transmit interval
   transmitInterval = ceil(sendInterval / 60.0);
   
+  transmitDelay = sendInterval * 1000UL;
+  
   // Constrain maximum number of transmits value
   if (maxNrOfSends < 1) {
     maxNrOfSends = 1;
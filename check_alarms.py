@@ -83,6 +83,16 @@ import smtplib, ssl
 import minimalmodbus
 import sys
 
+# Registers that fit one response, also without external SRAM in gateway
+MAX_READ = 22
+
+# Register ranges that can be read together. Gateway has its own ranges, every node has the same
+# ranges relative to node id * 100. Latest values range is as long as the longest node type,
+# a read past the registers of a shorter type fails and is then done one register at a time.
+# Timing reset registers are left out so that reading one metric does not reset the others.
+gateway_ranges = [(0, 29), (30, 37), (40, 91), (21000, 21112)]
+node_ranges = [(0, 35), (40, 46), (50, 100)]
+
 gateway = minimalmodbus.Instrument(serial_device, modbus_address)
 gateway.serial.baudrate = 38400
 
@@ -118,39 +128,122 @@ def to_signed(value):
   else:
     return (value)
 
-# Function to check one alarm. Reads a modbus register and makes alarm state comparison.
+# Helper function to find the range a register belongs to.
+#
+# register: modbus register
+#
+# returns:  tuple of the first register and the register after the range (None if register is not in any range)
+#
+def get_range(register):
+  if (register < 100):
+    ranges = gateway_ranges
+    base = 0
+  elif (register < 20000):
+    ranges = node_ranges
+    base = (register // 100) * 100
+  else:
+    ranges = gateway_ranges
+    base = 0
+
+  for start, end in ranges:
+    if ((base + start) <= register < (base + end)):
+      return (base + start, base + end)
+  return None
+
+# Function to plan reads for a set of registers.
+#
+# Registers in the same range are coalesced into as few reads as possible, each at most MAX_READ
+# registers long. Registers not in any known range are read alone.
+#
+# registers: registers to read
+#
+# returns:   list of (first register, number of registers) tuples
+#
+def plan_reads(registers):
+  reads = []
+  for register in sorted(set(registers)):
+    if (len(reads) > 0):
+      first, count = reads[-1]
+      register_range = get_range(register)
+      if ((register_range is not None) and (register_range == get_range(first)) and ((register - first) < MAX_READ)):
+        reads[-1] = (first, register - first + 1)
+        continue
+    reads.append((register, 1))
+  return reads
+
+# Function to read a snapshot of all registers needed by the alarms.
+#
+# If a coalesced read fails because it goes past the registers of the node, its registers are read
+# one by one so that one missing register does not fail the others.
+#
+# registers: registers to read
+#
+# returns:   dictionary of signed values by register (registers that could not be read are missing)
+#
+def read_snapshot(registers):
+  snapshot = {}
+  for first, count in plan_reads(registers):
+    try:
+      mb_data = gateway.read_registers(first, count)
+      for i in range(len(mb_data)):
+        snapshot[first + i] = to_signed(mb_data[i])
+    except minimalmodbus.IllegalRequestError:
+      for register in sorted(set(registers)):
+        if ((count > 1) and (first <= register < (first + count))):
+          try:
+            snapshot[register] = to_signed(gateway.read_registers(register, 1)[0])
+          except Exception:
+            pass
+    except Exception:
+      pass
+
+    if (print_verbose):
+      print("Read registers "+str(first)+"-"+str(first + count - 1))
+  return snapshot
+
+# Helper function to get registers an alarm needs.
+#
+# alarm:   alarm definition
+#
+# returns: list of registers
+#
+def get_alarm_registers(alarm):
+  registers = [alarm[0]]
+  if (str(alarm[2]).startswith("R")):
+    registers.append(int(alarm[2].strip("R")))
+  return registers
+
+# Function to check one alarm. Makes alarm state comparison with values read to a snapshot.
 #
 # Comparison can be made against either a constant integer or another register. For example,
-# check_alarm(105, ">", 100) will read modbus register 105 and compare it against a fixed value 60.
-# On the other hand, check_alarm(7, "<", "R8") reads values from registers 6 and 8 and makes the comparison.
+# check_alarm(105, ">", 100, snapshot) will compare register 105 against a fixed value 100.
+# On the other hand, check_alarm(7, "<", "R8", snapshot) compares values from registers 7 and 8.
 #
-# register:   modbus register to read from
+# register:   modbus register to compare
 # condition:  comparison operator (<, >, =, >=, <=, !=)
-# value:      either an integer to compare against, or a register to read value from
+# value:      either an integer to compare against, or a register to compare against
 #             If defining a register, prefix with R.
+# snapshot:   register values read by read_snapshot()
 #
-# return:     -1 if unable to read from modbus slave
+# return:     -1 if register was not read from modbus slave
 #              0 if alarm off
 #              1 if alarm active
 #
-def check_alarm(register, condition, value):
+def check_alarm(register, condition, value, snapshot):
   try:
-    # Try to read the defined register
-    mb_data = gateway.read_registers(register, 1)
-
-    if (len(mb_data) != 1):
+    if (register not in snapshot):
       return -1
 
-    raw = to_signed(mb_data[0])
+    raw = snapshot[register]
     
-    # Read comparing value if it is a register
+    # Get comparing value if it is a register
     if (str(value).startswith("R")):
-      mb_data = gateway.read_registers(int(value.strip("R")), 1)
+      value_register = int(value.strip("R"))
       
-      if (len(mb_data) != 1):
+      if (value_register not in snapshot):
         return -1
 
-      value = to_signed(mb_data[0])
+      value = snapshot[value_register]
 
     if (print_verbose):
       print("... condition '"+str(raw)+condition+str(value)+"' ...")
@@ -184,12 +277,18 @@ def check_alarm(register, condition, value):
 
 has_active_alarm = False
 
+# Read all registers needed by the alarms at once
+needed_registers = []
+for alarm in alarms:
+  needed_registers += get_alarm_registers(alarm)
+snapshot = read_snapshot(needed_registers)
+
 # Iterate through all alarm definitions, append alarm texts to the message body
 for alarm in alarms:
   if (print_verbose):
     print("Checking alarm '"+alarm[3]+"' ...")
     
-  value = check_alarm(alarm[0], alarm[1], alarm[2])
+  value = check_alarm(alarm[0], alarm[1], alarm[2], snapshot)
   if (value == 1):
     has_active_alarm = True
     message += "- "+alarm[3]+"\n"
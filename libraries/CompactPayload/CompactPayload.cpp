@@ -0,0 +1,231 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2026 aattww (https://github.com/aattww/)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * CompactPayload.cpp - Delta encoding of Sensors node messages
+ *
+ * CompactPayload shrinks a normal node message by sending only the fields that have changed since
+ * a reference message, which is the last message acknowledged by the gateway. Both ends must
+ * have the same reference, so it is identified by a checksum and the gateway asks for a normal
+ * message if its own reference does not match.
+ *
+ * See CompactPayload.h for the message format.
+ */
+
+/*
+ * Version history
+ * ---------------
+ *
+ * 1.0 2026-10-14 (CURRENT)
+ *   Initial version
+ */
+
+#include "CompactPayload.h"
+
+/*
+ * Creates a new instance.
+ *
+ * fieldSizes: table of field sizes, must stay valid for the lifetime of the instance
+ * nrOfFields: number of fields in the table (1-32)
+ *
+ * returns:    no
+ */
+CompactPayload::CompactPayload(const uint8_t* fieldSizes, uint8_t nrOfFields) {
+  _fieldSizes = fieldSizes;
+  _nrOfFields = nrOfFields;
+
+  // Header plus all the fields
+  _payloadLength = 1;
+  for (uint8_t i = 0; i < nrOfFields; i++) {
+    _payloadLength += fieldSizes[i];
+  }
+}
+
+/*
+ * Returns length of the normal message, header included.
+ *
+ * parameters: no
+ *
+ * returns:    length of the normal message
+ */
+uint8_t CompactPayload::getPayloadLength() {
+  return _payloadLength;
+}
+
+/*
+ * Calculates checksum of a reference message.
+ *
+ * reference: normal message
+ *
+ * returns:   CRC8 of the message (header excluded)
+ */
+uint8_t CompactPayload::getChecksum(uint8_t* reference) {
+  uint8_t crc = 0;
+
+  // CRC-8 with polynomial 0x07
+  for (uint8_t i = 1; i < _payloadLength; i++) {
+    crc ^= reference[i];
+    for (uint8_t j = 0; j < 8; j++) {
+      if (crc & 0x80) {
+        crc = (crc << 1) ^ 0x07;
+      }
+      else {
+        crc <<= 1;
+      }
+    }
+  }
+
+  return crc;
+}
+
+/*
+ * Encodes a normal message as a compact one.
+ *
+ * payload:   normal message to encode
+ * reference: last acknowledged normal message
+ * compact:   buffer for the compact message, must be at least as long as the normal message
+ *
+ * returns:   length of the compact message OR
+ *            0 if compact message would not be shorter than the normal one
+ */
+uint8_t CompactPayload::encode(uint8_t* payload, uint8_t* reference, uint8_t* compact) {
+  uint8_t bitmapLength = (_nrOfFields + 7) / 8;
+  uint8_t length = 2 + bitmapLength;
+
+  if (length >= _payloadLength) {
+    return 0;
+  }
+
+  compact[0] = payload[0] | COMPACT_FLAG;
+  compact[1] = getChecksum(reference);
+  memset(compact + 2, 0, bitmapLength);
+
+  uint8_t offset = 1;
+  for (uint8_t i = 0; i < _nrOfFields; i++) {
+    uint8_t size = _fieldSizes[i];
+
+    // Difference wraps around like the field itself, so sign of the 32 bit difference is enough even for full 4 byte fields
+    int32_t delta = readField(payload + offset, size) - readField(reference + offset, size);
+    if (size < 4) {
+      // Sign extend from the field size to get the shortest difference
+      uint8_t shift = 32 - (size * 8);
+      delta = (int32_t)((uint32_t)delta << shift) >> shift;
+    }
+    offset += size;
+
+    if (delta == 0) {
+      continue;
+    }
+
+    bitSet(compact[2 + (i / 8)], i % 8);
+
+    // Zig-zag encoding keeps small negative differences short as well
+    uint32_t value = ((uint32_t)delta << 1) ^ (uint32_t)(delta >> 31);
+    do {
+      // Give up as soon as it is clear compact message is not shorter
+      if (length >= (_payloadLength - 1)) {
+        return 0;
+      }
+      compact[length] = value & 0x7F;
+      value >>= 7;
+      if (value) {
+        compact[length] |= 0x80;
+      }
+      length++;
+    } while (value);
+  }
+
+  return length;
+}
+
+/*
+ * Decodes a compact message back into a normal one.
+ *
+ * compact:       compact message
+ * compactLength: length of the compact message
+ * reference:     reference message the compact message was encoded against
+ * payload:       buffer for the normal message (must not overlap with the other buffers)
+ *
+ * returns:       length of the normal message OR
+ *                0 if reference does not match or message is malformed
+ */
+uint8_t CompactPayload::decode(uint8_t* compact, uint8_t compactLength, uint8_t* reference, uint8_t* payload) {
+  uint8_t bitmapLength = (_nrOfFields + 7) / 8;
+  uint8_t position = 2 + bitmapLength;
+
+  if ((compactLength < position) || (compact[1] != getChecksum(reference))) {
+    return 0;
+  }
+
+  payload[0] = compact[0] & ~COMPACT_FLAG;
+
+  uint8_t offset = 1;
+  for (uint8_t i = 0; i < _nrOfFields; i++) {
+    uint8_t size = _fieldSizes[i];
+    uint32_t field = readField(reference + offset, size);
+
+    if (bitRead(compact[2 + (i / 8)], i % 8)) {
+      // Read variable length integer, at most 5 bytes for 32 bits
+      uint32_t value = 0;
+      uint8_t shift = 0;
+      uint8_t byte;
+      do {
+        if ((position >= compactLength) || (shift > 28)) {
+          return 0;
+        }
+        byte = compact[position++];
+        value |= (uint32_t)(byte & 0x7F) << shift;
+        shift += 7;
+      } while (byte & 0x80);
+
+      // Undo zig-zag encoding and add difference to the reference
+      field += (value >> 1) ^ (-(value & 1));
+    }
+
+    writeField(payload + offset, size, field);
+    offset += size;
+  }
+
+  // Every byte must have been used
+  if (position != compactLength) {
+    return 0;
+  }
+
+  return _payloadLength;
+}
+
+uint32_t CompactPayload::readField(uint8_t* buffer, uint8_t size) {
+  uint32_t value = 0;
+  for (uint8_t i = 0; i < size; i++) {
+    value = (value << 8) | buffer[i];
+  }
+  return value;
+}
+
+void CompactPayload::writeField(uint8_t* buffer, uint8_t size, uint32_t value) {
+  for (uint8_t i = size; i > 0; i--) {
+    buffer[i - 1] = value;
+    value >>= 8;
+  }
+}
@@ -0,0 +1,122 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2026 aattww (https://github.com/aattww/)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * CompactPayload.h - Delta encoding of Sensors node messages
+ *
+ * CompactPayload shrinks a normal node message by sending only the fields that have changed since
+ * a reference message, which is the last message acknowledged by the gateway. Both ends must
+ * have the same reference, so it is identified by a checksum and the gateway asks for a normal
+ * message if its own reference does not match.
+ *
+ * Message fields are unsigned big-endian values of 1-4 bytes following the header. Field sizes
+ * are given as a table, for example {1, 1, 4, 4, 4} for a pulse node message.
+ *
+ * Compact message:
+ *   Header | Checksum | Bitmap (1 bit per field) | Deltas
+ *
+ *   Header   - Header of the normal message with COMPACT_FLAG set
+ *   Checksum - CRC8 of the reference message (header excluded)
+ *   Bitmap   - Bit set for every field that differs from the reference, LSB of the first byte
+ *              is the first field
+ *   Deltas   - Difference to the reference of every changed field, zig-zag encoded and written
+ *              as a variable length integer (7 bits per byte, MSB set if more bytes follow)
+ */
+
+#ifndef CompactPayload_h
+#define CompactPayload_h
+
+#include "Arduino.h"
+
+// Header bit marking a compact message
+#define COMPACT_FLAG B00001000
+
+class CompactPayload {
+
+  private:
+
+    const uint8_t* _fieldSizes; // Size of every field in bytes (1-4)
+    uint8_t _nrOfFields;        // Number of fields
+    uint8_t _payloadLength;     // Length of the normal message
+
+    uint32_t readField(uint8_t* buffer, uint8_t size);
+    void writeField(uint8_t* buffer, uint8_t size, uint32_t value);
+
+  public:
+
+    /*
+     * Creates a new instance.
+     *
+     * fieldSizes: table of field sizes, must stay valid for the lifetime of the instance
+     * nrOfFields: number of fields in the table (1-32)
+     *
+     * returns:    no
+     */
+    CompactPayload(const uint8_t* fieldSizes, uint8_t nrOfFields);
+
+    /*
+     * Returns length of the normal message, header included.
+     *
+     * parameters: no
+     *
+     * returns:    length of the normal message
+     */
+    uint8_t getPayloadLength();
+
+    /*
+     * Calculates checksum of a reference message.
+     *
+     * reference: normal message
+     *
+     * returns:   CRC8 of the message (header excluded)
+     */
+    uint8_t getChecksum(uint8_t* reference);
+
+    /*
+     * Encodes a normal message as a compact one.
+     *
+     * payload:   normal message to encode
+     * reference: last acknowledged normal message
+     * compact:   buffer for the compact message, must be at least as long as the normal message
+     *
+     * returns:   length of the compact message OR
+     *            0 if compact message would not be shorter than the normal one
+     */
+    uint8_t encode(uint8_t* payload, uint8_t* reference, uint8_t* compact);
+
+    /*
+     * Decodes a compact message back into a normal one.
+     *
+     * compact:       compact message
+     * compactLength: length of the compact message
+     * reference:     reference message the compact message was encoded against
+     * payload:       buffer for the normal message (must not overlap with the other buffers)
+     *
+     * returns:       length of the normal message OR
+     *                0 if reference does not match or message is malformed
+     */
+    uint8_t decode(uint8_t* compact, uint8_t compactLength, uint8_t* reference, uint8_t* payload);
+};
+
+#endif
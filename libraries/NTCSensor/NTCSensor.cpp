@@ -52,7 +52,15 @@
  * Version history
  * ---------------
  *
- * 1.2 2020-03-15 (CURRENT)
+ * 1.4 2026-10-14 (CURRENT)
+ *   - Added powerUp() to let voltage divider settle while doing something else.
+ *
+ * 1.3 2026-10-14
+ *   - Temperature is converted with an interpolated lookup table generated at compile time, so no
+ *     floating point code is needed at runtime.
+ *   - Samples are taken in ADC noise reduction sleep instead of busy delays.
+ *
+ * 1.2 2020-03-15
  *   - Fixed a possible division by zero error if sensor is missing.
  *
  * 1.1 2019-12-29
@@ -63,19 +71,84 @@
  */
 
 #include "NTCSensor.h"
+#include <avr/sleep.h>
+
+/*
+ * Lookup table generation. Everything here is evaluated by the compiler, so no floating point code
+ * ends up in the program.
+ */
+
+// Natural logarithm of x in [0.5, 2] as series 2 * (y + y^3/3 + y^5/5 + ...) where y = (x - 1) / (x + 1)
+constexpr double ntcLogSeries(double y2, double power, uint8_t n) {
+  return (n > 30) ? 0.0 : (power / (2 * n + 1)) + ntcLogSeries(y2, power * y2, n + 1);
+}
+
+// Natural logarithm of any positive x, scaled to [0.5, 2] by powers of two
+constexpr double ntcLog(double x) {
+  return (x > 2.0) ? ntcLog(x / 2.0) + 0.693147180559945 :
+         (x < 0.5) ? ntcLog(x * 2.0) - 0.693147180559945 :
+         2.0 * ntcLogSeries(((x - 1.0) / (x + 1.0)) * ((x - 1.0) / (x + 1.0)), (x - 1.0) / (x + 1.0), 0);
+}
+
+// Temperature (tenfold) using B parameter version of Steinhart-Hart equation for thermistor resistance r
+constexpr double ntcTemperature(double r) {
+  return 10.0 * ((1.0 / ((1.0 / (NOMINAL_TEMPERATURE + 273.15)) + (ntcLog(r / NOMINAL_RESISTANCE) / BETA_COEFFICIENT))) - 273.15);
+}
+
+// Rounds to the nearest integer, also below zero
+constexpr int16_t ntcRound(double x) {
+  return (x < 0) ? (int16_t)(x - 0.5) : (int16_t)(x + 0.5);
+}
+
+// Table entry for ADC value (kept within 1-1022 to avoid infinite resistance at the ends)
+constexpr int16_t ntcTableValue(uint16_t value) {
+  return (value < 1) ? ntcTableValue(1) :
+         (value > 1022) ? ntcTableValue(1022) :
+         ntcRound(ntcTemperature(SERIES_RESISTOR * value / (1023.0 - value)));
+}
+
+// Forces each entry to be a compile time constant
+template <uint8_t index> struct NTCTableEntry {
+  static constexpr int16_t value = ntcTableValue(index * NTC_TABLE_STEP);
+};
+
+#define NTC_ENTRIES_8(i) NTCTableEntry<i>::value, NTCTableEntry<i + 1>::value, NTCTableEntry<i + 2>::value, NTCTableEntry<i + 3>::value, \
+                         NTCTableEntry<i + 4>::value, NTCTableEntry<i + 5>::value, NTCTableEntry<i + 6>::value, NTCTableEntry<i + 7>::value
+
+// Temperature (tenfold) for every NTC_TABLE_STEP:th ADC value
+static const int16_t ntcTable[129] PROGMEM = {
+  NTC_ENTRIES_8(0), NTC_ENTRIES_8(8), NTC_ENTRIES_8(16), NTC_ENTRIES_8(24),
+  NTC_ENTRIES_8(32), NTC_ENTRIES_8(40), NTC_ENTRIES_8(48), NTC_ENTRIES_8(56),
+  NTC_ENTRIES_8(64), NTC_ENTRIES_8(72), NTC_ENTRIES_8(80), NTC_ENTRIES_8(88),
+  NTC_ENTRIES_8(96), NTC_ENTRIES_8(104), NTC_ENTRIES_8(112), NTC_ENTRIES_8(120),
+  NTCTableEntry<128>::value
+};
+
+static_assert(NTC_TABLE_SIZE == 129, "ntcTable initializer must be updated for NTC_TABLE_STEP");
+
+// Set when ADC conversion started by noise reduction sleep is complete
+static volatile bool ntcConversionDone;
+
+ISR(ADC_vect) {
+  ntcConversionDone = true;
+}
 
 /*
  * Creates a new instance.
  *
- * enablePin: voltage divider enable pin (set to NTC_NO_ENABLE_PIN if not in use)
- * sensorPin: thermistor pin
+ * enablePin:     voltage divider enable pin (set to NTC_NO_ENABLE_PIN if not in use)
+ * sensorPin:     thermistor pin
+ * sleepSampling: take samples in ADC noise reduction sleep (set to false if serial communication
+ *                must not be interrupted, as UART is stopped while sleeping)
  *
- * returns:   no
+ * returns:       no
  */
-NTCSensor::NTCSensor(uint8_t enablePin, uint8_t sensorPin) {
+NTCSensor::NTCSensor(uint8_t enablePin, uint8_t sensorPin, bool sleepSampling) {
   _enablePin = enablePin;
   _sensorPin = sensorPin;
   _initialised = false;
+  _sleepSampling = sleepSampling;
+  _isPoweredUp = false;
 }
 
 /*
@@ -149,6 +222,23 @@ bool NTCSensor::init() {
   return (_initialised);
 }
 
+/*
+ * Turns on voltage divider in advance, so that readTemperature() does not have to wait for it to settle.
+ * Divider is turned off again by readTemperature(). Does nothing if enable pin is not in use.
+ *
+ * NOTE: Wait at least NTC_SETTLE_TIME before calling readTemperature().
+ *
+ * parameters: no
+ *
+ * returns:    no
+ */
+void NTCSensor::powerUp() {
+  if (_initialised && (_enablePin != NTC_NO_ENABLE_PIN)) {
+    digitalWrite(_enablePin, HIGH);
+    _isPoweredUp = true;
+  }
+}
+
 /*
  * Reads current temperature in Celsius.
  *
@@ -167,48 +257,92 @@ int16_t NTCSensor::readTemperature() {
   analogReference(DEFAULT);
   analogRead(_sensorPin);
   
-  // Turn on analog voltage divider if it is in use
-  if (_enablePin != NTC_NO_ENABLE_PIN) {
+  // Turn on analog voltage divider if it is in use and not already on
+  if ((_enablePin != NTC_NO_ENABLE_PIN) && !_isPoweredUp) {
     digitalWrite(_enablePin, HIGH);
-    delay(50);
+    delay(NTC_SETTLE_TIME);
   }
   
-  uint16_t rawValues = 0;
- 
-  // Take 5 samples in a row for averaging
-  for (uint8_t i = 0; i < 5; i++) {
-   rawValues += analogRead(_sensorPin);
-   delay(10);
-  }
+  uint16_t rawValues = sampleADC();
   
   // Turn off analog voltage if in use
   if (_enablePin != NTC_NO_ENABLE_PIN) {
     digitalWrite(_enablePin, LOW);
+    _isPoweredUp = false;
   }
 
   // In the unlikely event of measuring almost 0 resistance (sensor is shorted),
-  // or almost 1023*5 (sensor is missing completely), return invalid value.
-  // This also prevents possible division by zero error below.
-  if ((rawValues <= 15) || (rawValues >= 1020*5)) {
+  // or almost 1023 (sensor is missing completely), return invalid value.
+  if ((rawValues <= 3 * NTC_SAMPLES) || (rawValues >= 1020U * NTC_SAMPLES)) {
     return (-990);
   }
- 
-  // Calculate average
-  float average = rawValues / 5.0;
+  
+  return lookupTemperature(rawValues);
+}
 
+/*
+ * Takes samples of the thermistor pin, in ADC noise reduction sleep if enabled.
+ *
+ * NOTE: ADC must already be set to thermistor pin (by analogRead()).
+ *
+ * parameters: no
+ *
+ * returns:    sum of NTC_SAMPLES samples
+ */
+uint16_t NTCSensor::sampleADC() {
+  uint16_t rawValues = 0;
+  
+  // Without sleep, just start conversions back to back
+  if (!_sleepSampling) {
+    for (uint8_t i = 0; i < NTC_SAMPLES; i++) {
+      ADCSRA |= _BV(ADSC);
+      while (ADCSRA & _BV(ADSC));
+      rawValues += ADC;
+    }
+    return rawValues;
+  }
+  
+  // Entering noise reduction sleep starts a conversion, and ADC interrupt wakes up when it is done
+  ADCSRA |= _BV(ADIE);
+  set_sleep_mode(SLEEP_MODE_ADC);
+  
+  for (uint8_t i = 0; i < NTC_SAMPLES; i++) {
+    ntcConversionDone = false;
+    
+    // Other interrupts (such as pulse inputs) may wake up earlier, so sleep until conversion is done
+    while (!ntcConversionDone) {
+      cli();
+      sleep_enable();
+      sei();
+      sleep_cpu();
+      sleep_disable();
+    }
+    
+    rawValues += ADC;
+  }
+  
+  ADCSRA &= ~_BV(ADIE);
+  
+  return rawValues;
+}
+
+/*
+ * Converts ADC samples into temperature using lookup table.
+ *
+ * rawValues: sum of NTC_SAMPLES samples
+ *
+ * returns:   temperature (tenfold)
+ */
+int16_t NTCSensor::lookupTemperature(uint16_t rawValues) {
+  // Interpolate linearly between table entries
+  const uint16_t step = NTC_TABLE_STEP * NTC_SAMPLES;
+  uint8_t index = rawValues / step;
+  uint16_t fraction = rawValues % step;
+  
+  int16_t lower = pgm_read_word(&ntcTable[index]);
+  int16_t upper = pgm_read_word(&ntcTable[index + 1]);
   
-  // Convert the value to resistance
-  average = 1023.0 / average - 1;
-  average = SERIES_RESISTOR / average;
-
-  // Calculate temperature using B parameter version of Steinhart-Hart equation
-  float steinhart;
-  steinhart = average / NOMINAL_RESISTANCE;          // (R/Ro)
-  steinhart = log(steinhart);                        // ln(R/Ro)
-  steinhart /= BETA_COEFFICIENT;                     // 1/B * ln(R/Ro)
-  steinhart += 1.0 / (NOMINAL_TEMPERATURE + 273.15); // (1/To) + 1/B * ln(R/Ro)
-  steinhart = 1.0 / steinhart;                       // Invert
-  steinhart -= 273.15;                               // Convert to C
-
-  return (round(steinhart * 10));
+  // Round to the nearest (table is descending, so the difference is negative)
+  int32_t difference = (int32_t)(upper - lower) * fraction;
+  return lower + ((difference - (step / 2)) / step);
 }
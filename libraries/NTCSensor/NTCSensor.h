@@ -52,7 +52,15 @@
  * Version history
  * ---------------
  *
- * 1.2 2020-03-15 (CURRENT)
+ * 1.4 2026-10-14 (CURRENT)
+ *   - Added powerUp() to let voltage divider settle while doing something else.
+ *
+ * 1.3 2026-10-14
+ *   - Temperature is converted with an interpolated lookup table generated at compile time, so no
+ *     floating point code is needed at runtime.
+ *   - Samples are taken in ADC noise reduction sleep instead of busy delays.
+ *
+ * 1.2 2020-03-15
  *   - Fixed a possible division by zero error if sensor is missing.
  *
  * 1.1 2019-12-29
@@ -81,6 +89,16 @@
 // The value of the series resistor
 #define SERIES_RESISTOR 10000.0
 
+// Time in ms to let voltage divider settle after enabling it
+#define NTC_SETTLE_TIME 2
+
+// Number of samples averaged for one reading (1-64, power of two keeps conversion fast)
+#define NTC_SAMPLES 8
+
+// Lookup table has an entry for every 8th ADC value (0-1024)
+#define NTC_TABLE_STEP 8
+#define NTC_TABLE_SIZE ((1024 / NTC_TABLE_STEP) + 1)
+
 class NTCSensor {
   
   private:
@@ -88,18 +106,25 @@ class NTCSensor {
     uint8_t _enablePin;  // Voltage divider enable pin (NTC_NO_ENABLE_PIN if not in use)
     uint8_t _sensorPin;  // Thermistor pin
     bool _initialised;   // Sensor has been initialized
+    bool _sleepSampling; // Samples are taken in ADC noise reduction sleep
+    bool _isPoweredUp;   // Voltage divider has been turned on by powerUp()
+    
+    uint16_t sampleADC();
+    int16_t lookupTemperature(uint16_t rawValues);
 
   public:
   
     /*
      * Creates a new instance.
      *
-     * enablePin: voltage divider enable pin (set to NTC_NO_ENABLE_PIN if not in use)
-     * sensorPin: thermistor pin
+     * enablePin:     voltage divider enable pin (set to NTC_NO_ENABLE_PIN if not in use)
+     * sensorPin:     thermistor pin
+     * sleepSampling: take samples in ADC noise reduction sleep (set to false if serial communication
+     *                must not be interrupted, as UART is stopped while sleeping)
      *
-     * returns:   no
+     * returns:       no
      */
-    NTCSensor(uint8_t enablePin, uint8_t sensorPin);
+    NTCSensor(uint8_t enablePin, uint8_t sensorPin, bool sleepSampling = true);
     
     /*
      * Initializes thermistor.
@@ -114,6 +139,18 @@ class NTCSensor {
      */
     bool init();
     
+    /*
+     * Turns on voltage divider in advance, so that readTemperature() does not have to wait for it to settle.
+     * Divider is turned off again by readTemperature(). Does nothing if enable pin is not in use.
+     *
+     * NOTE: Wait at least NTC_SETTLE_TIME before calling readTemperature().
+     *
+     * parameters: no
+     *
+     * returns:    no
+     */
+    void powerUp();
+    
     /*
      * Reads current temperature in Celsius.
      *
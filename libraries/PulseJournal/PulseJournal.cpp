@@ -0,0 +1,205 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2026 aattww (https://github.com/aattww/)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * PulseJournal.cpp - Wear levelled EEPROM journal of pulse counters
+ *
+ * PulseJournal saves pulse counters as records appended in turn to a ring of slots in EEPROM,
+ * so every slot is written only once per round. The latest valid record is found by its sequence
+ * number when reading back.
+ *
+ * See PulseJournal.h for the record format.
+ */
+
+/*
+ * Version history
+ * ---------------
+ *
+ * 1.0 2026-10-14 (CURRENT)
+ *   Initial version
+ */
+
+#include "PulseJournal.h"
+#include <avr/eeprom.h>
+
+/*
+ * Creates a new instance.
+ *
+ * start:  first EEPROM address of the journal
+ * length: length of the journal in bytes, divided into slots of PJ_RECORD_LENGTH bytes
+ *         (at most PJ_MAX_SLOTS slots are used)
+ *
+ * returns: no
+ */
+PulseJournal::PulseJournal(uint16_t start, uint16_t length) {
+  _start = start;
+  _slots = ((length / PJ_RECORD_LENGTH) > PJ_MAX_SLOTS) ? PJ_MAX_SLOTS : (length / PJ_RECORD_LENGTH);
+  _nextSlot = PJ_NOT_SCANNED;
+  _sequence = 0;
+  _pendingLeft = 0;
+}
+
+/*
+ * Reads the latest valid record.
+ *
+ * counters: buffer for PJ_COUNTERS counters
+ *
+ * returns:  true if a valid record was found, false if journal is empty (counters are not changed)
+ */
+bool PulseJournal::read(uint32_t* counters) {
+  // Make sure a record being written is complete
+  flush();
+
+  return findLatest(counters);
+}
+
+/*
+ * Starts saving a new record. Record is written in the background by update().
+ *
+ * counters: PJ_COUNTERS counters to save
+ *
+ * returns:  true on success, false if previous record is still being written
+ */
+bool PulseJournal::save(uint32_t* counters) {
+  if ((_pendingLeft != 0) || (_slots < 2)) {
+    return false;
+  }
+
+  // Find where to continue the journal if not already known
+  if (_nextSlot == PJ_NOT_SCANNED) {
+    uint32_t latest[PJ_COUNTERS];
+    findLatest(latest);
+  }
+
+  _sequence++;
+  _pending[0] = _sequence;
+  memcpy(_pending + 1, counters, PJ_COUNTERS * 4);
+  uint16_t checksum = getChecksum(_pending);
+  _pending[PJ_RECORD_LENGTH - 2] = checksum >> 8;
+  _pending[PJ_RECORD_LENGTH - 1] = checksum;
+
+  _pendingSlot = _nextSlot;
+  _pendingLeft = PJ_RECORD_LENGTH;
+  _nextSlot = (_nextSlot + 1) % _slots;
+
+  return true;
+}
+
+/*
+ * Writes the next byte of the record being saved if EEPROM is ready.
+ *
+ * NOTE: Must be called regularly while a record is being saved.
+ *
+ * parameters: no
+ *
+ * returns:    true if there is still something to write, false if record has been saved
+ */
+bool PulseJournal::update() {
+  if (_pendingLeft == 0) {
+    return false;
+  }
+
+  // Previous byte is still being written
+  if (!eeprom_is_ready()) {
+    return true;
+  }
+
+  // Bytes already having the right value are skipped. Sequence (first byte) is written last.
+  while (_pendingLeft > 0) {
+    uint8_t index = (PJ_RECORD_LENGTH + 1 - _pendingLeft) % PJ_RECORD_LENGTH;
+    uint8_t* address = (uint8_t*)(_start + (_pendingSlot * PJ_RECORD_LENGTH) + index);
+    _pendingLeft--;
+
+    if (eeprom_read_byte(address) != _pending[index]) {
+      eeprom_write_byte(address, _pending[index]);
+      return true;
+    }
+  }
+
+  return false;
+}
+
+/*
+ * Waits until the record being saved has been written.
+ *
+ * parameters: no
+ *
+ * returns:    no
+ */
+void PulseJournal::flush() {
+  while (update());
+  eeprom_busy_wait();
+}
+
+bool PulseJournal::findLatest(uint32_t* counters) {
+  uint8_t record[PJ_RECORD_LENGTH];
+  bool isFound = false;
+  uint8_t latestSlot = 0;
+
+  for (uint8_t i = 0; i < _slots; i++) {
+    eeprom_read_block(record, (const void*)(_start + (i * PJ_RECORD_LENGTH)), PJ_RECORD_LENGTH);
+
+    uint16_t checksum = ((uint16_t)record[PJ_RECORD_LENGTH - 2] << 8) | record[PJ_RECORD_LENGTH - 1];
+    if (checksum != getChecksum(record)) {
+      continue;
+    }
+
+    // Valid records are at most one round of slots apart, so the sign of the difference tells the newer one
+    if (!isFound || ((int8_t)(record[0] - _sequence) > 0)) {
+      isFound = true;
+      latestSlot = i;
+      _sequence = record[0];
+      memcpy(counters, record + 1, PJ_COUNTERS * 4);
+    }
+  }
+
+  if (isFound) {
+    _nextSlot = (latestSlot + 1) % _slots;
+  }
+  else {
+    _nextSlot = 0;
+    _sequence = 0;
+  }
+
+  return isFound;
+}
+
+uint16_t PulseJournal::getChecksum(uint8_t* record) {
+  uint16_t crc = 0xFFFF;
+
+  // CRC-16/CCITT over everything but the checksum itself
+  for (uint8_t i = 0; i < (PJ_RECORD_LENGTH - 2); i++) {
+    crc ^= (uint16_t)record[i] << 8;
+    for (uint8_t j = 0; j < 8; j++) {
+      if (crc & 0x8000) {
+        crc = (crc << 1) ^ 0x1021;
+      }
+      else {
+        crc <<= 1;
+      }
+    }
+  }
+
+  return crc;
+}
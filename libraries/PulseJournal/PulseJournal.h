@@ -0,0 +1,130 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2026 aattww (https://github.com/aattww/)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * PulseJournal.h - Wear levelled EEPROM journal of pulse counters
+ *
+ * PulseJournal saves pulse counters as records appended in turn to a ring of slots in EEPROM,
+ * so every slot is written only once per round. The latest valid record is found by its sequence
+ * number when reading back.
+ *
+ * Record:
+ *   Sequence | Counter 1 | Counter 2 | Counter 3 | CRC16
+ *
+ *   Sequence - Incremented for every record, wraps around after 255
+ *   Counters - Pulse counters, 32 bit LSB first
+ *   CRC16    - CRC-16/CCITT of the sequence and counters
+ *
+ * Records are written in the background one byte at a time, so saving does not block for the
+ * ~3 ms every EEPROM byte takes. Sequence is written last and completes the record. If power
+ * is cut before that, the slot still has an older sequence number (or an invalid checksum) and
+ * the previous record is used.
+ */
+
+/*
+ * Version history
+ * ---------------
+ *
+ * 1.0 2026-10-14 (CURRENT)
+ *   Initial version
+ */
+
+#ifndef PulseJournal_h
+#define PulseJournal_h
+
+#include "Arduino.h"
+
+#define PJ_COUNTERS      3
+#define PJ_RECORD_LENGTH (1 + (PJ_COUNTERS * 4) + 2)
+#define PJ_MAX_SLOTS     127 // Sequence numbers must stay unambiguous around the ring
+#define PJ_NOT_SCANNED   255
+
+class PulseJournal {
+
+  private:
+
+    uint16_t _start;        // First EEPROM address of the journal
+    uint8_t _slots;         // Number of record slots
+    uint8_t _nextSlot;      // Slot for the next record (PJ_NOT_SCANNED if journal has not been read yet)
+    uint8_t _sequence;      // Sequence number of the latest record
+    uint8_t _pending[PJ_RECORD_LENGTH]; // Record being written
+    uint8_t _pendingSlot;   // Slot of the record being written
+    uint8_t _pendingLeft;   // Bytes of the record not yet checked or written (0 = nothing to write)
+
+    bool findLatest(uint32_t* counters);
+    uint16_t getChecksum(uint8_t* record);
+
+  public:
+
+    /*
+     * Creates a new instance.
+     *
+     * start:  first EEPROM address of the journal
+     * length: length of the journal in bytes, divided into slots of PJ_RECORD_LENGTH bytes
+     *         (at most PJ_MAX_SLOTS slots are used)
+     *
+     * returns: no
+     */
+    PulseJournal(uint16_t start, uint16_t length);
+
+    /*
+     * Reads the latest valid record.
+     *
+     * counters: buffer for PJ_COUNTERS counters
+     *
+     * returns:  true if a valid record was found, false if journal is empty (counters are not changed)
+     */
+    bool read(uint32_t* counters);
+
+    /*
+     * Starts saving a new record. Record is written in the background by update().
+     *
+     * counters: PJ_COUNTERS counters to save
+     *
+     * returns:  true on success, false if previous record is still being written
+     */
+    bool save(uint32_t* counters);
+
+    /*
+     * Writes the next byte of the record being saved if EEPROM is ready.
+     *
+     * NOTE: Must be called regularly while a record is being saved.
+     *
+     * parameters: no
+     *
+     * returns:    true if there is still something to write, false if record has been saved
+     */
+    bool update();
+
+    /*
+     * Waits until the record being saved has been written.
+     *
+     * parameters: no
+     *
+     * returns:    no
+     */
+    void flush();
+};
+
+#endif
@@ -0,0 +1,71 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2026 aattww (https://github.com/aattww/)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * SI7021Conversion.cpp - Conversion of raw Silicon Labs Si7021 measurement codes
+ *
+ * See SI7021Conversion.h for the formulas.
+ */
+
+/*
+ * Version history
+ * ---------------
+ *
+ * 1.0 2026-10-14 (CURRENT)
+ *   Initial version
+ */
+
+#include "SI7021Conversion.h"
+
+/*
+ * Converts a relative humidity measurement code.
+ *
+ * code:    16 bit code read from the sensor
+ *
+ * returns: relative humidity (tenfold), limited to 0-1000
+ */
+int16_t si7021Humidity(uint16_t code) {
+  // Humidity in hundredths of a percent, status bits masked out
+  int32_t humidity = ((12500L * (code & 0xFFFC)) >> 16) - 600;
+  
+  // Datasheet allows values slightly outside the physical range, which are limited
+  humidity = constrain(humidity, 0, 10000);
+  
+  return (humidity + 5) / 10;
+}
+
+/*
+ * Converts a temperature measurement code.
+ *
+ * code:    16 bit code read from the sensor
+ *
+ * returns: temperature (tenfold)
+ */
+int16_t si7021Temperature(uint16_t code) {
+  // Temperature in hundredths of a degree, status bits masked out
+  int32_t temperature = ((17572L * (code & 0xFFFC)) >> 16) - 4685;
+  
+  // Round to the nearest tenth, also below zero
+  return (temperature < 0) ? ((temperature - 5) / 10) : ((temperature + 5) / 10);
+}
@@ -33,7 +33,12 @@
  * Version history
  * ---------------
  *
- * 1.1 2020-04-21 (CURRENT)
+ * 1.2 2026-10-14 (CURRENT)
+ *   - Added readNodeData() to read node data without a separate header read.
+ *   - Header reads and node deletes use sequential mode to avoid switching operating mode.
+ *   - Added per-node history ring buffers in the memory not used by node records.
+ *
+ * 1.1 2020-04-21
  *   - Add beginTransaction() and endTransaction() to prevent interrupts interfering
  *     with transmissions.
  *   - Stop using transfer16() and use transfer() instead.
@@ -279,7 +284,11 @@ uint8_t Sensors23K256Handler::getNodeHeader(uint8_t nodeId) {
     return 0;
   }
   
-  return readByte((uint16_t)(nodeId * 100));
+  // Use sequential mode like all other node accesses so that operating mode does not need to be switched
+  uint8_t header;
+  readSequence((uint16_t)(nodeId * 100), 1, &header);
+  
+  return header;
 }
 
 /*
@@ -307,6 +316,30 @@ uint8_t Sensors23K256Handler::getNodeData(uint8_t nodeId, uint8_t length, uint8_
     return 0;
   }
   
+  return readNodeData(nodeId, length, buffer, offset);
+}
+
+/*
+ * Reads data for a node without checking that it exists.
+ *
+ * Same as getNodeData() but saves one SPI transaction when the caller already
+ * knows the node exists.
+ *
+ * WARNING: Silently limits bytes to be read to 100.
+ *
+ * nodeId:  id of the node
+ * length:  number of bytes to read
+ * buffer:  buffer to write read bytes
+ * offset:  how many bytes to skip in the beginning
+ *
+ * returns: number of bytes read
+ */
+uint8_t Sensors23K256Handler::readNodeData(uint8_t nodeId, uint8_t length, uint8_t* buffer, uint8_t offset) {
+  // Check that instance has been initialized
+  if (!_initialized) {
+    return 0;
+  }
+  
   if ((length + offset) > 100) {
     length = 100 - offset;
   }
@@ -343,7 +376,7 @@ uint8_t Sensors23K256Handler::saveNodeData(uint8_t nodeId, uint8_t length, uint8
 }
 
 /*
- * Deletes node. That is, sets its header to 0.
+ * Deletes node. That is, sets its header to 0 and clears its history.
  *
  * nodeId:  id of the node
  *
@@ -355,5 +388,141 @@ void Sensors23K256Handler::deleteNode(uint8_t nodeId) {
     return;
   }
   
-  writeByte((uint16_t)(nodeId * 100), 0);
+  // Use sequential mode like all other node accesses so that operating mode does not need to be switched
+  uint8_t header = 0;
+  writeSequence((uint16_t)(nodeId * 100), 1, &header);
+  
+  // Clear history so that a new node with the same ID starts from scratch
+  if ((nodeId >= 1) && (nodeId <= SMH_HISTORY_NODES)) {
+    writeSequence(getHistoryAddress(nodeId), SMH_HISTORY_HEADER, NULL);
+  }
+}
+
+/*
+ * Returns start address of the history slot of a node.
+ *
+ * nodeId:  id of the node (1 to SMH_HISTORY_NODES)
+ *
+ * returns: address of the slot header
+ */
+uint16_t Sensors23K256Handler::getHistoryAddress(uint8_t nodeId) {
+  return SMH_HISTORY_START + (uint16_t)(nodeId - 1) * SMH_HISTORY_SLOT;
+}
+
+/*
+ * Appends a record to the history ring buffer of a node.
+ *
+ * Oldest record is overwritten when the ring is full. If record length changes
+ * (for example, node type changes), earlier records are discarded.
+ *
+ * WARNING: Silently ignores IDs over SMH_HISTORY_NODES.
+ *
+ * nodeId:  id of the node
+ * length:  number of bytes in the record
+ * buffer:  record bytes
+ *
+ * returns: true if record was saved, else false
+ */
+bool Sensors23K256Handler::appendNodeHistory(uint8_t nodeId, uint8_t length, uint8_t* buffer) {
+  // Check that instance has been initialized
+  if (!_initialized) {
+    return false;
+  }
+  
+  if ((nodeId < 1) || (nodeId > SMH_HISTORY_NODES) || (length == 0) || (length > (SMH_HISTORY_SLOT - SMH_HISTORY_HEADER))) {
+    return false;
+  }
+  
+  uint16_t address = getHistoryAddress(nodeId);
+  uint8_t capacity = (SMH_HISTORY_SLOT - SMH_HISTORY_HEADER) / length;
+  
+  // Header: record length | next write index | record count | sequence MSB | sequence LSB
+  uint8_t header[SMH_HISTORY_HEADER];
+  readSequence(address, SMH_HISTORY_HEADER, header);
+  
+  // If record length has changed, old records can not be read anymore so discard them
+  if (header[0] != length) {
+    header[0] = length;
+    header[1] = 0;
+    header[2] = 0;
+  }
+  
+  writeSequence(address + SMH_HISTORY_HEADER + (uint16_t)header[1] * length, length, buffer);
+  
+  header[1] = (header[1] + 1) % capacity;
+  if (header[2] < capacity) {
+    header[2]++;
+  }
+  uint16_t sequence = ((header[3] << 8) | header[4]) + 1;
+  header[3] = (sequence >> 8);
+  header[4] = sequence;
+  
+  writeSequence(address, SMH_HISTORY_HEADER, header);
+  
+  return true;
+}
+
+/*
+ * Gets state of the history ring buffer of a node.
+ *
+ * nodeId:   id of the node
+ * sequence: will be set to number of records ever appended (wraps at 2^16). Call with NULL if not needed.
+ *
+ * returns:  number of records currently in the ring
+ */
+uint8_t Sensors23K256Handler::getNodeHistoryInfo(uint8_t nodeId, uint16_t* sequence) {
+  uint8_t header[SMH_HISTORY_HEADER] = {0};
+  
+  if (_initialized && (nodeId >= 1) && (nodeId <= SMH_HISTORY_NODES)) {
+    readSequence(getHistoryAddress(nodeId), SMH_HISTORY_HEADER, header);
+  }
+  
+  if (sequence) {
+    *sequence = (header[3] << 8) | header[4];
+  }
+  
+  return header[2];
+}
+
+/*
+ * Gets a record from the history ring buffer of a node.
+ *
+ * nodeId:  id of the node
+ * index:   0 for the most recent record, 1 for the one before and so on
+ * length:  maximum number of bytes to read
+ * buffer:  buffer to write read bytes
+ *
+ * returns: number of bytes read, 0 if there is no such record
+ */
+uint8_t Sensors23K256Handler::getNodeHistory(uint8_t nodeId, uint8_t index, uint8_t length, uint8_t* buffer) {
+  // Check that instance has been initialized
+  if (!_initialized) {
+    return 0;
+  }
+  
+  if ((nodeId < 1) || (nodeId > SMH_HISTORY_NODES)) {
+    return 0;
+  }
+  
+  uint16_t address = getHistoryAddress(nodeId);
+  
+  uint8_t header[SMH_HISTORY_HEADER];
+  readSequence(address, SMH_HISTORY_HEADER, header);
+  
+  // Check that the record exists
+  if ((header[0] == 0) || (index >= header[2])) {
+    return 0;
+  }
+  
+  uint8_t capacity = (SMH_HISTORY_SLOT - SMH_HISTORY_HEADER) / header[0];
+  // Next write index points past the most recent record
+  uint8_t slot = (header[1] + capacity - 1 - index) % capacity;
+  
+  if (length > header[0]) {
+    length = header[0];
+  }
+  
+  readSequence(address + SMH_HISTORY_HEADER + (uint16_t)slot * header[0], length, buffer);
+  
+  return length;
 }
@@ -33,7 +33,12 @@
  * Version history
  * ---------------
  *
- * 1.1 2020-04-21 (CURRENT)
+ * 1.2 2026-10-14 (CURRENT)
+ *   - Added readNodeData() to read node data without a separate header read.
+ *   - Header reads and node deletes use sequential mode to avoid switching operating mode.
+ *   - Added per-node history ring buffers in the memory not used by node records.
+ *
+ * 1.1 2020-04-21
  *   - Add beginTransaction() and endTransaction() to prevent interrupts interfering
  *     with transmissions.
  *   - Stop using transfer16() and use transfer() instead.
@@ -59,6 +64,15 @@
 #define SMH_PAGE_MODE       B10000001
 #define SMH_SEQUENTIAL_MODE B01000001
 
+// History ring buffers
+// Node records take addresses up to 10099 (IDs up to 100), history uses the rest of the chip.
+// Every node ID from 1 to SMH_HISTORY_NODES has one slot. Slot starts with a header
+// (record length, next write index, record count and 16 bit sequence) followed by records.
+#define SMH_HISTORY_NODES   100
+#define SMH_HISTORY_START   10100
+#define SMH_HISTORY_SLOT    226
+#define SMH_HISTORY_HEADER  5
+
 
 class Sensors23K256Handler {
   
@@ -124,6 +138,15 @@ class Sensors23K256Handler {
      * returns: no
      */
     void clearRegisters();
+    
+    /*
+     * Returns start address of the history slot of a node.
+     *
+     * nodeId:  id of the node (1 to SMH_HISTORY_NODES)
+     *
+     * returns: address of the slot header
+     */
+    uint16_t getHistoryAddress(uint8_t nodeId);
 
   public:
   
@@ -180,6 +203,23 @@ class Sensors23K256Handler {
      */
     uint8_t getNodeData(uint8_t nodeId, uint8_t length, uint8_t* buffer, uint8_t offset);
     
+    /*
+     * Reads data for a node without checking that it exists.
+     *
+     * Same as getNodeData() but saves one SPI transaction when the caller already
+     * knows the node exists.
+     *
+     * WARNING: Silently limits bytes to be read to 100.
+     *
+     * nodeId:  id of the node
+     * length:  number of bytes to read
+     * buffer:  buffer to write read bytes
+     * offset:  how many bytes to skip in the beginning
+     *
+     * returns: number of bytes read
+     */
+    uint8_t readNodeData(uint8_t nodeId, uint8_t length, uint8_t* buffer, uint8_t offset);
+    
     /*
      * Saves data for a node.
      *
@@ -194,13 +234,51 @@ class Sensors23K256Handler {
     uint8_t saveNodeData(uint8_t nodeId, uint8_t length, uint8_t* buffer);
     
     /*
-     * Deletes node. That is, sets its header to 0.
+     * Deletes node. That is, sets its header to 0 and clears its history.
      *
      * nodeId:  id of the node
      *
      * returns: no
      */
     void deleteNode(uint8_t nodeId);
+    
+    /*
+     * Appends a record to the history ring buffer of a node.
+     *
+     * Oldest record is overwritten when the ring is full. If record length changes
+     * (for example, node type changes), earlier records are discarded.
+     *
+     * WARNING: Silently ignores IDs over SMH_HISTORY_NODES.
+     *
+     * nodeId:  id of the node
+     * length:  number of bytes in the record
+     * buffer:  record bytes
+     *
+     * returns: true if record was saved, else false
+     */
+    bool appendNodeHistory(uint8_t nodeId, uint8_t length, uint8_t* buffer);
+    
+    /*
+     * Gets state of the history ring buffer of a node.
+     *
+     * nodeId:   id of the node
+     * sequence: will be set to number of records ever appended (wraps at 2^16). Call with NULL if not needed.
+     *
+     * returns:  number of records currently in the ring
+     */
+    uint8_t getNodeHistoryInfo(uint8_t nodeId, uint16_t* sequence);
+    
+    /*
+     * Gets a record from the history ring buffer of a node.
+     *
+     * nodeId:  id of the node
+     * index:   0 for the most recent record, 1 for the one before and so on
+     * length:  maximum number of bytes to read
+     * buffer:  buffer to write read bytes
+     *
+     * returns: number of bytes read, 0 if there is no such record
+     */
+    uint8_t getNodeHistory(uint8_t nodeId, uint8_t index, uint8_t length, uint8_t* buffer);
 };
 
 #endif
@@ -30,6 +30,10 @@
  * internal SRAM by providing abstraction to save and restore node data regardless
  * of the actual memory in use. Checks first if there is a 23K256 chip connected
  * and uses it, otherwise falls back to using internal SRAM.
+ *
+ * With 23K256 in use, node headers are mirrored in internal SRAM so that checking
+ * whether a node exists, or what type it is, does not need an SPI transaction.
+ * 23K256 also keeps a short history of records for every node.
  */
 
 #include "SensorsMemoryHandler.h"
@@ -44,6 +48,7 @@
 SensorsMemoryHandler::SensorsMemoryHandler(uint8_t slaveSelectPin) {
   _slaveSelectPin = slaveSelectPin;
   _initialized = false;
+  _headerCache = NULL;
 }
 
 /*
@@ -58,6 +63,10 @@ bool SensorsMemoryHandler::init() {
   _23K256Handler.setSlaveSelectPin(_slaveSelectPin);
   if (_23K256Handler.init()) {
     _hasExternalSRAM = true;
+    
+    // 23K256 is cleared on init so all headers start as zero. If allocation fails,
+    // headers are simply read from 23K256 every time.
+    _headerCache = (uint8_t*)calloc(SMH_MAX_NODE_ID + 1, sizeof(uint8_t));
   }
   // ... else fall back to internal SRAM
   else {
@@ -87,6 +96,9 @@ uint8_t SensorsMemoryHandler::getNodeHeader(uint8_t nodeId) {
   }
   
   if (_hasExternalSRAM) {
+    if (_headerCache && (nodeId <= SMH_MAX_NODE_ID)) {
+      return _headerCache[nodeId];
+    }
     return _23K256Handler.getNodeHeader(nodeId);
   }
   else {
@@ -115,6 +127,13 @@ uint8_t SensorsMemoryHandler::getNodeData(uint8_t nodeId, uint8_t length, uint8_
   }
   
   if (_hasExternalSRAM) {
+    if (_headerCache && (nodeId <= SMH_MAX_NODE_ID)) {
+      // Check that the ID exists without touching the SPI bus
+      if (_headerCache[nodeId] == 0) {
+        return 0;
+      }
+      return _23K256Handler.readNodeData(nodeId, length, buffer, offset);
+    }
     return _23K256Handler.getNodeData(nodeId, length, buffer, offset);
   }
   else {
@@ -140,7 +159,13 @@ uint8_t SensorsMemoryHandler::saveNodeData(uint8_t nodeId, uint8_t length, uint8
   }
   
   if (_hasExternalSRAM) {
-    return _23K256Handler.saveNodeData(nodeId, length, buffer);
+    uint8_t savedBytes = _23K256Handler.saveNodeData(nodeId, length, buffer);
+    
+    // Write header through to the cache
+    if (_headerCache && (nodeId <= SMH_MAX_NODE_ID) && (savedBytes > 0)) {
+      _headerCache[nodeId] = buffer[0];
+    }
+    return savedBytes;
   }
   else {
     return _SRAMHandler.saveNodeData(nodeId, length, buffer);
@@ -148,7 +173,7 @@ uint8_t SensorsMemoryHandler::saveNodeData(uint8_t nodeId, uint8_t length, uint8
 }
 
 /*
- * Deletes node. That is, sets its header to 0.
+ * Deletes node. That is, sets its header to 0 (and clears its history with external SRAM).
  *
  * nodeId:  id of the node
  *
@@ -161,6 +186,9 @@ void SensorsMemoryHandler::deleteNode(uint8_t nodeId) {
   }
   
   if (_hasExternalSRAM) {
+    if (_headerCache && (nodeId <= SMH_MAX_NODE_ID)) {
+      _headerCache[nodeId] = 0;
+    }
     return _23K256Handler.deleteNode(nodeId);
   }
   else {
@@ -168,6 +196,136 @@ void SensorsMemoryHandler::deleteNode(uint8_t nodeId) {
   }
 }
 
+/*
+ * Calls a function for every node ID currently in memory.
+ *
+ * Only IDs from 1 to SMH_MAX_NODE_ID are visited. Callback may delete the node
+ * it was called with.
+ *
+ * callback: function to call with the node ID
+ *
+ * returns:  no
+ */
+void SensorsMemoryHandler::forEachNode(void (*callback)(uint8_t nodeId)) {
+  // Check that instance has been initialized
+  if (!_initialized) {
+    return;
+  }
+  
+  if (_hasExternalSRAM) {
+    for (uint8_t i = 1; i <= SMH_MAX_NODE_ID; i++) {
+      if (getNodeHeader(i) != 0) {
+        callback(i);
+      }
+    }
+  }
+  else {
+    _SRAMHandler.forEachNode(callback);
+  }
+}
+
+/*
+ * Reads data for a range of node IDs and calls a function for every node in memory.
+ *
+ * With 23K256, headers come from the cache, so missing and unselected IDs cost no SPI
+ * transaction and every node read is one sequential mode transaction. Records are 100 bytes
+ * apart, so clocking over the gap between two records at 1 MHz would take longer than the
+ * 3 command and address bytes of a new transaction, and nodes are not streamed together.
+ * Callback is called with no transaction open and may use the memory handler.
+ *
+ * firstId:      first node ID to read
+ * count:        number of node IDs to go through
+ * bytesPerNode: number of bytes to read per node (from the beginning), up to 100
+ * buffer:       buffer of at least bytesPerNode bytes, passed to callback
+ * callback:     function to call with the node ID, read bytes and their number
+ * selected:     bitmap of node IDs to read (bit ID % 8 of byte ID / 8), NULL for all
+ *
+ * returns:      number of nodes read
+ */
+uint8_t SensorsMemoryHandler::getNodesData(uint8_t firstId, uint8_t count, uint8_t bytesPerNode, uint8_t* buffer, void (*callback)(uint8_t nodeId, uint8_t* data, uint8_t length), const uint8_t* selected) {
+  // Check that instance has been initialized
+  if (!_initialized) {
+    return 0;
+  }
+  
+  uint8_t nodesRead = 0;
+  
+  for (uint16_t id = firstId; (id < (uint16_t)(firstId + count)) && (id <= 255); id++) {
+    if (selected && !bitRead(selected[id / 8], id % 8)) {
+      continue;
+    }
+    
+    // Checks existence from the header cache or node directory before reading
+    uint8_t readBytes = getNodeData(id, bytesPerNode, buffer, 0);
+    
+    if (readBytes > 0) {
+      callback(id, buffer, readBytes);
+      nodesRead++;
+    }
+  }
+  
+  return nodesRead;
+}
+
+/*
+ * Appends a record to the history of a node.
+ *
+ * Only available with external SRAM, see Sensors23K256Handler for details.
+ *
+ * nodeId:  id of the node
+ * length:  number of bytes in the record
+ * buffer:  record bytes
+ *
+ * returns: true if record was saved, else false
+ */
+bool SensorsMemoryHandler::appendNodeHistory(uint8_t nodeId, uint8_t length, uint8_t* buffer) {
+  // Check that instance has been initialized and history is available
+  if (!_initialized || !_hasExternalSRAM) {
+    return false;
+  }
+  
+  return _23K256Handler.appendNodeHistory(nodeId, length, buffer);
+}
+
+/*
+ * Gets state of the history of a node.
+ *
+ * nodeId:   id of the node
+ * sequence: will be set to number of records ever appended (wraps at 2^16). Call with NULL if not needed.
+ *
+ * returns:  number of records currently in the history (0 without external SRAM)
+ */
+uint8_t SensorsMemoryHandler::getNodeHistoryInfo(uint8_t nodeId, uint16_t* sequence) {
+  // Check that instance has been initialized and history is available
+  if (!_initialized || !_hasExternalSRAM) {
+    if (sequence) {
+      *sequence = 0;
+    }
+    return 0;
+  }
+  
+  return _23K256Handler.getNodeHistoryInfo(nodeId, sequence);
+}
+
+/*
+ * Gets a record from the history of a node.
+ *
+ * nodeId:  id of the node
+ * index:   0 for the most recent record, 1 for the one before and so on
+ * length:  maximum number of bytes to read
+ * buffer:  buffer to write read bytes
+ *
+ * returns: number of bytes read, 0 if there is no such record
+ */
+uint8_t SensorsMemoryHandler::getNodeHistory(uint8_t nodeId, uint8_t index, uint8_t length, uint8_t* buffer) {
+  // Check that instance has been initialized and history is available
+  if (!_initialized || !_hasExternalSRAM) {
+    return 0;
+  }
+  
+  return _23K256Handler.getNodeHistory(nodeId, index, length, buffer);
+}
+
 /*
  * Check whether gateway has external SRAM connected or not.
  *
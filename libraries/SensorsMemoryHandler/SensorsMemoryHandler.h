@@ -30,6 +30,10 @@
  * internal SRAM by providing abstraction to save and restore node data regardless
  * of the actual memory in use. Checks first if there is a 23K256 chip connected
  * and uses it, otherwise falls back to using internal SRAM.
+ *
+ * With 23K256 in use, node headers are mirrored in internal SRAM so that checking
+ * whether a node exists, or what type it is, does not need an SPI transaction.
+ * 23K256 also keeps a short history of records for every node.
  */
 
 #ifndef SENSORSMEMORYHANDLER_H
@@ -39,6 +43,9 @@
 #include "Sensors23K256Handler.h"
 #include "SensorsSRAMHandler.h"
 
+// Highest node ID handled by forEachNode(), getNodesData() and the header cache
+#define SMH_MAX_NODE_ID 100
+
 class SensorsMemoryHandler {
   
   private:
@@ -48,6 +55,7 @@ class SensorsMemoryHandler {
     bool _hasExternalSRAM;               // External SRAM (23K256) is connected
     Sensors23K256Handler _23K256Handler; // External SRAM (23K256) handler
     SensorsSRAMHandler _SRAMHandler;     // Internal SRAM handler
+    uint8_t* _headerCache;               // Mirror of 23K256 node headers (NULL if not in use)
 
   public:
   
@@ -111,7 +119,7 @@ class SensorsMemoryHandler {
     uint8_t saveNodeData(uint8_t nodeId, uint8_t length, uint8_t* buffer);
     
     /*
-     * Deletes node. That is, sets its header to 0.
+     * Deletes node. That is, sets its header to 0 (and clears its history with external SRAM).
      *
      * nodeId:  id of the node
      *
@@ -119,6 +127,73 @@ class SensorsMemoryHandler {
      */
     void deleteNode(uint8_t nodeId);
     
+    /*
+     * Calls a function for every node ID currently in memory.
+     *
+     * Only IDs from 1 to SMH_MAX_NODE_ID are visited. Callback may delete the node
+     * it was called with.
+     *
+     * callback: function to call with the node ID
+     *
+     * returns:  no
+     */
+    void forEachNode(void (*callback)(uint8_t nodeId));
+    
+    /*
+     * Reads data for a range of node IDs and calls a function for every node in memory.
+     *
+     * With 23K256, headers come from the cache, so missing and unselected IDs cost no SPI
+     * transaction and every node read is one sequential mode transaction. Records are 100 bytes
+     * apart, so clocking over the gap between two records at 1 MHz would take longer than the
+     * 3 command and address bytes of a new transaction, and nodes are not streamed together.
+     * Callback is called with no transaction open and may use the memory handler.
+     *
+     * firstId:      first node ID to read
+     * count:        number of node IDs to go through
+     * bytesPerNode: number of bytes to read per node (from the beginning), up to 100
+     * buffer:       buffer of at least bytesPerNode bytes, passed to callback
+     * callback:     function to call with the node ID, read bytes and their number
+     * selected:     bitmap of node IDs to read (bit ID % 8 of byte ID / 8), NULL for all
+     *
+     * returns:      number of nodes read
+     */
+    uint8_t getNodesData(uint8_t firstId, uint8_t count, uint8_t bytesPerNode, uint8_t* buffer, void (*callback)(uint8_t nodeId, uint8_t* data, uint8_t length), const uint8_t* selected = NULL);
+    
+    /*
+     * Appends a record to the history of a node.
+     *
+     * Only available with external SRAM, see Sensors23K256Handler for details.
+     *
+     * nodeId:  id of the node
+     * length:  number of bytes in the record
+     * buffer:  record bytes
+     *
+     * returns: true if record was saved, else false
+     */
+    bool appendNodeHistory(uint8_t nodeId, uint8_t length, uint8_t* buffer);
+    
+    /*
+     * Gets state of the history of a node.
+     *
+     * nodeId:   id of the node
+     * sequence: will be set to number of records ever appended (wraps at 2^16). Call with NULL if not needed.
+     *
+     * returns:  number of records currently in the history (0 without external SRAM)
+     */
+    uint8_t getNodeHistoryInfo(uint8_t nodeId, uint16_t* sequence);
+    
+    /*
+     * Gets a record from the history of a node.
+     *
+     * nodeId:  id of the node
+     * index:   0 for the most recent record, 1 for the one before and so on
+     * length:  maximum number of bytes to read
+     * buffer:  buffer to write read bytes
+     *
+     * returns: number of bytes read, 0 if there is no such record
+     */
+    uint8_t getNodeHistory(uint8_t nodeId, uint8_t index, uint8_t length, uint8_t* buffer);
+    
     /*
      * Check whether gateway has external SRAM connected or not.
      *
@@ -33,7 +33,13 @@
  * Version history
  * ---------------
  *
- * 1.1 2020-03-15 (CURRENT)
+ * 1.2 2026-10-14 (CURRENT)
+ *   - Replaced linear chunk scans with a node directory and per-chunk links so that
+ *     header lookups are constant time and reads and deletes only walk the node's own chunks.
+ *   - Added forEachNode() to iterate only node IDs in use.
+ *   - Chunks no longer carry node ID and ordinal bytes, directory holds that information.
+ *
+ * 1.1 2020-03-15
  *   - Fixed a possible problem caused by not checking memory allocation for success.
  *
  * 1.0 2019-12-26
@@ -52,7 +58,7 @@
 void SensorsSRAMHandler::init() {
   for (uint8_t i = 0; i < POOL_CHUNKS; i++) {
     // Allocate memory for a chunk
-    uint8_t* chunk = (uint8_t*)calloc(POOL_CHUNK_RAW_SIZE, sizeof(uint8_t));
+    uint8_t* chunk = (uint8_t*)calloc(POOL_CHUNK_DATA_SIZE, sizeof(uint8_t));
     // Check that memory was actually allocated
     if (chunk != NULL) {
       // Add chunk to pool
@@ -65,56 +71,64 @@ void SensorsSRAMHandler::init() {
     }
   }
   
+  // No node has any chunks yet
+  for (uint8_t i = 0; i <= POOL_MAX_NODE_ID; i++) {
+    _nodeDirectory[i] = POOL_NO_CHUNK;
+  }
+  
   // If we have allocated chunks
   if (_nrOfChunks > 0) {
+    // Link all chunks to the free list
+    for (uint8_t i = 0; i < _nrOfChunks; i++) {
+      _nextChunk[i] = i + 1;
+    }
+    _nextChunk[_nrOfChunks - 1] = POOL_NO_CHUNK;
+    _firstFreeChunk = 0;
+    
     _freeChunks = _nrOfChunks;
     _initialized = true;
   }
 }
 
 /*
- * Finds a free data chunk.
+ * Takes a free data chunk from the free list.
  *
- * returns: pointer to the newly allocated data chunk
+ * returns: index of the newly allocated data chunk, POOL_NO_CHUNK if none free
  */
-uint8_t* SensorsSRAMHandler::allocateDataChunk() {
+uint8_t SensorsSRAMHandler::allocateDataChunk() {
   // Check that instance has been initialized
   if (!_initialized) {
-    return NULL;
+    return POOL_NO_CHUNK;
   }
   
-  for (uint8_t i = 0; i < _nrOfChunks; i++) {
-    // The first byte indicates node ID and can not be zero, meaning that chunk is currently not in use.
-    if (_dataPool[i][0] == 0) {
-      _freeChunks--;
-      return _dataPool[i];
-    }
+  uint8_t chunk = _firstFreeChunk;
+  
+  // Unlink chunk from the free list
+  if (chunk != POOL_NO_CHUNK) {
+    _firstFreeChunk = _nextChunk[chunk];
+    _nextChunk[chunk] = POOL_NO_CHUNK;
+    _freeChunks--;
   }
-  // If did not find a free chunk, return NULL pointer
-  return NULL;
+  
+  return chunk;
 }
 
 /*
- * Deallocates (frees) a data chunk.
+ * Deallocates (frees) a data chunk by returning it to the free list.
  *
- * chunk:   pointer to the chunk to be deallocated
+ * chunk:   index of the chunk to be deallocated
  *
  * returns: no
  */
-void SensorsSRAMHandler::deallocateDataChunk(uint8_t* chunk) {
+void SensorsSRAMHandler::deallocateDataChunk(uint8_t chunk) {
   // Check that instance has been initialized
-  if (!_initialized) {
+  if (!_initialized || (chunk >= _nrOfChunks)) {
     return;
   }
   
-  for (uint8_t i = 0; i < _nrOfChunks; i++) {
-    if (_dataPool[i] == chunk) {
-      _freeChunks++;
-      // Clear the first byte (node ID) to indicate free chunk
-      _dataPool[i][0] = 0;
-      break;
-    }
-  }
+  _nextChunk[chunk] = _firstFreeChunk;
+  _firstFreeChunk = chunk;
+  _freeChunks++;
 }
 
 /*
@@ -138,8 +152,8 @@ uint8_t SensorsSRAMHandler::getFreeChunks() {
  * returns: number of bytes written
  */
 uint8_t SensorsSRAMHandler::saveNodeData(uint8_t nodeId, uint8_t length, uint8_t* buffer) {
-  // Check that instance has been initialized
-  if (!_initialized) {
+  // Check that instance has been initialized and ID fits the directory
+  if (!_initialized || (nodeId == 0) || (nodeId > POOL_MAX_NODE_ID)) {
     return 0;
   }
   
@@ -164,13 +178,19 @@ uint8_t SensorsSRAMHandler::saveNodeData(uint8_t nodeId, uint8_t length, uint8_t
   
   // If enough free chunks for the whole data
   if (getFreeChunks() >= neededChunks) {
+    uint8_t previousChunk = POOL_NO_CHUNK;
+    
     for (uint8_t i = 0; i < neededChunks; i++) {
-      uint8_t* chunk = allocateDataChunk();
-      // First byte of a chunk is node ID
-      chunk[0] = nodeId;
-      // Second byte of the chunk is the ordinal:
-      // First chunk of long node data is 0, second chunk 1 and so on
-      chunk[1] = i;
+      uint8_t chunk = allocateDataChunk();
+      
+      // The first chunk goes to the directory, the rest are linked after the previous one
+      if (previousChunk == POOL_NO_CHUNK) {
+        _nodeDirectory[nodeId] = chunk;
+      }
+      else {
+        _nextChunk[previousChunk] = chunk;
+      }
+      previousChunk = chunk;
       
       // Calculate start and end byte of the data to be saved
       start = i * POOL_CHUNK_DATA_SIZE;
@@ -181,7 +201,7 @@ uint8_t SensorsSRAMHandler::saveNodeData(uint8_t nodeId, uint8_t length, uint8_t
       
       // Save node data to data pool
       for (uint8_t i2 = start; i2 < end; i2++) {
-        chunk[i2 + POOL_CHUNK_HEADER_SIZE - start] = buffer[i2];
+        _dataPool[chunk][i2 - start] = buffer[i2];
       }
     }
   }
@@ -201,21 +221,19 @@ uint8_t SensorsSRAMHandler::saveNodeData(uint8_t nodeId, uint8_t length, uint8_t
  */
 uint8_t SensorsSRAMHandler::getNodeHeader(uint8_t nodeId) {
   // Check that instance has been initialized
-  if (!_initialized) {
+  if (!_initialized || (nodeId > POOL_MAX_NODE_ID)) {
     return 0;
   }
   
-  for (uint8_t i = 0; i < _nrOfChunks; i++) {
-    if (_dataPool[i][0] == nodeId) {
-      // If this is the first chunk of node data (ie. it has the header)
-      if (_dataPool[i][1] == 0) {
-        // First byte is node ID, second one ordinal, third one the actual header
-        return _dataPool[i][2];
-      }
-    }
-  }
+  uint8_t chunk = _nodeDirectory[nodeId];
+  
   // Return zero to indicate node ID not found (header can not be zero)
-  return 0;
+  if (chunk == POOL_NO_CHUNK) {
+    return 0;
+  }
+  
+  // Header is the first byte of the first chunk
+  return _dataPool[chunk][0];
 }
 
 /*
@@ -227,15 +245,18 @@ uint8_t SensorsSRAMHandler::getNodeHeader(uint8_t nodeId) {
  */
 void SensorsSRAMHandler::deleteNode(uint8_t nodeId) {
   // Check that instance has been initialized
-  if (!_initialized) {
+  if (!_initialized || (nodeId > POOL_MAX_NODE_ID)) {
     return;
   }
   
-  // Search every chunk associated to node ID
-  for (uint8_t i = 0; i < _nrOfChunks; i++) {
-    if (_dataPool[i][0] == nodeId) {
-      deallocateDataChunk(_dataPool[i]);
-    }
+  uint8_t chunk = _nodeDirectory[nodeId];
+  _nodeDirectory[nodeId] = POOL_NO_CHUNK;
+  
+  // Return every chunk of the node to the free list
+  while (chunk != POOL_NO_CHUNK) {
+    uint8_t nextChunk = _nextChunk[chunk];
+    deallocateDataChunk(chunk);
+    chunk = nextChunk;
   }
 }
 
@@ -255,12 +276,14 @@ void SensorsSRAMHandler::deleteNode(uint8_t nodeId) {
  */
 uint8_t SensorsSRAMHandler::getNodeData(uint8_t nodeId, uint8_t length, uint8_t* buffer, uint8_t offset) {
   // Check that instance has been initialized
-  if (!_initialized) {
+  if (!_initialized || (nodeId > POOL_MAX_NODE_ID)) {
     return 0;
   }
   
+  uint8_t chunk = _nodeDirectory[nodeId];
+  
   // Check that the ID exists
-  if (getNodeHeader(nodeId) == 0) {
+  if (chunk == POOL_NO_CHUNK) {
     return 0;
   }
   
@@ -269,48 +292,45 @@ uint8_t SensorsSRAMHandler::getNodeData(uint8_t nodeId, uint8_t length, uint8_t*
     length = 100 - offset;
   }
   
-  // Calculate how many chunks the data has been divided to
-  uint8_t neededChunks = ceil((double)(length + offset) / POOL_CHUNK_DATA_SIZE);
-  uint8_t start = 0;
-  uint8_t end = 0;
+  // Skip chunks that are completely covered by offset
+  while ((chunk != POOL_NO_CHUNK) && (offset >= POOL_CHUNK_DATA_SIZE)) {
+    offset -= POOL_CHUNK_DATA_SIZE;
+    chunk = _nextChunk[chunk];
+  }
+  
   uint8_t bytesWritten = 0;
   
-  for (uint8_t chunkNumber = 0; chunkNumber < neededChunks; chunkNumber++) {
-    for (uint8_t i = 0; i < _nrOfChunks; i++) {
-      if (_dataPool[i][0] == nodeId) {
-        if (_dataPool[i][1] == chunkNumber) {
-          
-          // Calculate start byte of the chunk
-          start = POOL_CHUNK_HEADER_SIZE + offset;
-          // If start byte would overflow chunk size...
-          if (start >= POOL_CHUNK_RAW_SIZE) {
-            // ... calculate remaining offset for the next chunk
-            offset = offset - POOL_CHUNK_DATA_SIZE;
-            // ... and discard this chunk completely
-            continue;
-          }
-          // ... else clear offset to indicate we have handled it
-          else {
-            offset = 0;
-          }
-          // Assume we iterate through the whole chunk
-          end = POOL_CHUNK_RAW_SIZE;
-          
-          for (uint8_t i2 = start; i2 < end; i2++) {
-            // Copy byte to outside buffer
-            buffer[bytesWritten] = _dataPool[i][i2];
-            bytesWritten++;
-            
-            // If we have copied requested bytes, break off
-            if (bytesWritten == length) {
-              break;
-            }
-          }
-          // No need to iterate the rest of the chunks anymore, instead go to the next chunk number
-          break;
-        }
-      }
+  // Copy bytes chunk by chunk until requested bytes have been copied or chain ends
+  while ((chunk != POOL_NO_CHUNK) && (bytesWritten < length)) {
+    for (uint8_t i = offset; (i < POOL_CHUNK_DATA_SIZE) && (bytesWritten < length); i++) {
+      buffer[bytesWritten] = _dataPool[chunk][i];
+      bytesWritten++;
     }
+    // Offset affects only the first chunk read
+    offset = 0;
+    chunk = _nextChunk[chunk];
   }
   return bytesWritten;
 }
+
+/*
+ * Calls a function for every node ID currently in memory.
+ *
+ * Callback may delete the node it was called with.
+ *
+ * callback: function to call with the node ID
+ *
+ * returns:  no
+ */
+void SensorsSRAMHandler::forEachNode(void (*callback)(uint8_t nodeId)) {
+  // Check that instance has been initialized
+  if (!_initialized) {
+    return;
+  }
+  
+  for (uint8_t i = 1; i <= POOL_MAX_NODE_ID; i++) {
+    if (_nodeDirectory[i] != POOL_NO_CHUNK) {
+      callback(i);
+    }
+  }
+}
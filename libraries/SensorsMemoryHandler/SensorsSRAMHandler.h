@@ -33,7 +33,13 @@
  * Version history
  * ---------------
  *
- * 1.1 2020-03-15 (CURRENT)
+ * 1.2 2026-10-14 (CURRENT)
+ *   - Replaced linear chunk scans with a node directory and per-chunk links so that
+ *     header lookups are constant time and reads and deletes only walk the node's own chunks.
+ *   - Added forEachNode() to iterate only node IDs in use.
+ *   - Chunks no longer carry node ID and ordinal bytes, directory holds that information.
+ *
+ * 1.1 2020-03-15
  *   - Fixed a possible problem caused by not checking memory allocation for success.
  *
  * 1.0 2019-12-26
@@ -58,37 +64,40 @@
 // 5 pulse nodes OR 6 battery and 2 pulse nodes and so on. 10 chunks is on the
 // high side and increasing that starts to be pushing the limits.
 
-// Bytes added by this library to every chunk (node ID and chunk ordinal for now)
-// DO NOT CHANGE!
-#define POOL_CHUNK_HEADER_SIZE 2
-// Size of a complete chunk
+// Highest node ID the directory can hold. Directory takes one byte per ID.
+#define POOL_MAX_NODE_ID       100
+
+// Marks an unused directory entry or the end of a chunk chain
 // DO NOT CHANGE!
-#define POOL_CHUNK_RAW_SIZE    (POOL_CHUNK_DATA_SIZE + POOL_CHUNK_HEADER_SIZE)
+#define POOL_NO_CHUNK          255
 
 class SensorsSRAMHandler {
   
   private:
 
-    uint8_t* _dataPool[POOL_CHUNKS]; // Memory pool for data
-    uint8_t _freeChunks = 0;         // Number of free chunks
-    uint8_t _nrOfChunks = 0;         // Number of chunks in total
-    bool _initialized = false;       // SRAM handler has been initialized
+    uint8_t* _dataPool[POOL_CHUNKS];              // Memory pool for data
+    uint8_t _nodeDirectory[POOL_MAX_NODE_ID + 1]; // First chunk of every node ID (POOL_NO_CHUNK if not in use)
+    uint8_t _nextChunk[POOL_CHUNKS];              // Next chunk of the same node, or next free chunk if chunk is free
+    uint8_t _firstFreeChunk = POOL_NO_CHUNK;      // First chunk in the free list
+    uint8_t _freeChunks = 0;                      // Number of free chunks
+    uint8_t _nrOfChunks = 0;                      // Number of chunks in total
+    bool _initialized = false;                    // SRAM handler has been initialized
 
     /*
-     * Finds a free data chunk.
+     * Takes a free data chunk from the free list.
      *
-     * returns: pointer to the newly allocated data chunk
+     * returns: index of the newly allocated data chunk, POOL_NO_CHUNK if none free
      */
-    uint8_t* allocateDataChunk();
+    uint8_t allocateDataChunk();
     
     /*
-     * Deallocates (frees) a data chunk.
+     * Deallocates (frees) a data chunk by returning it to the free list.
      *
-     * chunk:   pointer to the chunk to be deallocated
+     * chunk:   index of the chunk to be deallocated
      *
      * returns: no
      */
-    void deallocateDataChunk(uint8_t* chunk);
+    void deallocateDataChunk(uint8_t chunk);
     
     /*
      * Returns the amount of free data chunks.
@@ -157,6 +166,17 @@ class SensorsSRAMHandler {
      * returns: number of bytes read
      */
     uint8_t getNodeData(uint8_t nodeId, uint8_t length, uint8_t* buffer, uint8_t offset);
+    
+    /*
+     * Calls a function for every node ID currently in memory.
+     *
+     * Callback may delete the node it was called with.
+     *
+     * callback: function to call with the node ID
+     *
+     * returns:  no
+     */
+    void forEachNode(void (*callback)(uint8_t nodeId));
 };
 
 #endif
@@ -33,21 +33,91 @@
  * The parts may not work well together but it does not make much sense for the same device to operate
  * as Modbus slave and master at the same time anyway.
  *
- * Currently supports only function codes 3 (read holding registers) and 4 (read input registers). 
+ * Currently supports only function codes 3 (read holding registers), 4 (read input registers) and
+ * 6 (write single register). 
+ * Slave can also send frames of its own when the line is idle, for example to push data to the master.
+ * Master queues up to MASTER_QUEUE_LENGTH requests and sends them in turn.
  */
 
 #include "SimpleModbusAsync.h"
 
+// Lookup table for Modbus CRC (polynomial 0xa001, reflected)
+#ifdef MODBUS_CRC_NIBBLE_TABLE
+static const uint16_t crcTable[16] PROGMEM = {
+  0x0000, 0xCC01, 0xD801, 0x1400, 0xF001, 0x3C00, 0x2800, 0xE401,
+  0xA001, 0x6C00, 0x7800, 0xB401, 0x5000, 0x9C01, 0x8801, 0x4400
+};
+#else
+static const uint16_t crcTable[256] PROGMEM = {
+  0x0000, 0xC0C1, 0xC181, 0x0140, 0xC301, 0x03C0, 0x0280, 0xC241,
+  0xC601, 0x06C0, 0x0780, 0xC741, 0x0500, 0xC5C1, 0xC481, 0x0440,
+  0xCC01, 0x0CC0, 0x0D80, 0xCD41, 0x0F00, 0xCFC1, 0xCE81, 0x0E40,
+  0x0A00, 0xCAC1, 0xCB81, 0x0B40, 0xC901, 0x09C0, 0x0880, 0xC841,
+  0xD801, 0x18C0, 0x1980, 0xD941, 0x1B00, 0xDBC1, 0xDA81, 0x1A40,
+  0x1E00, 0xDEC1, 0xDF81, 0x1F40, 0xDD01, 0x1DC0, 0x1C80, 0xDC41,
+  0x1400, 0xD4C1, 0xD581, 0x1540, 0xD701, 0x17C0, 0x1680, 0xD641,
+  0xD201, 0x12C0, 0x1380, 0xD341, 0x1100, 0xD1C1, 0xD081, 0x1040,
+  0xF001, 0x30C0, 0x3180, 0xF141, 0x3300, 0xF3C1, 0xF281, 0x3240,
+  0x3600, 0xF6C1, 0xF781, 0x3740, 0xF501, 0x35C0, 0x3480, 0xF441,
+  0x3C00, 0xFCC1, 0xFD81, 0x3D40, 0xFF01, 0x3FC0, 0x3E80, 0xFE41,
+  0xFA01, 0x3AC0, 0x3B80, 0xFB41, 0x3900, 0xF9C1, 0xF881, 0x3840,
+  0x2800, 0xE8C1, 0xE981, 0x2940, 0xEB01, 0x2BC0, 0x2A80, 0xEA41,
+  0xEE01, 0x2EC0, 0x2F80, 0xEF41, 0x2D00, 0xEDC1, 0xEC81, 0x2C40,
+  0xE401, 0x24C0, 0x2580, 0xE541, 0x2700, 0xE7C1, 0xE681, 0x2640,
+  0x2200, 0xE2C1, 0xE381, 0x2340, 0xE101, 0x21C0, 0x2080, 0xE041,
+  0xA001, 0x60C0, 0x6180, 0xA141, 0x6300, 0xA3C1, 0xA281, 0x6240,
+  0x6600, 0xA6C1, 0xA781, 0x6740, 0xA501, 0x65C0, 0x6480, 0xA441,
+  0x6C00, 0xACC1, 0xAD81, 0x6D40, 0xAF01, 0x6FC0, 0x6E80, 0xAE41,
+  0xAA01, 0x6AC0, 0x6B80, 0xAB41, 0x6900, 0xA9C1, 0xA881, 0x6840,
+  0x7800, 0xB8C1, 0xB981, 0x7940, 0xBB01, 0x7BC0, 0x7A80, 0xBA41,
+  0xBE01, 0x7EC0, 0x7F80, 0xBF41, 0x7D00, 0xBDC1, 0xBC81, 0x7C40,
+  0xB401, 0x74C0, 0x7580, 0xB541, 0x7700, 0xB7C1, 0xB681, 0x7640,
+  0x7200, 0xB2C1, 0xB381, 0x7340, 0xB101, 0x71C0, 0x7080, 0xB041,
+  0x5000, 0x90C1, 0x9181, 0x5140, 0x9301, 0x53C0, 0x5280, 0x9241,
+  0x9601, 0x56C0, 0x5780, 0x9741, 0x5500, 0x95C1, 0x9481, 0x5440,
+  0x9C01, 0x5CC0, 0x5D80, 0x9D41, 0x5F00, 0x9FC1, 0x9E81, 0x5E40,
+  0x5A00, 0x9AC1, 0x9B81, 0x5B40, 0x9901, 0x59C0, 0x5880, 0x9841,
+  0x8801, 0x48C0, 0x4980, 0x8941, 0x4B00, 0x8BC1, 0x8A81, 0x4A40,
+  0x4E00, 0x8EC1, 0x8F81, 0x4F40, 0x8D01, 0x4DC0, 0x4C80, 0x8C41,
+  0x4400, 0x84C1, 0x8581, 0x4540, 0x8701, 0x47C0, 0x4680, 0x8641,
+  0x8201, 0x42C0, 0x4380, 0x8341, 0x4100, 0x81C1, 0x8081, 0x4040
+};
+#endif
+
 /*
- * Sets communication parameters.
+ * Sets communication parameters and allocates frame buffer.
+ *
+ * If a buffer of the requested size can not be allocated, falls back to BUFFER_SIZE.
+ * Only Serial (USART0) is supported. With any other port no buffer is allocated and
+ * every frame is handled as overflown and nothing is sent.
  *
- * serialPort:  hardware serial port
+ * serialPort:  hardware serial port, must be &Serial
  * baud:        speed of the port
  * txEnablePin: TX enable pin for Maxim MAX(3)485 RS-485 transceiver chip (set to 255 if not in use)
+ * bufferSize:  size of the frame buffer in bytes (up to MAX_BUFFER_SIZE)
  *
  * returns:     no
  */
-void SimpleModbusAsync::setComms(HardwareSerial* serialPort, uint32_t baud, byte txEnablePin) {
+void SimpleModbusAsync::setComms(HardwareSerial* serialPort, uint32_t baud, byte txEnablePin, uint16_t bufferSize) {
+  if (bufferSize > MAX_BUFFER_SIZE) {
+    bufferSize = MAX_BUFFER_SIZE;
+  }
+  
+  // Allocate frame buffer, free possible previous one first
+  free(_frame);
+  _frame = NULL;
+  // End of transmit is read from USART0 registers, so other ports get no buffer
+  if (serialPort == &Serial) {
+    _frame = (byte*)calloc(bufferSize, sizeof(byte));
+    // If failed, try the default size
+    if (!_frame && (bufferSize > BUFFER_SIZE)) {
+      bufferSize = BUFFER_SIZE;
+      _frame = (byte*)calloc(bufferSize, sizeof(byte));
+    }
+  }
+  // Without a buffer every frame is handled as overflown and nothing is sent
+  _bufferSize = _frame ? bufferSize : 0;
+  
   _ModbusPort = serialPort;
   _txEnablePin = txEnablePin;
   if (_txEnablePin != 255) {
@@ -56,9 +126,14 @@ void SimpleModbusAsync::setComms(HardwareSerial* serialPort, uint32_t baud, byte
   }
   _ModbusPort->begin(baud, SERIAL_8N1);
   _onGoing = false;
-  _isSending = false;
+  _txState = TX_IDLE;
   _waitingResponseFrom = 0;
   _masterHasResponse = false;
+  _masterTimeout = MASTER_READ_TIMEOUT;
+  _masterQueueHead = 0;
+  _masterQueueCount = 0;
+  _masterQueueSent = false;
+  _masterLastStart = 0;
   
   // Calculate correct timings based on Modbus standard
   if (baud > 19200) {
@@ -71,6 +146,17 @@ void SimpleModbusAsync::setComms(HardwareSerial* serialPort, uint32_t baud, byte
   }
 }
 
+/*
+ * Returns size of the frame buffer.
+ *
+ * parameters: no
+ *
+ * returns:    frame buffer size in bytes (0 if allocation failed)
+ */
+uint16_t SimpleModbusAsync::getBufferSize() {
+  return _bufferSize;
+}
+
 /*
  * Sets slave address.
  *
@@ -92,9 +178,10 @@ void SimpleModbusAsync::setAddress(byte address) {
 void SimpleModbusAsync::flushPort() {
   _buffer = 0;
   _onGoing = false;
-  _isSending = false;
+  _txState = TX_IDLE;
   _waitingResponseFrom = 0;
   _masterHasResponse = false;
+  _masterQueueSent = false;
   _overflow = false;
   
   while (_ModbusPort->available()) {
@@ -108,28 +195,39 @@ void SimpleModbusAsync::flushPort() {
  * NOTE: Must be called frequently enough in order to respond to requests in time!
  *
  * startRegister: will be set to first requested register number. Call with NULL if not needed.
- * nrOfRegisters: will be set to number of registers requested. Call with NULL if not needed.
+ * nrOfRegisters: will be set to number of registers requested (value to write with function code 6).
+ *                Call with NULL if not needed.
  * functionCode:  will be set to requested function code. Call with NULL if not needed.
  *
  * returns:       status code (see .h for codes)
  */
 byte SimpleModbusAsync::modbusUpdate(uint16_t* startRegister, uint16_t* nrOfRegisters, uint8_t* functionCode) {
+  return updateMasterQueue(updateFrames(startRegister, nrOfRegisters, functionCode));
+}
+
+/*
+ * Receives and processes frames.
+ *
+ * startRegister: will be set to first requested register number. Call with NULL if not needed.
+ * nrOfRegisters: will be set to number of registers requested (value to write with function code 6).
+ *                Call with NULL if not needed.
+ * functionCode:  will be set to requested function code. Call with NULL if not needed.
+ *
+ * returns:       status code (see .h for codes)
+ */
+byte SimpleModbusAsync::updateFrames(uint16_t* startRegister, uint16_t* nrOfRegisters, uint8_t* functionCode) {
   
   // If currently sending
-  if (_isSending) {
-    // If sending has just finished
-    if (!(bit_is_set(UCSR0B, UDRIE0) || bit_is_clear(UCSR0A, TXC0))) {
-      finishSend();
-      return FRAME_SENT;
-    }
-    return FRAME_SENDING;
+  if (_txState != TX_IDLE) {
+    return updateSend();
   }
   
   // If expecting a response (master mode) and timeout has been exceeded, clear flag
   // This is in case a slave does not respond to a master request at all
-  if (_waitingResponseFrom) {
-    if ((millis() - _masterSentRequest) > MASTER_READ_TIMEOUT) {
+  if (_waitingResponseFrom && !_onGoing) {
+    if ((millis() - _masterSentRequest) > _masterTimeout) {
       _waitingResponseFrom = 0;
+      return MASTER_TIMEOUT;
     }
   }
   
@@ -150,6 +248,7 @@ byte SimpleModbusAsync::modbusUpdate(uint16_t* startRegister, uint16_t* nrOfRegi
       _buffer = 0;
       _overflow = false;
       _onGoing = true;
+      _rxCRC = 0xffff;
       // Clear flag for having a response from a slave since the response will be lost (sharing the same buffer)
       _masterHasResponse = false;
     }
@@ -159,13 +258,14 @@ byte SimpleModbusAsync::modbusUpdate(uint16_t* startRegister, uint16_t* nrOfRegi
     }
     else {
       // If buffer has just become full
-      if (_buffer == BUFFER_SIZE) {
+      if (_buffer >= _bufferSize) {
         _overflow = true;
         _ModbusPort->read();
       }
-      // Read character to buffer
+      // Read character to buffer and update CRC so that it is ready when the frame ends
       else {
         _frame[_buffer] = _ModbusPort->read();
+        _rxCRC = updateCRC(_rxCRC, _frame[_buffer]);
         _buffer++;
       }
     }
@@ -183,14 +283,12 @@ byte SimpleModbusAsync::modbusUpdate(uint16_t* startRegister, uint16_t* nrOfRegi
       
   // As a slave, the minimum request frame is 8 bytes. As a master, minimum response frame is 7 bytes.
   if (((_buffer >= 8) && !_waitingResponseFrom) || ((_buffer >= 7) && _waitingResponseFrom)) {
-    // Combine CRC low and high bytes
-    uint16_t crc = ((_frame[_buffer - 2] << 8) | _frame[_buffer - 1]);
-    // If correct CRC
-    if (calculateCRC(_buffer - 2) == crc) {
+    // CRC over the whole frame including its own CRC bytes is zero for a valid frame
+    if (_rxCRC == 0) {
       // If correct address and not waiting for a response
       if ((_frame[0] == _address) && !_waitingResponseFrom) {
-        // If correct function code (3, read holding registers or 4, read input registers)
-        if ((_frame[1] == 3) || (_frame[1] == 4)) {
+        // If correct function code (3, read holding registers, 4, read input registers or 6, write single register)
+        if ((_frame[1] == 3) || (_frame[1] == 4) || (_frame[1] == 6)) {
           
           // Set data to arguments
           
@@ -265,22 +363,33 @@ byte SimpleModbusAsync::modbusUpdate(uint16_t* startRegister, uint16_t* nrOfRegi
  */
 uint16_t SimpleModbusAsync::calculateCRC(byte bufferSize) {
   uint16_t temp = 0xffff;
-  uint16_t flag = 0;
   
   for (byte i = 0; i < bufferSize; i++) {
-    temp = temp ^ _frame[i];
-    for (byte j = 0; j < 8; j++) {
-      flag = temp & 0x0001;
-      temp >>= 1;
-      if (flag) {
-        temp ^= 0xa001;
-      }
-    }
+    temp = updateCRC(temp, _frame[i]);
   }
   // Reverse byte order
   return (((temp << 8) & 0xff00) | ((temp >> 8) & 0x00ff));
 }
 
+/*
+ * Updates running CRC with one byte.
+ *
+ * crc:     CRC so far (0xffff for the first byte)
+ * data:    next byte
+ *
+ * returns: updated CRC (in calculation byte order)
+ */
+uint16_t SimpleModbusAsync::updateCRC(uint16_t crc, byte data) {
+  #ifdef MODBUS_CRC_NIBBLE_TABLE
+  crc ^= data;
+  crc = (crc >> 4) ^ pgm_read_word(&crcTable[crc & 0x0f]);
+  crc = (crc >> 4) ^ pgm_read_word(&crcTable[crc & 0x0f]);
+  return crc;
+  #else
+  return (crc >> 8) ^ pgm_read_word(&crcTable[(crc ^ data) & 0xff]);
+  #endif
+}
+
 /*
  * Sends Modbus error response.
  *
@@ -303,6 +412,9 @@ bool SimpleModbusAsync::sendErrorResponse(uint8_t originalFunctionCode, uint8_t
     case ERROR_ILLEGAL_FUNCTION:
       _frame[2] = 0x01;
       break;
+    case ERROR_DEVICE_BUSY:
+      _frame[2] = 0x06;
+      break;
     default:
       return false;
   }
@@ -317,6 +429,27 @@ bool SimpleModbusAsync::sendErrorResponse(uint8_t originalFunctionCode, uint8_t
   return true;
 }
 
+/*
+ * Sends response to a write request (function code 6), which echoes the request.
+ *
+ * Only valid right after modbusUpdate() has returned FRAME_RECEIVED.
+ *
+ * originalFunctionCode: function code of the related request
+ *
+ * returns:              true if response was sent, else false
+ */
+bool SimpleModbusAsync::sendWriteResponse(uint8_t originalFunctionCode) {
+  // Request including its CRC is still in the buffer
+  if ((originalFunctionCode == 6) && (_frame[1] == 6) && (_buffer == 8) && (_txState == TX_IDLE)) {
+    sendResponse(8);
+    
+    return true;
+  }
+  else {
+    return false;
+  }
+}
+
 /*
  * Sends normal Modbus response with payload.
  *
@@ -332,16 +465,113 @@ bool SimpleModbusAsync::sendNormalResponse(uint8_t originalFunctionCode, uint8_t
   _masterHasResponse = false;
   
   // Validate some values
-  if (((originalFunctionCode == 3) || (originalFunctionCode == 4)) && ((length + 5) <= BUFFER_SIZE)) {
+  if (((originalFunctionCode == 3) || (originalFunctionCode == 4)) && ((length + 5) <= _bufferSize)) {
     _frame[0] = _address;
     _frame[1] = originalFunctionCode;
     _frame[2] = length;
     
-    // Copy payload to send buffer
+    uint16_t crc = 0xffff;
+    crc = updateCRC(crc, _frame[0]);
+    crc = updateCRC(crc, _frame[1]);
+    crc = updateCRC(crc, _frame[2]);
+    
+    // Copy payload to send buffer and calculate CRC on the way
     for (uint16_t i = 0; i < length; i++) {
       _frame[3 + i] = payload[i + offset];
+      crc = updateCRC(crc, _frame[3 + i]);
     }
     
+    // Add CRC (low byte first)
+    _frame[length + 3] = crc;
+    _frame[length + 4] = (crc >> 8);
+    
+    sendResponse(length + 5);
+    
+    return true;
+  }
+  else {
+    return false;
+  }
+}
+
+/*
+ * Returns payload area of the frame buffer for building a response in place.
+ *
+ * Saves a separate payload buffer when responses are large. Fill the payload and send it using
+ * sendPreparedResponse(). Only valid right after modbusUpdate() has returned FRAME_RECEIVED.
+ *
+ * length:  number of payload bytes going to be written
+ *
+ * returns: pointer to the payload area, NULL if payload does not fit the buffer
+ */
+uint8_t* SimpleModbusAsync::getResponsePayload(uint8_t length) {
+  if (((length + 5) > _bufferSize) || (_txState != TX_IDLE)) {
+    return NULL;
+  }
+  
+  // Clear flag for having a response from a slave since the response will be lost (sharing the same buffer)
+  _masterHasResponse = false;
+  
+  return _frame + 3;
+}
+
+/*
+ * Returns whether the line is idle, so that a frame of its own can be sent.
+ *
+ * parameters: no
+ *
+ * returns:    true if nothing is being received or sent and no response is expected, else false
+ */
+bool SimpleModbusAsync::isIdle() {
+  return (_txState == TX_IDLE) && !_onGoing && !_waitingResponseFrom && !_ModbusPort->available();
+}
+
+/*
+ * Sends a frame that is not a response to any request.
+ *
+ * Data is sent as is followed by CRC, so it should start with an address and a function code the
+ * receiver can tell apart from normal traffic. Frame is sent only if the line is idle.
+ *
+ * data:    frame without CRC
+ * length:  number of bytes in data
+ *
+ * returns: true if frame was sent, else false
+ */
+bool SimpleModbusAsync::sendFrame(uint8_t* data, uint8_t length) {
+  if (((length + 2) > _bufferSize) || !isIdle()) {
+    return false;
+  }
+  
+  // Clear flag for having a response from a slave since the response will be lost (sharing the same buffer)
+  _masterHasResponse = false;
+  
+  memcpy(_frame, data, length);
+  
+  // Add CRC
+  uint16_t crc = calculateCRC(length);
+  _frame[length] = (crc >> 8);
+  _frame[length + 1] = crc;
+  
+  sendResponse(length + 2);
+  
+  return true;
+}
+
+/*
+ * Sends normal Modbus response with payload already in the frame buffer.
+ *
+ * originalFunctionCode: function code of the related request
+ * length:               number of bytes in the payload to send
+ *
+ * returns:              true if response was sent, else false
+ */
+bool SimpleModbusAsync::sendPreparedResponse(uint8_t originalFunctionCode, uint8_t length) {
+  // Validate some values
+  if (((originalFunctionCode == 3) || (originalFunctionCode == 4)) && ((length + 5) <= _bufferSize) && (_txState == TX_IDLE)) {
+    _frame[0] = _address;
+    _frame[1] = originalFunctionCode;
+    _frame[2] = length;
+    
     // Add CRC
     uint16_t crc = calculateCRC(length + 3);
     _frame[length + 3] = (crc >> 8);
@@ -359,24 +589,76 @@ bool SimpleModbusAsync::sendNormalResponse(uint8_t originalFunctionCode, uint8_t
 /*
  * Sends actual Modbus frame.
  *
+ * Only queues the frame. Sending is driven by updateSend() from modbusUpdate().
+ *
  * bytes:   number of bytes in the buffer to send
  *
  * returns: no
  */
 void SimpleModbusAsync::sendResponse(uint16_t bytes) {
-  _isSending = true;
+  _txBytes = bytes;
+  _txState = TX_PENDING;
   
+  // Try to advance right away in case inter frame delay has already passed
+  updateSend();
+}
+
+/*
+ * Advances transmit state machine.
+ *
+ * Waits for inter frame delay and driver warm up using timestamps only, writes the frame and
+ * finalizes sending once the last byte has left. Never blocks.
+ *
+ * parameters: no
+ *
+ * returns:    FRAME_SENDING if still sending, FRAME_SENT if sending has just finished
+ */
+byte SimpleModbusAsync::updateSend() {
   // Wait for quiet time between frames
-  while ((micros() - _lastCharReceived) < _T3_5);
+  if (_txState == TX_PENDING) {
+    if ((micros() - _lastCharReceived) < _T3_5) {
+      return FRAME_SENDING;
+    }
+    // If using MAX(3)485 transceiver, enable driver output and let it stabilize
+    if (_txEnablePin != 255) {
+      digitalWrite(_txEnablePin, HIGH);
+      _txTimer = micros();
+      _txState = TX_WARMUP;
+      return FRAME_SENDING;
+    }
+  }
+  // Wait for driver to stabilize
+  else if (_txState == TX_WARMUP) {
+    if ((micros() - _txTimer) < TX_ENABLE_DELAY) {
+      return FRAME_SENDING;
+    }
+  }
   
-  // If using MAX(3)485 transceiver, enable driver output and wait for it to stabilize
-  if (_txEnablePin != 255) {
-    digitalWrite(_txEnablePin, HIGH);
-    delayMicroseconds(100);
+  if (_txState != TX_WRITING) {
+    _txWritten = 0;
+    _txState = TX_WRITING;
+  }
+  
+  // Write only as much as fits the serial transmit buffer so that large frames do not block
+  if (_txWritten < _txBytes) {
+    uint16_t space = _ModbusPort->availableForWrite();
+    if (space > (_txBytes - _txWritten)) {
+      space = _txBytes - _txWritten;
+    }
+    if (space) {
+      _ModbusPort->write(_frame + _txWritten, space);
+      _txWritten += space;
+    }
+    return FRAME_SENDING;
   }
   
-  // Write frame to serial and return immediately
-  _ModbusPort->write(_frame, bytes);
+  // If sending has just finished (transmit buffer empty and last byte shifted out of USART0,
+  // the port is always Serial, see setComms())
+  if (!(bit_is_set(UCSR0B, UDRIE0) || bit_is_clear(UCSR0A, TXC0))) {
+    finishSend();
+    return FRAME_SENT;
+  }
+  return FRAME_SENDING;
 }
 
 /*
@@ -387,7 +669,12 @@ void SimpleModbusAsync::sendResponse(uint16_t bytes) {
  * returns:    no
  */
 void SimpleModbusAsync::finishSend() {
-  _isSending = false;
+  _txState = TX_IDLE;
+  
+  // Response timeout of a master request starts when the request has left
+  if (_waitingResponseFrom) {
+    _masterSentRequest = millis();
+  }
   
   // Disable MAX3485 driver output (if in use)
   if (_txEnablePin != 255) {
@@ -418,12 +705,12 @@ bool SimpleModbusAsync::masterRead(uint8_t node, uint8_t function, uint16_t star
   }
   
   // Make sure that the response will fit frame buffer
-  if ((nrOfRegisters * 2 + 5) > BUFFER_SIZE) {
+  if ((nrOfRegisters * 2 + 5) > _bufferSize) {
     return false;
   }
   
   // Make sure we are not sending or receiving
-  if (_onGoing || _isSending || _waitingResponseFrom) {
+  if (_onGoing || (_txState != TX_IDLE) || _waitingResponseFrom) {
     return false;
   }
   
@@ -443,6 +730,7 @@ bool SimpleModbusAsync::masterRead(uint8_t node, uint8_t function, uint16_t star
   
   // Set flag that we are expecting a response
   _waitingResponseFrom = node;
+  _masterTimeout = MASTER_READ_TIMEOUT;
   
   // Send data
   sendResponse(8);
@@ -482,3 +770,122 @@ bool SimpleModbusAsync::masterRead(uint8_t node, uint8_t function, uint16_t star
 
   return 0;
 }
+
+/*
+ * Queues a request to read data from a slave.
+ *
+ * Queued requests are sent from modbusUpdate() one at a time, each one as soon as the previous one
+ * has been answered, so several register blocks can be read without waiting in between. Once
+ * modbusUpdate() returns MASTER_RECEIVED, data can be retrieved using masterGetLastResponse() and
+ * masterGetLastStart() tells which request it is for. If there is no valid response even after
+ * retries, modbusUpdate() returns MASTER_TIMEOUT or MASTER_ERROR for the request instead.
+ *
+ * node:          slave address
+ * function:      Modbus function code
+ * start:         first register
+ * nrOfRegisters: number of registers to read
+ * timeout:       milliseconds to wait for response after the request has been sent
+ * retries:       how many times to resend the request if there is no valid response
+ *
+ * returns:       true if request was queued, false if queue is full or request is invalid
+ */
+bool SimpleModbusAsync::masterQueueRead(uint8_t node, uint8_t function, uint16_t start, uint16_t nrOfRegisters, uint16_t timeout, uint8_t retries) {
+  
+  // Validate the same values as masterRead() so that a queued request can always be sent
+  if (!((node >= 1) && (node <= 254) && ((function == 3) || (function == 4)) && (nrOfRegisters > 0))) {
+    return false;
+  }
+  
+  if (((nrOfRegisters * 2 + 5) > _bufferSize) || (_masterQueueCount >= MASTER_QUEUE_LENGTH)) {
+    return false;
+  }
+  
+  uint8_t slot = (_masterQueueHead + _masterQueueCount) % MASTER_QUEUE_LENGTH;
+  _masterQueue[slot].node = node;
+  _masterQueue[slot].function = function;
+  _masterQueue[slot].start = start;
+  _masterQueue[slot].nrOfRegisters = nrOfRegisters;
+  _masterQueue[slot].timeout = timeout;
+  _masterQueue[slot].retries = retries;
+  _masterQueueCount++;
+  
+  return true;
+}
+
+/*
+ * Returns number of requests in the master queue.
+ *
+ * parameters: no
+ *
+ * returns:    number of requests not yet finished (including the one waiting for response)
+ */
+uint8_t SimpleModbusAsync::masterQueueCount() {
+  return _masterQueueCount;
+}
+
+/*
+ * Returns first register of the queued request that modbusUpdate() last returned
+ * MASTER_RECEIVED, MASTER_TIMEOUT or MASTER_ERROR for.
+ *
+ * parameters: no
+ *
+ * returns:    first register of the request
+ */
+uint16_t SimpleModbusAsync::masterGetLastStart() {
+  return _masterLastStart;
+}
+
+/*
+ * Advances master request queue.
+ *
+ * Finishes the sent request based on the status of the latest update, resending it if there are
+ * retries left, and sends the next request when the bus is idle.
+ *
+ * status:  status returned by updateFrames()
+ *
+ * returns: status code for the caller (see .h for codes)
+ */
+byte SimpleModbusAsync::updateMasterQueue(byte status) {
+  if (_masterQueueCount == 0) {
+    return status;
+  }
+  
+  uint8_t head = _masterQueueHead;
+  
+  if (_masterQueueSent) {
+    // Still waiting for response
+    if ((status != MASTER_RECEIVED) && (status != MASTER_ERROR) && (status != MASTER_TIMEOUT) &&
+        (status != ERROR_CRC_FAILED) && (status != ERROR_CORRUPTED) && (status != ERROR_OVERFLOW)) {
+      return status;
+    }
+    
+    _masterQueueSent = false;
+    
+    // Resend if response was lost or broken. An exception response from the slave would not change.
+    if ((status != MASTER_RECEIVED) && (status != MASTER_ERROR) && (_masterQueue[head].retries > 0)) {
+      _masterQueue[head].retries--;
+      return NO_FRAMES;
+    }
+    
+    // Request is finished
+    _masterLastStart = _masterQueue[head].start;
+    _masterQueueHead = (head + 1) % MASTER_QUEUE_LENGTH;
+    _masterQueueCount--;
+    
+    if ((status == MASTER_RECEIVED) || (status == MASTER_TIMEOUT)) {
+      return status;
+    }
+    return MASTER_ERROR;
+  }
+  
+  // Send the oldest request when nothing else is going on. Response of the previous request
+  // stays in the buffer until the next update, so the caller has had time to read it.
+  if (status == NO_FRAMES) {
+    if (masterRead(_masterQueue[head].node, _masterQueue[head].function, _masterQueue[head].start, _masterQueue[head].nrOfRegisters)) {
+      _masterTimeout = _masterQueue[head].timeout;
+      _masterQueueSent = true;
+    }
+  }
+  
+  return status;
+}
@@ -33,7 +33,10 @@
  * The parts may not work well together but it does not make much sense for the same device to operate
  * as Modbus slave and master at the same time anyway.
  *
- * Currently supports only function codes 3 (read holding registers) and 4 (read input registers). 
+ * Currently supports only function codes 3 (read holding registers), 4 (read input registers) and
+ * 6 (write single register). 
+ * Slave can also send frames of its own when the line is idle, for example to push data to the master.
+ * Master queues up to MASTER_QUEUE_LENGTH requests and sends them in turn.
  */
 
 #ifndef SIMPLE_MODBUS_ASYNC_H
@@ -45,25 +48,47 @@
 #define ERROR_CORRUPTED         3
 #define ERROR_ILLEGAL_FUNCTION  4
 #define ERROR_ILLEGAL_ADDRESS   5
+#define ERROR_DEVICE_BUSY       6
 #define FRAME_SENDING           7
 #define FRAME_SENT              8
 #define FRAME_RECEIVING         9
 #define FRAME_RECEIVED          10
 #define MASTER_RECEIVED         11
 #define MASTER_ERROR            12
+#define MASTER_TIMEOUT          13
 
-#define BUFFER_SIZE 50
+#define BUFFER_SIZE 50           // Default frame buffer size
+#define MAX_BUFFER_SIZE 256      // Maximum Modbus RTU frame size
 
 #define MASTER_READ_TIMEOUT     1000
+#define MASTER_QUEUE_LENGTH     4   // Master requests that can wait in the queue
+
+// Transmit states
+#define TX_IDLE                 0   // Nothing to send
+#define TX_PENDING              1   // Frame in buffer, waiting for inter frame delay
+#define TX_WARMUP               2   // Driver output enabled, waiting for it to stabilize
+#define TX_WRITING              3   // Frame written to serial, waiting for the last byte to leave
+
+#define TX_ENABLE_DELAY         100 // Time in microseconds for MAX(3)485 driver to stabilize
+
+// CRC is calculated using a 256 entry lookup table (512 bytes of flash). If flash is tight,
+// define MODBUS_CRC_NIBBLE_TABLE to use a 16 entry table (32 bytes) at about half the speed.
+//#define MODBUS_CRC_NIBBLE_TABLE
 
 #include "Arduino.h"
 
+// End of transmit is read directly from USART0 registers (see updateSend()), so the port must be Serial
+#if defined(ARDUINO_ARCH_AVR) && !defined(UCSR0B)
+#error "SimpleModbusAsync needs a microcontroller with Serial on USART0, such as ATmega328P"
+#endif
+
 
 class SimpleModbusAsync {
   
   private:
   
-    byte _frame[BUFFER_SIZE];         // Shared buffer for Modbus frames
+    byte* _frame;                     // Shared buffer for Modbus frames
+    uint16_t _bufferSize;             // Size of the frame buffer
     byte _txEnablePin;                // Maxim MAX(3)485 driver output pin (255 if not in use)
     byte _address;                    // Slave address 
     uint16_t _T1_5;               // Inter character time
@@ -71,12 +96,63 @@ class SimpleModbusAsync {
     uint32_t _lastCharReceived;  // Time of the last character received
     HardwareSerial* _ModbusPort;      // Modbus serial port
     bool _onGoing;                    // Frame is being received
-    byte _buffer;                     // Bytes read to the buffer
+    uint16_t _buffer;                 // Bytes read to the buffer
     bool _overflow;                   // Too many bytes received
-    bool _isSending;                  // Response is being sent
+    byte _txState;                    // Transmit state (see .h for states)
+    uint16_t _txBytes;                // Bytes in the buffer to send
+    uint16_t _txWritten;              // Bytes already written to serial
+    uint32_t _txTimer;                // Time the current transmit state was entered
     uint8_t _waitingResponseFrom;     // Waiting response from a slave (when operating as master)
     uint32_t _masterSentRequest; // When was a slave sent a request to
     bool _masterHasResponse;          // Response from a slave is in the buffer (when operating as master)
+    uint16_t _masterTimeout;          // Milliseconds to wait for response to the sent request
+    struct {
+      uint8_t node;
+      uint8_t function;
+      uint16_t start;
+      uint16_t nrOfRegisters;
+      uint16_t timeout;
+      uint8_t retries;                // Resends left
+    } _masterQueue[MASTER_QUEUE_LENGTH]; // Queued master requests
+    uint8_t _masterQueueHead;         // Oldest request in the queue
+    uint8_t _masterQueueCount;        // Requests in the queue
+    bool _masterQueueSent;            // Oldest request has been sent and is waiting for response
+    uint16_t _masterLastStart;        // First register of the request the latest master result is for
+    uint16_t _rxCRC;                  // CRC of the bytes received so far (zero after a complete valid frame)
+    
+    /*
+     * Updates running CRC with one byte.
+     *
+     * crc:     CRC so far (0xffff for the first byte)
+     * data:    next byte
+     *
+     * returns: updated CRC (in calculation byte order)
+     */
+    static uint16_t updateCRC(uint16_t crc, byte data);
+    
+    /*
+     * Receives and processes frames.
+     *
+     * startRegister: will be set to first requested register number. Call with NULL if not needed.
+     * nrOfRegisters: will be set to number of registers requested (value to write with function code 6).
+     *                Call with NULL if not needed.
+     * functionCode:  will be set to requested function code. Call with NULL if not needed.
+     *
+     * returns:       status code (see .h for codes)
+     */
+    byte updateFrames(uint16_t* startRegister, uint16_t* nrOfRegisters, uint8_t* functionCode);
+    
+    /*
+     * Advances master request queue.
+     *
+     * Finishes the sent request based on the status of the latest update, resending it if there are
+     * retries left, and sends the next request when the bus is idle.
+     *
+     * status:  status returned by updateFrames()
+     *
+     * returns: status code for the caller (see .h for codes)
+     */
+    byte updateMasterQueue(byte status);
     
     /*
      * Calculates correct CRC for the first "bufferSize" bytes in the buffer.
@@ -90,12 +166,26 @@ class SimpleModbusAsync {
     /*
      * Sends actual Modbus frame.
      *
+     * Only queues the frame. Sending is driven by updateSend() from modbusUpdate().
+     *
      * bytes:   number of bytes in the buffer to send
      *
      * returns: no
      */
     void sendResponse(uint16_t bytes);
     
+    /*
+     * Advances transmit state machine.
+     *
+     * Waits for inter frame delay and driver warm up using timestamps only, writes the frame and
+     * finalizes sending once the last byte has left. Never blocks.
+     *
+     * parameters: no
+     *
+     * returns:    FRAME_SENDING if still sending, FRAME_SENT if sending has just finished
+     */
+    byte updateSend();
+    
     /*
      * Finalizes sending.
      *
@@ -108,15 +198,29 @@ class SimpleModbusAsync {
   public:
   
     /*
-     * Sets communication parameters.
+     * Sets communication parameters and allocates frame buffer.
+     *
+     * If a buffer of the requested size can not be allocated, falls back to BUFFER_SIZE.
+     * Only Serial (USART0) is supported. With any other port no buffer is allocated and
+     * every frame is handled as overflown and nothing is sent.
      *
-     * serialPort:  hardware serial port
+     * serialPort:  hardware serial port, must be &Serial
      * baud:        speed of the port
      * txEnablePin: TX enable pin for Maxim MAX(3)485 RS-485 transceiver chip (set to 255 if not in use)
+     * bufferSize:  size of the frame buffer in bytes (up to MAX_BUFFER_SIZE)
      *
      * returns:     no
      */
-    void setComms(HardwareSerial* serialPort, uint32_t baud, byte txEnablePin);
+    void setComms(HardwareSerial* serialPort, uint32_t baud, byte txEnablePin, uint16_t bufferSize = BUFFER_SIZE);
+    
+    /*
+     * Returns size of the frame buffer.
+     *
+     * parameters: no
+     *
+     * returns:    frame buffer size in bytes (0 if allocation failed)
+     */
+    uint16_t getBufferSize();
     
     /*
      * Sets slave address.
@@ -142,7 +246,8 @@ class SimpleModbusAsync {
      * NOTE: Must be called frequently enough in order to respond to requests in time!
      *
      * startRegister: will be set to first requested register number. Call with NULL if not needed.
-     * nrOfRegisters: will be set to number of registers requested. Call with NULL if not needed.
+     * nrOfRegisters: will be set to number of registers requested (value to write with function code 6).
+     *                Call with NULL if not needed.
      * functionCode:  will be set to requested function code. Call with NULL if not needed.
      *
      * returns:       status code (see .h for codes)
@@ -159,6 +264,17 @@ class SimpleModbusAsync {
      */
     bool sendErrorResponse(uint8_t originalFunctionCode, uint8_t modbusErrorCode);
     
+    /*
+     * Sends response to a write request (function code 6), which echoes the request.
+     *
+     * Only valid right after modbusUpdate() has returned FRAME_RECEIVED.
+     *
+     * originalFunctionCode: function code of the related request
+     *
+     * returns:              true if response was sent, else false
+     */
+    bool sendWriteResponse(uint8_t originalFunctionCode);
+    
     /*
      * Sends normal Modbus response with payload.
      *
@@ -171,6 +287,50 @@ class SimpleModbusAsync {
      */
     bool sendNormalResponse(uint8_t originalFunctionCode, uint8_t* payload, uint8_t length, uint8_t offset);
     
+    /*
+     * Returns payload area of the frame buffer for building a response in place.
+     *
+     * Saves a separate payload buffer when responses are large. Fill the payload and send it using
+     * sendPreparedResponse(). Only valid right after modbusUpdate() has returned FRAME_RECEIVED.
+     *
+     * length:  number of payload bytes going to be written
+     *
+     * returns: pointer to the payload area, NULL if payload does not fit the buffer
+     */
+    uint8_t* getResponsePayload(uint8_t length);
+    
+    /*
+     * Returns whether the line is idle, so that a frame of its own can be sent.
+     *
+     * parameters: no
+     *
+     * returns:    true if nothing is being received or sent and no response is expected, else false
+     */
+    bool isIdle();
+    
+    /*
+     * Sends a frame that is not a response to any request.
+     *
+     * Data is sent as is followed by CRC, so it should start with an address and a function code the
+     * receiver can tell apart from normal traffic. Frame is sent only if the line is idle.
+     *
+     * data:    frame without CRC
+     * length:  number of bytes in data
+     *
+     * returns: true if frame was sent, else false
+     */
+    bool sendFrame(uint8_t* data, uint8_t length);
+    
+    /*
+     * Sends normal Modbus response with payload already in the frame buffer.
+     *
+     * originalFunctionCode: function code of the related request
+     * length:               number of bytes in the payload to send
+     *
+     * returns:              true if response was sent, else false
+     */
+    bool sendPreparedResponse(uint8_t originalFunctionCode, uint8_t length);
+    
     /*
      * Requests data from a slave.
      *
@@ -199,6 +359,45 @@ class SimpleModbusAsync {
      * returns: number of bytes written to buffer
      */
     uint8_t masterGetLastResponse(uint8_t* buffer, uint8_t length);
+    
+    /*
+     * Queues a request to read data from a slave.
+     *
+     * Queued requests are sent from modbusUpdate() one at a time, each one as soon as the previous one
+     * has been answered, so several register blocks can be read without waiting in between. Once
+     * modbusUpdate() returns MASTER_RECEIVED, data can be retrieved using masterGetLastResponse() and
+     * masterGetLastStart() tells which request it is for. If there is no valid response even after
+     * retries, modbusUpdate() returns MASTER_TIMEOUT or MASTER_ERROR for the request instead.
+     *
+     * node:          slave address
+     * function:      Modbus function code
+     * start:         first register
+     * nrOfRegisters: number of registers to read
+     * timeout:       milliseconds to wait for response after the request has been sent
+     * retries:       how many times to resend the request if there is no valid response
+     *
+     * returns:       true if request was queued, false if queue is full or request is invalid
+     */
+    bool masterQueueRead(uint8_t node, uint8_t function, uint16_t start, uint16_t nrOfRegisters, uint16_t timeout = MASTER_READ_TIMEOUT, uint8_t retries = 0);
+    
+    /*
+     * Returns number of requests in the master queue.
+     *
+     * parameters: no
+     *
+     * returns:    number of requests not yet finished (including the one waiting for response)
+     */
+    uint8_t masterQueueCount();
+    
+    /*
+     * Returns first register of the queued request that modbusUpdate() last returned
+     * MASTER_RECEIVED, MASTER_TIMEOUT or MASTER_ERROR for.
+     *
+     * parameters: no
+     *
+     * returns:    first register of the request
+     */
+    uint16_t masterGetLastStart();
 };
 
 #endif
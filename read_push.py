@@ -0,0 +1,141 @@
+#!/usr/bin/env python3
+
+# MIT License
+#
+# Copyright (c) 2026 aattww (https://github.com/aattww/)
+#
+# Permission is hereby granted, free of charge, to any person obtaining a copy
+# of this software and associated documentation files (the "Software"), to deal
+# in the Software without restriction, including without limitation the rights
+# to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+# copies of the Software, and to permit persons to whom the Software is
+# furnished to do so, subject to the following conditions:
+#
+# The above copyright notice and this permission notice shall be included in all
+# copies or substantial portions of the Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+# IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+# AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+# LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+# OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+# SOFTWARE.
+
+
+# Python script to read messages a Sensors gateway pushes over its serial port in push mode.
+#
+# Enable push mode in the gateway settings (ENABLE_PUSH_MODE) and connect the gateway directly to
+# the serial port. Every new node message is printed as soon as the gateway has received it.
+# Also remember to install pyserial library: https://pypi.org/project/pyserial/
+#
+# Each message is sent as a Modbus RTU like frame from address 0 (broadcast address, never used by
+# a responding slave) with user defined function code 100:
+#
+#   address (0) | function (100) | node id | sequence | RSSI | SNR | length | message | CRC (2)
+#
+# Sequence is the message number given by the node (0 if node does not number its messages), RSSI
+# (dBm) and SNR (dB) are signed bytes. Message is "length" bytes as sent by the node, node type is
+# in the 3 LSB of its first byte. CRC is Modbus CRC16, LSB first. Without external SRAM in gateway,
+# sequence, RSSI and SNR are zero if the message had to wait for Modbus traffic to end.
+
+# Use with "read_push.py" or "read_push.py -v" for printing also message bytes.
+
+
+##################
+# BEGIN SETTINGS #
+##################
+
+# Serial settings
+serial_device = "/dev/serial0" # This should work with Raspberry if gateway is connected directly to headers
+
+################
+# END SETTINGS #
+################
+
+import serial
+import sys
+
+PUSH_FUNCTION = 100
+HEADER_LENGTH = 7
+MAX_MESSAGE_LENGTH = 45
+
+node_types = {1: "battery", 2: "pulse with Kamstrup", 3: "pulse", 4: "battery", 5: "battery", 6: "battery", 7: "battery batch"}
+
+# Helper function to calculate Modbus CRC16.
+#
+# data:     bytes to calculate CRC over
+#
+# returns:  CRC
+#
+def get_crc(data):
+  crc = 0xFFFF
+  for byte in data:
+    crc ^= byte
+    for i in range(8):
+      if (crc & 0x0001):
+        crc = (crc >> 1) ^ 0xA001
+      else:
+        crc >>= 1
+  return crc
+
+# Helper function to convert 8 bit unsigned values to signed values.
+#
+# value:    unsigned value to be converted
+#
+# returns:  signed value
+#
+def to_signed8(value):
+  if (value >= 2**7):
+    return (value - 2**8)
+  else:
+    return (value)
+
+# Function to take the next valid frame from received bytes.
+#
+# Bytes before a valid frame (Modbus traffic or noise) are dropped from the buffer.
+#
+# buffer:  received bytes, frame is removed from it
+#
+# returns: frame without CRC, None if there is no complete frame yet
+#
+def take_frame(buffer):
+  while (len(buffer) >= HEADER_LENGTH):
+    # Find the start of a frame
+    if ((buffer[0] != 0) or (buffer[1] != PUSH_FUNCTION) or (buffer[6] == 0) or (buffer[6] > MAX_MESSAGE_LENGTH)):
+      del buffer[0]
+      continue
+
+    length = HEADER_LENGTH + buffer[6]
+    if (len(buffer) < (length + 2)):
+      return None
+
+    crc = get_crc(buffer[:length])
+    if ((buffer[length] != (crc & 0xFF)) or (buffer[length + 1] != (crc >> 8))):
+      del buffer[0]
+      continue
+
+    frame = bytes(buffer[:length])
+    del buffer[:length + 2]
+    return frame
+  return None
+
+print_verbose = (len(sys.argv) > 1) and (sys.argv[1] == "-v")
+
+port = serial.Serial(serial_device, 38400, timeout=1)
+buffer = bytearray()
+
+while True:
+  try:
+    buffer += port.read(max(1, port.in_waiting))
+
+    frame = take_frame(buffer)
+    while (frame is not None):
+      message = frame[HEADER_LENGTH:]
+      node_type = node_types.get(message[0] & 0x07, "unknown")
+      print("Node %i (%s), sequence %i, RSSI %i dBm, SNR %i dB" %(frame[2], node_type, frame[3], to_signed8(frame[4]), to_signed8(frame[5])))
+      if (print_verbose):
+        print("  " + " ".join("%02x" %(byte) for byte in message))
+      frame = take_frame(buffer)
+  except KeyboardInterrupt:
+    break
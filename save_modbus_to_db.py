@@ -23,8 +23,17 @@
 # SOFTWARE.
 
 
-# Simple example (very simplified) Python script to read data from a Sensors gateway and save
-# it to MySQL database. Use this as a base for your own needs.
+
+# Simple Python script to collect data from a Sensors gateway and save it to MySQL database.
+# Use this as a base for your own needs.
+#
+# Script runs until stopped and polls the gateway every poll_interval seconds. Only nodes that have
+# sent a new message since the previous poll are read, every node with one read of all its registers
+# (several reads without external SRAM, as frames are shorter).
+# All values of one poll are saved in one transaction over a connection kept open between polls.
+#
+# Every node has its own table named table_prefix + node id, for example "node_1", with a "time"
+# column as a unique key and a column for every saved value (see saved_values below).
 #
 # Remember to change the correct port and slave address and database settings below before use.
 #
@@ -46,6 +55,18 @@ db_user = "user"
 db_password = "password"
 db_host = "localhost"
 db_database = "database"
+table_prefix = "node_"
+
+# How often to poll the gateway in seconds
+poll_interval = 60
+
+# Values saved to database by node type (see register maps below for names)
+saved_values = {
+  "battery": ["temperature", "humidity", "pressure"],
+  "pulse": ["pulse1", "pulse2", "pulse3"],
+  "kamstrup": ["pulse1", "pulse2", "pulse3", "energy", "flow", "volume", "power", "t1", "t2"],
+  "batch": ["temperature", "humidity", "pressure"],
+}
 
 ################
 # END SETTINGS #
@@ -53,61 +74,223 @@ db_database = "database"
 
 import minimalmodbus
 import mysql.connector
-from datetime import datetime
+import time
+from datetime import datetime, timedelta
+
+# Register maps of node types, same as in gateway firmware. Every value is described by its name
+# and form: "u16" and "s16" take one register, "u32" and "s32" two registers (MSW first).
+register_maps = {
+  "battery": [("last_received", "u16"), ("battery_voltage", "u16"), ("transmit_power", "u16"),
+              ("transmit_interval", "u16"), ("header", "u16"), ("temperature", "s16"),
+              ("humidity", "s16"), ("pressure", "s16")],
+  "pulse": [("last_received", "u16"), ("transmit_power", "u16"), ("transmit_interval", "u16"),
+            ("header", "u16"), ("pulse1", "u32"), ("pulse2", "u32"), ("pulse3", "s32"),
+            ("rate1", "u16"), ("rate2", "u16"), ("rate3", "u16")],
+  "kamstrup": [("last_received", "u16"), ("transmit_power", "u16"), ("transmit_interval", "u16"),
+               ("header", "u16"), ("pulse1", "u32"), ("pulse2", "u32"), ("pulse3", "s32"),
+               ("energy", "u32"), ("flow", "u32"), ("volume", "u32"), ("power", "u32"),
+               ("t1", "s32"), ("t2", "s32"), ("rate1", "u16"), ("rate2", "u16"), ("rate3", "u16")],
+  "batch": [("last_received", "u16"), ("battery_voltage", "u16"), ("transmit_power", "u16"),
+            ("transmit_interval", "u16"), ("header", "u16"), ("sensor_header", "u16"),
+            ("samples", "u16"), ("sample_interval", "u16")] +
+           [(name + str(i), "s16") for i in range(1, 10) for name in ("temperature", "humidity", "pressure")],
+}
+
+# Node types by the type bits of the header
+header_types = {1: "battery", 2: "kamstrup", 3: "pulse", 4: "battery", 5: "battery", 6: "battery", 7: "batch"}
+
+UPDATED_REGISTER = 30
+UPDATED_REGISTERS = 7
+COUNTER_REGISTER = 40
+COUNTER_REGISTERS = 51
+MAX_NR_OF_NODES = 100
 
-# Helper function to convert 16 bit unsigned values from gateway to signed 16 bit values
-# so that negative values are handled correctly.
+# Helper function to calculate how many registers a register map takes.
 #
-# value:    unsigned value to be converted
+# register_map: register map of a node type
 #
-# returns:  signed value
+# returns:      number of registers
 #
-def to_signed(value):
-  if (value >= 2**15):
-    return (value - 2**16)
-  else:
-    return (value)
+def get_map_length(register_map):
+  return sum(2 if (form[1:] == "32") else 1 for name, form in register_map)
 
-# Function to save one value to database.
+# Helper function to decode registers read from a node.
 #
-# Automatically adds current date and time.
+# register_map: register map of the node type
+# registers:    registers read from the node
 #
-# table:   database table name
-# column:  database column
-# value:   value to be saved
+# returns:      dictionary of values by name
 #
-# returns: no
+def decode_registers(register_map, registers):
+  values = {}
+  position = 0
+  for name, form in register_map:
+    if (form[1:] == "32"):
+      value = (registers[position] << 16) | registers[position + 1]
+      position += 2
+    else:
+      value = registers[position]
+      position += 1
+    
+    bits = int(form[1:])
+    if ((form[0] == "s") and (value >= 2**(bits - 1))):
+      value -= 2**bits
+    values[name] = value
+  return values
+
+# Function to find which nodes have a new message since the previous poll.
 #
-def save_to_db(table, column, value):
-  try:
-    cnx = mysql.connector.connect(user=db_user, password=db_password, host=db_host, database=db_database)
-    cursor = cnx.cursor()
+# Uses updated nodes bitmap, and update counters to also catch updates whose bitmap response was lost.
+#
+# previous_counters: update counters of the previous poll (None on the first poll)
+#
+# returns:           tuple of changed node ids and current update counters
+#
+def get_changed_nodes(previous_counters):
+  bitmap = gateway.read_registers(UPDATED_REGISTER, UPDATED_REGISTERS)
+  registers = gateway.read_registers(COUNTER_REGISTER, COUNTER_REGISTERS)
   
-    dt = datetime.now().replace(second=0, microsecond=0)
+  counters = []
+  for register in registers:
+    counters += [register >> 8, register & 0xFF]
   
-    add_reading = ("INSERT INTO " + table + "(time, " + column + ") VALUES (%s, %s) ON DUPLICATE KEY UPDATE time=VALUES(time), " + column + "=VALUES(" + column + ")")
-    data_reading = (dt, str(value))
-    cursor.execute(add_reading, data_reading)
-    cnx.commit()
+  changed = set()
+  for node_id in range(1, MAX_NR_OF_NODES + 1):
+    if (bitmap[node_id // 16] & (1 << (node_id % 16))):
+      changed.add(node_id)
+    elif ((previous_counters is not None) and (counters[node_id] != previous_counters[node_id])):
+      changed.add(node_id)
+  
+  return (sorted(changed), counters)
+
+# Helper function to read registers in as few reads as the gateway frame size allows.
+#
+# start:   first register
+# count:   number of registers
+#
+# returns: list of registers
+#
+def read_block(start, count):
+  registers = []
+  while (len(registers) < count):
+    registers += gateway.read_registers(start + len(registers), min(count - len(registers), max_registers))
+  return registers
+
+# Function to read all registers of a node.
+#
+# Node type is not known from the node id, so on the first read every register map length is tried,
+# longest first. Lengths are different for every type and reading past the registers of a node fails.
+# Registers are read in one read if they fit the frame.
+#
+# node_id: id of the node
+#
+# returns: tuple of node type and registers (None if node could not be read)
+#
+def read_node(node_id):
+  known_type = node_types.get(node_id)
+  tried_types = [known_type] if known_type else sorted(register_maps, key=lambda t: -get_map_length(register_maps[t]))
+  
+  for node_type in tried_types:
+    try:
+      registers = read_block(node_id * 100, get_map_length(register_maps[node_type]))
+    except minimalmodbus.IllegalRequestError:
+      continue
     
-  except Exception as e:
-    print(e)
+    # Header must agree, otherwise node has changed its type
+    header = decode_registers(register_maps[node_type], registers)["header"]
+    if (header_types.get(header & 0x07) == node_type):
+      node_types[node_id] = node_type
+      return (node_type, registers)
+  
+  # Node has changed its type or disappeared, find it again on the next read
+  node_types.pop(node_id, None)
+  return (None, None)
+
+# Function to form database rows from the values of a node.
+#
+# Battery batch has one row for every sample, the newest when the message was received.
+#
+# node_type: type of the node
+# values:    decoded values of the node
+# now:       time of the poll
+#
+# returns:   list of (time, values) tuples
+#
+def get_rows(node_type, values, now):
+  columns = saved_values[node_type]
+  received = (now - timedelta(minutes=values["last_received"])).replace(second=0, microsecond=0)
+  
+  if (node_type != "batch"):
+    return [(received, [values[column] for column in columns])]
+  
+  rows = []
+  for i in range(values["samples"]):
+    sample_time = received - timedelta(seconds=values["sample_interval"] * (values["samples"] - 1 - i))
+    rows.append((sample_time.replace(second=0, microsecond=0), [values[column + str(i + 1)] for column in columns]))
+  return rows
+
+# Function to save values of all nodes read in one poll to database in one transaction.
+#
+# Rows of a node are written with one statement, so every table is only written once per poll.
+#
+# node_rows: dictionary of (node type, rows) by node id
+#
+# returns:   no
+#
+def save_to_db(node_rows):
+  global cnx
+  
+  # Keep the connection open between polls, reconnecting only if it has been lost
+  if (cnx is None):
+    cnx = mysql.connector.connect(user=db_user, password=db_password, host=db_host, database=db_database)
+  else:
+    cnx.ping(reconnect=True, attempts=3, delay=1)
+  
+  cursor = cnx.cursor()
+  try:
+    for node_id, (node_type, rows) in node_rows.items():
+      columns = saved_values[node_type]
+      statement = ("INSERT INTO " + table_prefix + str(node_id) + " (time, " + ", ".join(columns) + ") VALUES (%s" + ", %s" * len(columns) +
+                   ") ON DUPLICATE KEY UPDATE " + ", ".join(column + "=VALUES(" + column + ")" for column in columns))
+      cursor.executemany(statement, [[row_time] + row_values for row_time, row_values in rows])
+    cnx.commit()
+  except Exception:
+    cnx.rollback()
+    raise
   finally:
     cursor.close()
-    cnx.close()
 
 gateway = minimalmodbus.Instrument(serial_device, modbus_address)
 gateway.serial.baudrate = 38400
 
-# Read node 1 modbus data
-try:
-  mb_data = gateway.read_registers(100, 8)
-  
-  # If we had correct amount of data, save it to database
-  if len(mb_data) == 8:
-    save_to_db("node_1", "temperature", to_signed(mb_data[5]))
-    save_to_db("node_1", "humidity", to_signed(mb_data[6]))
-    save_to_db("node_1", "pressure", to_signed(mb_data[7]))
-except Exception:
-  print("Error saving node 1 data to database")
+cnx = None
+node_types = {} # Known node types by node id
+counters = None
+max_registers = None # Registers that fit one response
 
+while True:
+  poll_started = time.monotonic()
+  
+  try:
+    # Gateway with external SRAM accepts frames up to 256 bytes, otherwise only 50 bytes
+    if (max_registers is None):
+      max_registers = 125 if (gateway.read_register(13) & 0x01) else 22
+    
+    changed, new_counters = get_changed_nodes(counters)
+    now = datetime.now()
+    
+    node_rows = {}
+    for node_id in changed:
+      node_type, registers = read_node(node_id)
+      if (node_type is not None):
+        node_rows[node_id] = (node_type, get_rows(node_type, decode_registers(register_maps[node_type], registers), now))
+    
+    if (len(node_rows) > 0):
+      save_to_db(node_rows)
+    
+    # Counters are taken into use only when their nodes have been saved, so a failed poll is read again
+    counters = new_counters
+  except Exception as e:
+    print(e)
+  
+  time.sleep(max(poll_interval - (time.monotonic() - poll_started), 0))
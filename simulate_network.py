@@ -0,0 +1,328 @@
+#!/usr/bin/env python3
+
+# MIT License
+#
+# Copyright (c) 2026 aattww (https://github.com/aattww/)
+#
+# Permission is hereby granted, free of charge, to any person obtaining a copy
+# of this software and associated documentation files (the "Software"), to deal
+# in the Software without restriction, including without limitation the rights
+# to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+# copies of the Software, and to permit persons to whom the Software is
+# furnished to do so, subject to the following conditions:
+#
+# The above copyright notice and this permission notice shall be included in all
+# copies or substantial portions of the Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+# IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+# AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+# LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+# OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+# SOFTWARE.
+
+
+# Simple Python script to roughly estimate the limits of a Sensors network before deploying it.
+#
+# This is a simplified model, not a simulation of the sketches: no gateway or node code is run and
+# the results are only as good as the assumptions below. Use it to compare settings and to see
+# where a network starts to saturate, not to predict exact loss or latency figures.
+#
+# Models a population of battery, pulse and Kamstrup nodes transmitting to one gateway, together
+# with a Modbus master polling the gateway. Reports lost messages, gateway receive queue depth,
+# Modbus response latency and nodes that do not fit the internal SRAM pool.
+#
+# Assumptions:
+# - All nodes use the same data rate and channel and hear each other. Any overlap on air destroys
+#   every overlapping transmission, there is no capture effect, range or fading.
+# - Time on air uses the same formula as getTimeOnAir() in nodes.
+# - Gateway processing and response times are constants. Measure them from a gateway compiled with
+#   ENABLE_TIMING (registers 21032 and 21080) and set them below.
+# - Changed nodes block is read with the largest read the gateway allows, one poll at a time.
+#
+# No external libraries are needed.
+#
+# Use with "simulate_network.py [seed]". The same seed gives the same results.
+
+
+##################
+# BEGIN SETTINGS #
+##################
+
+# Node population: number of nodes and send interval in seconds by node type
+nodes = {
+  "battery": (30, 600),
+  "pulse": (5, 600),
+  "kamstrup": (2, 600),
+}
+retries = 1 # Retransmits after a missing ack, same as RETRIES in nodes
+
+# Radio settings (default data rate is SF7, 125 kHz, CR 4/5)
+spreading_factor = 7
+bandwidth = 125000 # Hz
+coding_rate = 1 # 1-4 for 4/5-4/8
+preamble = 8 # Symbols
+encryption_block = 8 # Payload is padded to encryption blocks, set to 0 without encryption
+ack_margin = 0.1 # Seconds added to ack time on air in ack timeout, same as ACK_MARGIN in nodes
+
+# Gateway settings
+external_sram = False
+rx_queue_length = 4 # Same as RX_QUEUE_LENGTH
+pool_chunks = 10 # Same as POOL_CHUNKS (only without external SRAM)
+pool_chunk_data_size = 13 # Same as POOL_CHUNK_DATA_SIZE
+process_time = 0.003 # Seconds to process one received message (ENABLE_TIMING metric 2)
+ack_delay = 0.002 # Seconds from received message to ack on air (ENABLE_TIMING metric 6)
+response_time = 0.002 # Seconds to build a Modbus response (ENABLE_TIMING metric 5 minus transfer)
+
+# Modbus master settings
+poll_interval = 10 # Seconds between polls
+poll_mode = "changed" # "changed" reads changed nodes block, "nodes" reads registers of every node
+baudrate = 38400
+
+# Simulation settings
+simulated_time = 86400 # Seconds
+clock_drift = 0.01 # Relative spread of node send intervals
+
+################
+# END SETTINGS #
+################
+
+import heapq
+import math
+import random
+import sys
+
+# Payload lengths and registers by node type, same as in gateway
+payload_lengths = {"battery": 11, "pulse": 21, "kamstrup": 45}
+node_registers = {"battery": 8, "pulse": 13, "kamstrup": 25}
+HEADER_LENGTH = 4 # RadioHead header
+ACK_LENGTH = 5 # Extended ack
+
+# Function to calculate LoRa time on air, same as getTimeOnAir() in nodes.
+#
+# length:  payload length in bytes
+#
+# returns: time on air in seconds
+#
+def time_on_air(length):
+  length = length + HEADER_LENGTH
+  if (encryption_block > 0):
+    length = HEADER_LENGTH + math.ceil((length - HEADER_LENGTH) / encryption_block) * encryption_block
+
+  symbol_time = (2 ** spreading_factor) / bandwidth
+  low_data_rate = (symbol_time > 0.016)
+  bits = 8 * length - 4 * spreading_factor + 28 + 16
+  bits_per_symbol = 4 * (spreading_factor - (2 if low_data_rate else 0))
+  payload_symbols = 8 + max(math.ceil(bits / bits_per_symbol), 0) * (coding_rate + 4)
+
+  return (preamble + 4.25 + payload_symbols) * symbol_time
+
+# Function to calculate how long a Modbus frame takes on the bus.
+#
+# length:  frame length in bytes
+#
+# returns: time in seconds
+#
+def frame_time(length):
+  return length * 10 / baudrate
+
+# Function to calculate a percentile of sorted values.
+#
+# values:  sorted values
+# percent: percentile to calculate
+#
+# returns: value at the percentile (0 if there are no values)
+#
+def percentile(values, percent):
+  if (len(values) == 0):
+    return 0
+  return values[min(int(len(values) * percent / 100), len(values) - 1)]
+
+if (len(sys.argv) > 1):
+  random.seed(int(sys.argv[1]))
+
+ack_air = time_on_air(ACK_LENGTH)
+ack_timeout = ack_margin + ack_air
+
+# Create nodes with their own send intervals and start times
+node_list = []
+for node_type, (count, interval) in nodes.items():
+  for i in range(count):
+    node_interval = interval * random.uniform(1 - clock_drift, 1 + clock_drift)
+    node_list.append({"type": node_type, "interval": node_interval, "air": time_on_air(payload_lengths[node_type]),
+                      "sends": 0, "acked": False, "received": False})
+
+events = [] # (time, order, event, node index)
+order = 0
+for i in range(len(node_list)):
+  heapq.heappush(events, (random.uniform(0, node_list[i]["interval"]), order, "message", i))
+  order += 1
+for poll in range(int(simulated_time / poll_interval)):
+  heapq.heappush(events, ((poll + 1) * poll_interval, order, "poll", -1))
+  order += 1
+
+on_air = {} # Transmissions on air by id: [end, corrupted, node index, is ack]
+transmission_id = 0
+queue_finish = [] # Times when queued messages have been processed
+used_chunks = 0
+stored_nodes = set()
+changed_nodes = set()
+
+stats = {"messages": 0, "transmits": 0, "collisions": 0, "acks_lost": 0, "queue_full": 0, "lost": 0,
+         "duplicates": 0, "out_of_memory": 0, "unfit_records": 0}
+queue_depths = []
+latencies = []
+
+while (len(events) > 0):
+  now, _, event, index = heapq.heappop(events)
+  if (now > simulated_time):
+    break
+
+  # Queued messages processed by now, in the order they were queued
+  while ((len(queue_finish) > 0) and (queue_finish[0] <= now)):
+    queue_finish.pop(0)
+
+  if (event == "message"):
+    # New message from a node, next one after its interval
+    node = node_list[index]
+    node["sends"] = 0
+    node["acked"] = False
+    node["received"] = False
+    stats["messages"] += 1
+    heapq.heappush(events, (now + node["interval"], order, "message", index))
+    order += 1
+    event = "transmit"
+
+  if (event == "transmit"):
+    # Node transmits, any overlapping transmission (including an ack) corrupts all of them
+    node = node_list[index]
+    node["sends"] += 1
+    stats["transmits"] += 1
+    corrupted = False
+    for other in on_air.values():
+      other[1] = True
+      corrupted = True
+    on_air[transmission_id] = [now + node["air"], corrupted, index, False]
+    heapq.heappush(events, (now + node["air"], order, "air_end", transmission_id))
+    heapq.heappush(events, (now + node["air"] + ack_delay + ack_timeout, order, "ack_timeout", index))
+    order += 1
+    transmission_id += 1
+
+  elif (event == "air_end"):
+    end, corrupted, node_index, is_ack = on_air.pop(index)
+    node = node_list[node_index]
+
+    if (corrupted):
+      stats["acks_lost" if is_ack else "collisions"] += 1
+    elif (is_ack):
+      node["acked"] = True
+    # If the queue is full, gateway does not ack and node retransmits
+    elif (len(queue_finish) >= rx_queue_length):
+      stats["queue_full"] += 1
+    else:
+      # Message received, a retransmit of a message whose ack was lost is a duplicate
+      if (node["received"]):
+        stats["duplicates"] += 1
+      node["received"] = True
+
+      start = max(now, queue_finish[-1]) if (len(queue_finish) > 0) else now
+      queue_finish.append(start + process_time)
+      queue_depths.append(len(queue_finish))
+
+      # Find room for the node when it is seen for the first time
+      if (node_index not in stored_nodes):
+        chunks = math.ceil((payload_lengths[node["type"]] + 2) / pool_chunk_data_size)
+        if (external_sram or ((used_chunks + chunks) <= pool_chunks)):
+          stored_nodes.add(node_index)
+          used_chunks += chunks
+      if (node_index in stored_nodes):
+        changed_nodes.add(node_index)
+      else:
+        stats["out_of_memory"] += 1
+
+      # Ack is sent after a short delay
+      heapq.heappush(events, (now + ack_delay, order, "ack", node_index))
+      order += 1
+
+  elif (event == "ack"):
+    corrupted = False
+    for other in on_air.values():
+      other[1] = True
+      corrupted = True
+    on_air[transmission_id] = [now + ack_air, corrupted, index, True]
+    heapq.heappush(events, (now + ack_air, order, "air_end", transmission_id))
+    order += 1
+    transmission_id += 1
+
+  elif (event == "ack_timeout"):
+    node = node_list[index]
+    if (not node["acked"]):
+      if (node["sends"] <= retries):
+        heapq.heappush(events, (now, order, "transmit", index))
+        order += 1
+      # Message is lost if gateway did not receive any of the transmits
+      elif (not node["received"]):
+        stats["lost"] += 1
+
+  elif (event == "poll"):
+    # Gateway handles Modbus between received messages, so a request may wait for one to be processed
+    reads = []
+    if (poll_mode == "changed"):
+      block = 125 if external_sram else 29
+      pending = [node_index for node_index in changed_nodes]
+      while (len(pending) > 0):
+        used = 2
+        remaining = []
+        for node_index in pending:
+          registers = node_registers[node_list[node_index]["type"]] + 1
+          if (registers > (block - 2)):
+            stats["unfit_records"] += 1
+          elif ((used + registers) <= block):
+            used += registers
+          else:
+            remaining.append(node_index)
+        reads.append(block)
+        pending = remaining
+      if (len(reads) == 0):
+        reads.append(block)
+      changed_nodes = set()
+    else:
+      reads = [node_registers[node_list[node_index]["type"]] for node_index in sorted(stored_nodes)]
+
+    time = now
+    for registers in reads:
+      time += frame_time(8)
+      busy = [finish for finish in queue_finish if finish > time]
+      wait = (min(busy) - time) if (len(busy) > 0) else 0
+      latency = wait + response_time + frame_time(5 + registers * 2)
+      latencies.append(latency)
+      time += latency
+
+latencies.sort()
+queue_depths.sort()
+utilization = sum(node["air"] / node["interval"] for node in node_list)
+
+print("Estimate for %i hours with %i nodes (simplified model, see the assumptions in the script)" %(simulated_time / 3600, len(node_list)))
+print()
+print("Radio:")
+print("  Channel utilization: %.2f %%" %(utilization * 100))
+print("  Messages: %i, transmits: %i" %(stats["messages"], stats["transmits"]))
+print("  Lost messages: %i (%.2f %%)" %(stats["lost"], 100 * stats["lost"] / max(stats["messages"], 1)))
+print("  Collisions: %i, lost acks: %i, duplicates: %i" %(stats["collisions"], stats["acks_lost"], stats["duplicates"]))
+print("  Dropped due to full receive queue: %i" %(stats["queue_full"]))
+print("  Receive queue depth: median %i, max %i" %(percentile(queue_depths, 50), percentile(queue_depths, 100)))
+print()
+print("Memory:")
+if (external_sram):
+  print("  External SRAM, all %i nodes fit" %(len(node_list)))
+else:
+  print("  Pool chunks used: %i / %i" %(used_chunks, pool_chunks))
+  print("  Nodes not fitting: %i, messages not saved: %i" %(len(node_list) - len(stored_nodes), stats["out_of_memory"]))
+print()
+print("Modbus:")
+print("  Reads: %i" %(len(latencies)))
+print("  Response latency: p50 %.1f ms, p95 %.1f ms, p99 %.1f ms, max %.1f ms" %(percentile(latencies, 50) * 1000,
+      percentile(latencies, 95) * 1000, percentile(latencies, 99) * 1000, percentile(latencies, 100) * 1000))
+if (stats["unfit_records"] > 0):
+  print("  Node records too long for changed nodes block: %i" %(stats["unfit_records"]))
@@ -0,0 +1,215 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2026 aattww (https://github.com/aattww/)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * host_bench.cpp - SPI bus usage and lookup times of SensorsMemoryHandler
+ *
+ * Runs the memory accesses of the gateway against the emulated 23K256 with 10 battery nodes
+ * (IDs 10, 20, ..., 100) and prints SPI transactions, bytes, operating mode writes and the time
+ * to clock the bytes at 1 MHz. Time spent around the transfers (slave select, SPI setup) is not
+ * included, it adds to every transaction. Internal SRAM is timed on the host, which shows only how
+ * the lookups scale.
+ *
+ * With HOST_BENCH_BASELINE defined, only the API of the original SensorsMemoryHandler is used
+ * so that the same accesses can be measured against an earlier version (make bench-baseline).
+ */
+
+#include <stdio.h>
+#include <time.h>
+#include <SPI.h>
+#include "SensorsMemoryHandler.h"
+
+static SensorsMemoryHandler memory(10);
+static uint8_t buffer[100];
+static volatile uint32_t sink;
+
+static void printHeader() {
+  printf("%-48s %8s %8s %6s %9s\n", "23K256 access", "transact", "bytes", "modes", "bus us");
+}
+
+static void printCounters(const char* name) {
+  printf("%-48s %8u %8u %6u %9u\n", name, (unsigned)host23K256.transactions, (unsigned)host23K256.bytes,
+         (unsigned)host23K256.modeWrites, (unsigned)host23K256.busMicros());
+  host23K256.resetCounters();
+}
+
+#ifdef HOST_BENCH_BASELINE
+static void printNotAvailable(const char* name) {
+  printf("%-48s %8s\n", name, "-");
+}
+#endif
+
+static void saveNodes() {
+  for (uint8_t id = 10; id <= 100; id += 10) {
+    uint8_t record[13] = {1, 0, 0, 12, 34, 0, 5, 0, 215, 0, 45, 0, 0};
+    memory.saveNodeData(id, 13, record);
+  }
+}
+
+// Reads a battery record one register run at a time like the gateway did before records
+// were serialized from a buffer: last seen, voltage, power, interval, header and the sensor words
+static void readBatteryRuns(uint8_t nodeId) {
+  static const uint8_t runs[6][2] = {{1, 2}, {3, 2}, {5, 1}, {6, 1}, {0, 1}, {7, 6}};
+  for (uint8_t i = 0; i < 6; i++) {
+    memory.getNodeData(nodeId, runs[i][1], buffer, runs[i][0]);
+  }
+}
+
+#ifndef HOST_BENCH_BASELINE
+static void readSeen(uint8_t nodeId) {
+  memory.getNodeData(nodeId, 5, buffer, 0);
+}
+
+static void addRecord(uint8_t nodeId, uint8_t* data, uint8_t length) {
+  sink += nodeId + data[0] + length;
+}
+#endif
+
+static void bench23K256() {
+  host23K256.powerUp(true, 10);
+  memory.init();
+  host23K256.resetCounters();
+
+  printHeader();
+
+  saveNodes();
+  printCounters("save 10 records");
+
+  for (uint8_t id = 1; id <= 100; id++) {
+    sink += memory.getNodeHeader(id);
+  }
+  printCounters("header of IDs 1-100");
+
+  for (uint8_t id = 10; id <= 100; id += 10) {
+    memory.getNodeData(id, 13, buffer, 0);
+  }
+  printCounters("read 10 records");
+
+  // Register read of a node: type from the header, then the record
+  for (uint8_t id = 10; id <= 100; id += 10) {
+    sink += memory.getNodeHeader(id);
+    memory.getNodeData(id, 13, buffer, 0);
+  }
+  printCounters("header and record of 10 nodes");
+
+  for (uint8_t id = 1; id <= 100; id++) {
+    memory.getNodeData(id, 5, buffer, 0);
+  }
+  printCounters("sweep: 5 bytes of IDs 1-100");
+
+#ifndef HOST_BENCH_BASELINE
+  memory.forEachNode(readSeen);
+  printCounters("sweep: forEachNode(), 5 bytes of each node");
+#else
+  printNotAvailable("sweep: forEachNode(), 5 bytes of each node");
+#endif
+
+  for (uint8_t id = 10; id <= 100; id += 10) {
+    readBatteryRuns(id);
+  }
+  printCounters("changed nodes: 10 records by register runs");
+
+#ifndef HOST_BENCH_BASELINE
+  memory.getNodesData(1, 100, 13, buffer, addRecord);
+  printCounters("changed nodes: getNodesData() of IDs 1-100");
+
+  uint8_t record[13] = {1};
+  for (uint8_t i = 0; i < 10; i++) {
+    memory.appendNodeHistory(10, 13, record);
+  }
+  printCounters("history: append 10 records");
+
+  for (uint8_t i = 0; i < 10; i++) {
+    memory.getNodeHistory(10, i, 13, buffer);
+  }
+  printCounters("history: read 10 records");
+#else
+  printNotAvailable("changed nodes: getNodesData() of IDs 1-100");
+  printNotAvailable("history: append 10 records");
+  printNotAvailable("history: read 10 records");
+#endif
+
+  for (uint8_t id = 10; id <= 100; id += 10) {
+    memory.deleteNode(id);
+  }
+  printCounters("delete 10 nodes");
+
+  if (host23K256.errors > 0) {
+    printf("23K256 ignored %u bytes\n", (unsigned)host23K256.errors);
+  }
+}
+
+static double nanosecondsSince(const struct timespec& start, uint32_t calls) {
+  struct timespec end;
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  return ((end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec)) / calls;
+}
+
+static void benchSRAM() {
+  static SensorsMemoryHandler internalMemory(10);
+  const uint32_t rounds = 20000;
+  struct timespec start;
+
+  host23K256.powerUp(false, 10);
+  internalMemory.init();
+  for (uint8_t id = 10; id <= 100; id += 10) {
+    uint8_t record[13] = {1};
+    internalMemory.saveNodeData(id, 13, record);
+  }
+
+  printf("\n%-48s %8s\n", "Internal SRAM access (host)", "ns");
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (uint32_t round = 0; round < rounds; round++) {
+    for (uint8_t id = 1; id <= 100; id++) {
+      sink += internalMemory.getNodeHeader(id);
+    }
+  }
+  printf("%-48s %8.1f\n", "header of IDs 1-100, per ID", nanosecondsSince(start, rounds * 100));
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (uint32_t round = 0; round < rounds; round++) {
+    for (uint8_t id = 10; id <= 100; id += 10) {
+      sink += internalMemory.getNodeData(id, 13, buffer, 0);
+    }
+  }
+  printf("%-48s %8.1f\n", "read of a 13 byte record", nanosecondsSince(start, rounds * 10));
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (uint32_t round = 0; round < rounds; round++) {
+    internalMemory.deleteNode(50);
+    uint8_t record[13] = {1};
+    sink += internalMemory.saveNodeData(50, 13, record);
+  }
+  printf("%-48s %8.1f\n", "delete and save of a record", nanosecondsSince(start, rounds));
+}
+
+int main() {
+#ifdef HOST_BENCH_BASELINE
+  printf("Baseline SensorsMemoryHandler\n\n");
+#endif
+  bench23K256();
+  benchSRAM();
+  return 0;
+}
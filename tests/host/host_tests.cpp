@@ -0,0 +1,581 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2026 aattww (https://github.com/aattww/)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * host_tests.cpp - Host tests of the hardware independent parts of Sensors libraries
+ *
+ * Covers Modbus CRC and framing of SimpleModbusAsync, CompactPayload encoding, NTCSensor
+ * lookup table, Si7021 conversions, PulseJournal records in a fake EEPROM and SensorsMemoryHandler
+ * with an emulated 23K256 and with internal SRAM. Returns non-zero if a check fails.
+ */
+
+#include <stdio.h>
+#include <avr/eeprom.h>
+#include <SPI.h>
+#include "SimpleModbusAsync.h"
+#include "CompactPayload.h"
+#include "NTCSensor.h"
+#include "PulseJournal.h"
+#include "SI7021Conversion.h"
+#include "SensorsMemoryHandler.h"
+
+static int failures = 0;
+
+#define CHECK(condition) do { \
+    if (!(condition)) { \
+      printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+      failures++; \
+    } \
+  } while (0)
+
+// Bitwise Modbus CRC to check the table driven one against
+static uint16_t referenceCRC(const uint8_t* data, uint8_t length) {
+  uint16_t crc = 0xFFFF;
+  for (uint8_t i = 0; i < length; i++) {
+    crc ^= data[i];
+    for (uint8_t j = 0; j < 8; j++) {
+      crc = (crc & 1) ? ((crc >> 1) ^ 0xA001) : (crc >> 1);
+    }
+  }
+  return crc;
+}
+
+// Feeds a frame to Modbus and updates until it has been processed
+static uint8_t receiveFrame(SimpleModbusAsync& modbus, const uint8_t* frame, uint8_t length, uint16_t* start, uint16_t* count, uint8_t* function) {
+  uint8_t status;
+  Serial.hostReceive(frame, length);
+  for (uint16_t i = 0; i < 1000; i++) {
+    status = modbus.modbusUpdate(start, count, function);
+    hostMicros += 100;
+    if (status != FRAME_RECEIVING) {
+      break;
+    }
+  }
+  return status;
+}
+
+// Updates Modbus until the frame being sent has been sent
+static bool sendFrame(SimpleModbusAsync& modbus) {
+  for (uint16_t i = 0; i < 1000; i++) {
+    uint8_t status = modbus.modbusUpdate(NULL, NULL, NULL);
+    hostMicros += 100;
+    if (status == FRAME_SENT) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static void testModbus() {
+  static SimpleModbusAsync modbus;
+  modbus.setComms(&Serial, 9600, 255);
+  modbus.setAddress(1);
+
+  uint16_t start = 0;
+  uint16_t count = 0;
+  uint8_t function = 0;
+
+  // Read holding register 0 of slave 1, CRC from the Modbus specification
+  const uint8_t request[8] = {0x01, 0x03, 0x00, 0x00, 0x00, 0x01, 0x84, 0x0A};
+  CHECK(receiveFrame(modbus, request, 8, &start, &count, &function) == FRAME_RECEIVED);
+  CHECK((start == 0) && (count == 1) && (function == 3));
+
+  // Any changed bit must fail the CRC
+  for (uint8_t i = 0; i < 8; i++) {
+    for (uint8_t j = 0; j < 8; j++) {
+      uint8_t corrupted[8];
+      memcpy(corrupted, request, 8);
+      corrupted[i] ^= (1 << j);
+      uint8_t status = receiveFrame(modbus, corrupted, 8, &start, &count, &function);
+      CHECK(status != FRAME_RECEIVED);
+      // Frames to other slaves are ignored if their CRC happens to match
+      if (i > 0) {
+        CHECK(status == ERROR_CRC_FAILED);
+      }
+    }
+  }
+
+  // Write single register
+  uint8_t write[8] = {0x01, 0x06, 0x55, 0xF0, 0x04, 0xB0};
+  uint16_t crc = referenceCRC(write, 6);
+  write[6] = crc;
+  write[7] = crc >> 8;
+  CHECK(receiveFrame(modbus, write, 8, &start, &count, &function) == FRAME_RECEIVED);
+  CHECK((start == 22000) && (count == 1200) && (function == 6));
+
+  // Responses of every length carry a valid CRC, low byte first
+  uint8_t payload[40];
+  for (uint8_t i = 0; i < sizeof(payload); i++) {
+    payload[i] = (i * 37) + 11;
+  }
+  for (uint8_t length = 2; length <= sizeof(payload); length += 2) {
+    CHECK(receiveFrame(modbus, request, 8, &start, &count, &function) == FRAME_RECEIVED);
+    CHECK(modbus.sendNormalResponse(3, payload, length, 0));
+    CHECK(sendFrame(modbus));
+    CHECK(Serial.txLength == (length + 5));
+    CHECK((Serial.txBuffer[0] == 1) && (Serial.txBuffer[1] == 3) && (Serial.txBuffer[2] == length));
+    CHECK(memcmp(Serial.txBuffer + 3, payload, length) == 0);
+    crc = referenceCRC(Serial.txBuffer, length + 3);
+    CHECK((Serial.txBuffer[length + 3] == (uint8_t)crc) && (Serial.txBuffer[length + 4] == (uint8_t)(crc >> 8)));
+  }
+
+  // Error response
+  CHECK(receiveFrame(modbus, request, 8, &start, &count, &function) == FRAME_RECEIVED);
+  CHECK(modbus.sendErrorResponse(3, ERROR_ILLEGAL_ADDRESS));
+  CHECK(sendFrame(modbus));
+  CHECK((Serial.txLength == 5) && (Serial.txBuffer[1] == 0x83) && (Serial.txBuffer[2] == 0x02));
+  crc = referenceCRC(Serial.txBuffer, 3);
+  CHECK((Serial.txBuffer[3] == (uint8_t)crc) && (Serial.txBuffer[4] == (uint8_t)(crc >> 8)));
+
+  // End of transmit is read from USART0, so other ports get no buffer and send nothing
+  static HardwareSerial otherPort;
+  static SimpleModbusAsync other;
+  other.setComms(&otherPort, 9600, 255);
+  CHECK(other.getBufferSize() == 0);
+  CHECK(!other.sendNormalResponse(3, payload, 2, 0));
+  CHECK(!other.sendFrame(payload, 2));
+  CHECK(otherPort.txLength == 0);
+}
+
+static void testCompactPayload() {
+  // Pulse node message: header, two 1 byte fields and three 32 bit counters
+  const uint8_t fieldSizes[5] = {1, 1, 4, 4, 4};
+  CompactPayload compactPayload(fieldSizes, 5);
+  CHECK(compactPayload.getPayloadLength() == 15);
+
+  uint8_t reference[15] = {0x20, 90, 7, 0x00, 0x01, 0x00, 0x00, 0xFF, 0xFF, 0xFF, 0xFF, 0x12, 0x34, 0x56, 0x78};
+  uint8_t payload[15];
+  uint8_t compact[15];
+  uint8_t decoded[15];
+
+  // Unchanged message has only header, checksum and bitmap
+  CHECK(compactPayload.encode(reference, reference, compact) == 3);
+  CHECK(compact[0] == (0x20 | COMPACT_FLAG));
+  CHECK(compactPayload.decode(compact, 3, reference, decoded) == 15);
+  CHECK(memcmp(decoded, reference, 15) == 0);
+
+  // Small changes, a decreasing field and counters wrapping around
+  memcpy(payload, reference, 15);
+  payload[1] = 88;
+  payload[4] = 0x05;
+  memset(payload + 7, 0, 4);
+  payload[10] = 0x02;
+  uint8_t length = compactPayload.encode(payload, reference, compact);
+  CHECK((length > 0) && (length < 15));
+  CHECK(compactPayload.decode(compact, length, reference, decoded) == 15);
+  CHECK(memcmp(decoded, payload, 15) == 0);
+
+  // Truncated or extended message is malformed
+  CHECK(compactPayload.decode(compact, length - 1, reference, decoded) == 0);
+  compact[length] = 0;
+  CHECK(compactPayload.decode(compact, length + 1, reference, decoded) == 0);
+
+  // Other reference than the one encoded against is rejected
+  uint8_t otherReference[15];
+  memcpy(otherReference, reference, 15);
+  otherReference[14]++;
+  CHECK(compactPayload.decode(compact, length, otherReference, decoded) == 0);
+
+  // Large changes everywhere would not be shorter
+  for (uint8_t i = 1; i < 15; i++) {
+    payload[i] = reference[i] ^ 0x80;
+  }
+  CHECK(compactPayload.encode(payload, reference, compact) == 0);
+
+  // Round trip of pseudo random changes
+  uint32_t seed = 1;
+  for (uint16_t round = 0; round < 2000; round++) {
+    memcpy(payload, reference, 15);
+    for (uint8_t i = 1; i < 15; i++) {
+      seed = seed * 1103515245 + 12345;
+      if ((seed >> 16) % 4 == 0) {
+        payload[i] += (int8_t)(seed >> 24);
+      }
+    }
+    length = compactPayload.encode(payload, reference, compact);
+    if (length > 0) {
+      CHECK(compactPayload.decode(compact, length, reference, decoded) == 15);
+      CHECK(memcmp(decoded, payload, 15) == 0);
+    }
+  }
+}
+
+static void testNTCSensor(bool sleepSampling) {
+  NTCSensor sensorNTC(NTC_NO_ENABLE_PIN, 0, sleepSampling);
+
+  // No thermistor, pullup takes the pin high
+  hostAnalogValue = 1020;
+  CHECK(!sensorNTC.init());
+  CHECK(sensorNTC.readTemperature() == -990);
+
+  hostAnalogValue = 512;
+  CHECK(sensorNTC.init());
+
+  // Series resistor equals nominal resistance at nominal temperature
+  hostAnalogValue = 511;
+  uint16_t expected = 250;
+  CHECK(abs(sensorNTC.readTemperature() - expected) <= 1);
+
+  // Lookup table with interpolation follows the B parameter equation within 0.2 degrees from -30 to 120 degrees
+  for (uint16_t value = 64; value <= 980; value++) {
+    hostAnalogValue = value;
+    double resistance = SERIES_RESISTOR * value / (1023.0 - value);
+    double temperature = 10.0 * ((1.0 / ((1.0 / (NOMINAL_TEMPERATURE + 273.15)) + (log(resistance / NOMINAL_RESISTANCE) / BETA_COEFFICIENT))) - 273.15);
+    int16_t measured = sensorNTC.readTemperature();
+    if (fabs(measured - temperature) > 2.0) {
+      printf("NTC %u: %d, expected %.1f\n", value, measured, temperature);
+      failures++;
+    }
+  }
+
+  // Shorted and missing thermistor
+  hostAnalogValue = 2;
+  CHECK(sensorNTC.readTemperature() == -990);
+  hostAnalogValue = 1021;
+  CHECK(sensorNTC.readTemperature() == -990);
+}
+
+static void testSI7021Conversion() {
+  // Humidity half way through the code range, 125 * 0.5 - 6 = 56.5 %
+  CHECK(si7021Humidity(0x8000) == 565);
+  // Status bits do not change the value
+  CHECK(si7021Humidity(0x8003) == 565);
+  // 125 * 31872 / 65536 - 6 = 54.8 %
+  CHECK(si7021Humidity(0x7C80) == 548);
+  // Codes beyond the physical range are limited
+  CHECK(si7021Humidity(0x0000) == 0);
+  CHECK(si7021Humidity(0xFFFC) == 1000);
+
+  // Temperature 175.72 * 0.5 - 46.85 = 41.01 degrees
+  CHECK(si7021Temperature(0x8000) == 410);
+  CHECK(si7021Temperature(0x6000) == 190);
+  // Lowest code is -46.85 degrees
+  CHECK(si7021Temperature(0x0000) == -469);
+  CHECK(si7021Temperature(0x0003) == -469);
+}
+
+static void testPulseJournal() {
+  // Journal of 48 records like in the sketches, EEPROM erased
+  memset(hostEEPROM, 0xFF, sizeof(hostEEPROM));
+  memset(hostEEPROMWrites, 0, sizeof(hostEEPROMWrites));
+
+  uint32_t counters[3] = {1, 2, 3};
+  PulseJournal journal(40, 720);
+  CHECK(!journal.read(counters));
+  CHECK((counters[0] == 1) && (counters[1] == 2) && (counters[2] == 3));
+
+  // Saved record is found after a restart
+  counters[0] = 100;
+  counters[1] = 200;
+  counters[2] = 0xFFFFFFFF;
+  CHECK(journal.save(counters));
+  CHECK(!journal.save(counters));
+  journal.flush();
+  uint32_t restored[3] = {0, 0, 0};
+  PulseJournal restarted(40, 720);
+  CHECK(restarted.read(restored));
+  CHECK(memcmp(restored, counters, sizeof(counters)) == 0);
+
+  // Records are written in the background, one byte at a time
+  counters[0]++;
+  CHECK(restarted.save(counters));
+  uint16_t updates = 0;
+  while (restarted.update()) {
+    updates++;
+  }
+  CHECK(updates > 1);
+
+  // Latest record wins after wrapping around the ring and the sequence numbers many times
+  for (uint16_t i = 0; i < 1000; i++) {
+    counters[0] = i;
+    counters[1] = i * 3;
+    CHECK(restarted.save(counters));
+    restarted.flush();
+  }
+  PulseJournal wrapped(40, 720);
+  CHECK(wrapped.read(restored));
+  CHECK((restored[0] == 999) && (restored[1] == 2997));
+
+  // Journal stays within its area and every record slot wears evenly
+  for (uint16_t i = 0; i < HOST_EEPROM_SIZE; i++) {
+    if ((i < 40) || (i >= 760)) {
+      CHECK(hostEEPROMWrites[i] == 0);
+    }
+  }
+  for (uint8_t slot = 1; slot < 48; slot++) {
+    CHECK(abs((int)hostEEPROMWrites[40 + slot * PJ_RECORD_LENGTH] - (int)hostEEPROMWrites[40]) <= 1);
+  }
+
+  // Power cut before the sequence byte keeps the previous record
+  counters[0] = 5000;
+  CHECK(wrapped.save(counters));
+  for (uint8_t i = 0; i < 6; i++) {
+    wrapped.update();
+  }
+  PulseJournal interrupted(40, 720);
+  CHECK(interrupted.read(restored));
+  CHECK(restored[0] == 999);
+
+  // Corrupted latest record falls back to the one before it
+  CHECK(interrupted.save(counters));
+  interrupted.flush();
+  PulseJournal corrupted(40, 720);
+  CHECK(corrupted.read(restored));
+  CHECK(restored[0] == 5000);
+  for (uint8_t slot = 0; slot < 48; slot++) {
+    uint16_t address = 40 + slot * PJ_RECORD_LENGTH;
+    if ((hostEEPROM[address + 1] == (5000 & 0xFF)) && (hostEEPROM[address + 2] == (5000 >> 8))) {
+      hostEEPROM[address + 5] ^= 0x01;
+    }
+  }
+  PulseJournal fallback(40, 720);
+  CHECK(fallback.read(restored));
+  CHECK(restored[0] == 999);
+}
+
+// Handlers are static like in the sketches, the 23K256 handler expects zeroed members
+static SensorsMemoryHandler externalMemory(10);
+static SensorsMemoryHandler internalMemory(10);
+static SensorsMemoryHandler* visitedMemory;
+static uint8_t visitedIds[SMH_MAX_NODE_ID + 1];
+static uint8_t visitedCount;
+
+static void visitNode(uint8_t nodeId) {
+  visitedIds[visitedCount++] = nodeId;
+}
+
+// Deletes every node it visits
+static void visitAndDeleteNode(uint8_t nodeId) {
+  visitedIds[visitedCount++] = nodeId;
+  visitedMemory->deleteNode(nodeId);
+}
+
+static void visitNodeData(uint8_t nodeId, uint8_t* data, uint8_t length) {
+  CHECK((length == 13) && (data[0] == 1) && (data[1] == nodeId));
+  visitedIds[visitedCount++] = nodeId;
+}
+
+// 13 byte battery record marked with the node ID
+static void makeRecord(uint8_t* record, uint8_t nodeId) {
+  for (uint8_t i = 0; i < 13; i++) {
+    record[i] = nodeId + i * 7;
+  }
+  record[0] = 1;
+  record[1] = nodeId;
+}
+
+static void testMemoryHandler23K256() {
+  host23K256.powerUp(true, 10);
+  CHECK(externalMemory.init());
+  CHECK(externalMemory.hasExternalSRAM());
+  CHECK(host23K256.errors == 0);
+  for (uint16_t i = 0; i < sizeof(host23K256.memory); i++) {
+    if (host23K256.memory[i] != 0) {
+      CHECK(host23K256.memory[i] == 0);
+      break;
+    }
+  }
+
+  uint8_t record[13];
+  uint8_t buffer[100];
+
+  // Saved record is at ID * 100 and headers come from the cache
+  makeRecord(record, 5);
+  host23K256.resetCounters();
+  CHECK(externalMemory.saveNodeData(5, 13, record) == 13);
+  CHECK(host23K256.transactions == 1);
+  CHECK(memcmp(&host23K256.memory[500], record, 13) == 0);
+  host23K256.resetCounters();
+  CHECK(externalMemory.getNodeHeader(5) == 1);
+  CHECK(externalMemory.getNodeHeader(6) == 0);
+  CHECK(host23K256.transactions == 0);
+
+  // Every read is one transaction, missing IDs none
+  CHECK(externalMemory.getNodeData(5, 13, buffer, 0) == 13);
+  CHECK(memcmp(buffer, record, 13) == 0);
+  CHECK(host23K256.transactions == 1);
+  CHECK(externalMemory.getNodeData(6, 13, buffer, 0) == 0);
+  CHECK(host23K256.transactions == 1);
+  CHECK(externalMemory.getNodeData(5, 2, buffer, 1) == 2);
+  CHECK((buffer[0] == record[1]) && (buffer[1] == record[2]));
+  CHECK(externalMemory.getNodeData(5, 100, buffer, 10) == 90);
+  CHECK(host23K256.transactions == 3);
+
+  // Sweeps touch only nodes in memory
+  for (uint8_t id = 10; id <= 100; id += 45) {
+    makeRecord(record, id);
+    externalMemory.saveNodeData(id, 13, record);
+  }
+  host23K256.resetCounters();
+  visitedCount = 0;
+  externalMemory.forEachNode(visitNode);
+  CHECK((visitedCount == 4) && (visitedIds[0] == 5) && (visitedIds[1] == 10) && (visitedIds[2] == 55) && (visitedIds[3] == 100));
+  CHECK(host23K256.transactions == 0);
+  visitedCount = 0;
+  CHECK(externalMemory.getNodesData(1, 100, 13, buffer, visitNodeData) == 4);
+  CHECK(visitedCount == 4);
+  CHECK(host23K256.transactions == 4);
+  uint8_t selected[13] = {0};
+  bitSet(selected[55 / 8], 55 % 8);
+  bitSet(selected[56 / 8], 56 % 8);
+  visitedCount = 0;
+  CHECK(externalMemory.getNodesData(1, 100, 13, buffer, visitNodeData, selected) == 1);
+  CHECK((visitedCount == 1) && (visitedIds[0] == 55));
+  CHECK(host23K256.transactions == 5);
+
+  // History keeps the newest records that fit the 221 bytes of the slot
+  for (uint8_t i = 1; i <= 20; i++) {
+    makeRecord(record, 5);
+    record[12] = i;
+    CHECK(externalMemory.appendNodeHistory(5, 13, record));
+  }
+  uint16_t sequence;
+  CHECK(externalMemory.getNodeHistoryInfo(5, &sequence) == 17);
+  CHECK(sequence == 20);
+  CHECK(externalMemory.getNodeHistory(5, 0, 13, buffer) == 13);
+  CHECK(buffer[12] == 20);
+  CHECK(externalMemory.getNodeHistory(5, 16, 13, buffer) == 13);
+  CHECK(buffer[12] == 4);
+  CHECK(externalMemory.getNodeHistory(5, 17, 13, buffer) == 0);
+  CHECK(externalMemory.getNodeHistoryInfo(10, NULL) == 0);
+  // History of one node stays in its own slot
+  for (uint16_t i = 10100 + 226; i < 10100 + 2 * 226; i++) {
+    CHECK(host23K256.memory[i] == 0);
+  }
+
+  // Changed record length starts the history from scratch
+  CHECK(externalMemory.appendNodeHistory(5, 23, buffer));
+  CHECK(externalMemory.getNodeHistoryInfo(5, &sequence) == 1);
+  CHECK(sequence == 21);
+
+  // Deleted node is gone from the cache, the chip and the history
+  host23K256.resetCounters();
+  externalMemory.deleteNode(5);
+  CHECK(host23K256.memory[500] == 0);
+  CHECK(externalMemory.getNodeHeader(5) == 0);
+  CHECK(externalMemory.getNodeData(5, 13, buffer, 0) == 0);
+  CHECK(externalMemory.getNodeHistoryInfo(5, &sequence) == 0);
+  CHECK(sequence == 0);
+  CHECK(host23K256.transactions == 3);
+
+  // Nodes can be deleted while iterating
+  visitedMemory = &externalMemory;
+  visitedCount = 0;
+  externalMemory.forEachNode(visitAndDeleteNode);
+  CHECK(visitedCount == 3);
+  visitedCount = 0;
+  externalMemory.forEachNode(visitNode);
+  CHECK(visitedCount == 0);
+
+  // Only sequential mode is used after init and the chip never ignored a byte
+  CHECK(host23K256.modeWrites == 0);
+  CHECK(host23K256.errors == 0);
+}
+
+static void testMemoryHandlerSRAM() {
+  host23K256.powerUp(false, 10);
+  CHECK(internalMemory.init());
+  CHECK(!internalMemory.hasExternalSRAM());
+
+  uint8_t record[47];
+  uint8_t buffer[100];
+
+  // Pool of 10 chunks of 13 bytes holds 10 battery records
+  for (uint8_t id = 10; id <= 100; id += 10) {
+    makeRecord(record, id);
+    CHECK(internalMemory.saveNodeData(id, 13, record) == 13);
+  }
+  makeRecord(record, 1);
+  CHECK(internalMemory.saveNodeData(1, 13, record) == 0);
+  CHECK(internalMemory.getNodeHeader(1) == 0);
+  CHECK(internalMemory.getNodeHeader(30) == 1);
+  CHECK(internalMemory.getNodeData(30, 13, buffer, 0) == 13);
+  makeRecord(record, 30);
+  CHECK(memcmp(buffer, record, 13) == 0);
+  CHECK(internalMemory.getNodeData(31, 13, buffer, 0) == 0);
+
+  visitedCount = 0;
+  internalMemory.forEachNode(visitNode);
+  CHECK((visitedCount == 10) && (visitedIds[0] == 10) && (visitedIds[9] == 100));
+  visitedCount = 0;
+  CHECK(internalMemory.getNodesData(1, 100, 13, buffer, visitNodeData) == 10);
+
+  // Freed chunks are reused by a record spanning four chunks, read back across chunk borders
+  for (uint8_t id = 10; id <= 40; id += 10) {
+    internalMemory.deleteNode(id);
+  }
+  for (uint8_t i = 0; i < 47; i++) {
+    record[i] = 200 - i;
+  }
+  CHECK(internalMemory.saveNodeData(7, 47, record) == 47);
+  CHECK(internalMemory.getNodeData(7, 47, buffer, 0) == 47);
+  CHECK(memcmp(buffer, record, 47) == 0);
+  CHECK(internalMemory.getNodeData(7, 20, buffer, 20) == 20);
+  CHECK(memcmp(buffer, record + 20, 20) == 0);
+  // Reads stop at the end of the last chunk
+  CHECK(internalMemory.getNodeData(7, 100, buffer, 40) == 12);
+  CHECK(memcmp(buffer, record + 40, 7) == 0);
+  CHECK(internalMemory.getNodeHeader(7) == 200);
+
+  // Saving again replaces the old chunks instead of leaking them
+  for (uint8_t i = 0; i < 10; i++) {
+    CHECK(internalMemory.saveNodeData(7, 47, record) == 47);
+  }
+  internalMemory.deleteNode(7);
+  for (uint8_t id = 1; id <= 4; id++) {
+    makeRecord(record, id);
+    CHECK(internalMemory.saveNodeData(id, 13, record) == 13);
+  }
+
+  // Nodes can be deleted while iterating
+  visitedMemory = &internalMemory;
+  visitedCount = 0;
+  internalMemory.forEachNode(visitAndDeleteNode);
+  CHECK(visitedCount == 10);
+  visitedCount = 0;
+  internalMemory.forEachNode(visitNode);
+  CHECK(visitedCount == 0);
+
+  // No history without external SRAM
+  CHECK(!internalMemory.appendNodeHistory(1, 13, record));
+  CHECK(internalMemory.getNodeHistoryInfo(1, NULL) == 0);
+}
+
+int main() {
+  testModbus();
+  testCompactPayload();
+  testNTCSensor(false);
+  testNTCSensor(true);
+  testSI7021Conversion();
+  testPulseJournal();
+  testMemoryHandler23K256();
+  testMemoryHandlerSRAM();
+
+  if (failures > 0) {
+    printf("%d checks failed\n", failures);
+    return 1;
+  }
+  printf("All checks passed\n");
+  return 0;
+}
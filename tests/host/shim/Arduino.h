@@ -0,0 +1,132 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2026 aattww (https://github.com/aattww/)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * Arduino.h - Host replacement of the Arduino core for testing Sensors libraries
+ *
+ * Provides only what CompactPayload, NTCSensor, PulseJournal, SensorsMemoryHandler, SI7021Conversion and
+ * SimpleModbusAsync use. Time, analog input and serial port are fakes controlled by the tests (see the host* names).
+ */
+
+#ifndef HOST_ARDUINO_H
+#define HOST_ARDUINO_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+typedef uint8_t byte;
+
+#define HIGH         1
+#define LOW          0
+#define INPUT        0
+#define OUTPUT       1
+#define INPUT_PULLUP 2
+#define DEFAULT      1
+#define SERIAL_8N1   0x06
+
+// Binary constants used by the libraries
+#define B00000001 0x01
+#define B00000010 0x02
+#define B00000011 0x03
+#define B00000101 0x05
+#define B00001000 0x08
+#define B01000001 0x41
+#define B10000001 0x81
+#define B10101010 0xAA
+
+#define PROGMEM
+#define pgm_read_byte(address) (*(const uint8_t*)(address))
+#define pgm_read_word(address) (*(const uint16_t*)(address))
+
+#define _BV(bit)                (1 << (bit))
+#define bit_is_set(sfr, bit)    ((sfr) & _BV(bit))
+#define bit_is_clear(sfr, bit)  (!((sfr) & _BV(bit)))
+#define bitRead(value, bit)     (((value) >> (bit)) & 0x01)
+#define bitSet(value, bit)      ((value) |= (1UL << (bit)))
+#define bitClear(value, bit)    ((value) &= ~(1UL << (bit)))
+#define constrain(value, low, high) ((value) < (low) ? (low) : ((value) > (high) ? (high) : (value)))
+
+#define ISR(vector) void vector(void)
+#define cli()
+#define sei()
+
+// Registers
+#define UDRIE0 5
+#define TXC0   6
+#define ADSC   6
+#define ADIE   3
+
+// ADC control register, a started conversion completes immediately
+struct HostADCSRA {
+  uint8_t value;
+  HostADCSRA& operator|=(uint8_t bits) { value |= bits & ~_BV(ADSC); return *this; }
+  HostADCSRA& operator&=(uint8_t bits) { value &= bits; return *this; }
+  operator uint8_t() const { return value; }
+};
+
+extern uint8_t UCSR0A;
+extern uint8_t UCSR0B;
+extern HostADCSRA ADCSRA;
+
+// ADC result is the value set by the test
+extern uint16_t hostAnalogValue;
+#define ADC hostAnalogValue
+
+// Time in microseconds, advanced only by the test and delay()
+extern uint32_t hostMicros;
+
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t value);
+int analogRead(uint8_t pin);
+void analogReference(uint8_t mode);
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+
+// Serial port that receives from and transmits to buffers of the test
+class HardwareSerial {
+  public:
+    uint8_t rxBuffer[256]; // Bytes to be read
+    uint16_t rxLength;
+    uint16_t rxPosition;
+    uint8_t txBuffer[256]; // Bytes written
+    uint16_t txLength;
+
+    void begin(unsigned long baud, uint8_t config);
+    int available();
+    int read();
+    int availableForWrite();
+    size_t write(const uint8_t* buffer, size_t size);
+    size_t write(uint8_t data);
+    void flush();
+
+    // Clears both buffers and queues bytes to be received
+    void hostReceive(const uint8_t* buffer, uint16_t length);
+};
+
+extern HardwareSerial Serial;
+
+#endif
@@ -0,0 +1,59 @@
+/*
+ * SPI.h - Host replacement of the Arduino SPI library with an emulated 23K256 SRAM
+ *
+ * 23K256 is selected by pulling host23K256.selectPin low with digitalWrite(). While selected,
+ * SPI.transfer() runs the chip's READ, WRITE, RDSR and WRSR instructions in byte, page or
+ * sequential mode. Counters tell how the bus was used, for example to count transactions.
+ */
+
+#ifndef HOST_SPI_H
+#define HOST_SPI_H
+
+#include "Arduino.h"
+
+#define MSBFIRST  1
+#define SPI_MODE0 0
+
+class SPISettings {
+  public:
+    SPISettings(uint32_t, uint8_t, uint8_t) {}
+};
+
+class SPIClass {
+  public:
+    void begin() {}
+    void beginTransaction(SPISettings) {}
+    void endTransaction() {}
+    uint8_t transfer(uint8_t data);
+};
+
+extern SPIClass SPI;
+
+struct Host23K256 {
+  uint8_t memory[32768];
+  uint8_t status;        // Status register, operating mode in 2 MSB
+  bool present;          // If false, bus reads 0xFF like with no chip connected
+  uint8_t selectPin;
+
+  // Instruction in progress
+  bool selected;
+  uint8_t instruction;
+  uint8_t step;          // Bytes received in this transaction
+  uint16_t address;
+
+  // Bus usage since the last resetCounters()
+  uint32_t transactions; // Slave select pulled low
+  uint32_t bytes;        // Bytes transferred while selected, instruction and address included
+  uint32_t modeWrites;   // WRSR instructions
+  uint32_t errors;       // Bytes the chip would ignore, such as a second data byte in byte mode
+
+  // Powers the chip up: memory is random and operating mode is byte mode
+  void powerUp(bool connected, uint8_t pin);
+  void resetCounters();
+  // Time to clock the counted bytes at 1 MHz, in microseconds
+  uint32_t busMicros() const { return bytes * 8; }
+};
+
+extern Host23K256 host23K256;
+
+#endif
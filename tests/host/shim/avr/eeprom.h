@@ -0,0 +1,23 @@
+/*
+ * eeprom.h - Host replacement of avr-libc EEPROM functions, backed by hostEEPROM
+ */
+
+#ifndef HOST_AVR_EEPROM_H
+#define HOST_AVR_EEPROM_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define HOST_EEPROM_SIZE 1024
+
+extern uint8_t hostEEPROM[HOST_EEPROM_SIZE];
+extern uint32_t hostEEPROMWrites[HOST_EEPROM_SIZE]; // Write count of every cell
+extern bool hostEEPROMBusy;                         // eeprom_is_ready() returns false once after every write
+
+bool eeprom_is_ready();
+void eeprom_busy_wait();
+uint8_t eeprom_read_byte(const uint8_t* address);
+void eeprom_write_byte(uint8_t* address, uint8_t value);
+void eeprom_read_block(void* buffer, const void* address, size_t length);
+
+#endif
@@ -0,0 +1,19 @@
+/*
+ * sleep.h - Host replacement of avr-libc sleep functions
+ *
+ * Sleeping only waits for the ADC conversion started by entering ADC noise reduction sleep.
+ */
+
+#ifndef HOST_AVR_SLEEP_H
+#define HOST_AVR_SLEEP_H
+
+#define SLEEP_MODE_ADC 1
+
+void ADC_vect(void);
+
+#define set_sleep_mode(mode)
+#define sleep_enable()
+#define sleep_disable()
+#define sleep_cpu() ADC_vect()
+
+#endif
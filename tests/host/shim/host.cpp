@@ -0,0 +1,224 @@
+/*
+ * host.cpp - Fakes behind the host replacements of Arduino core, SPI and avr-libc
+ */
+
+#include "Arduino.h"
+#include <SPI.h>
+#include <avr/eeprom.h>
+
+uint8_t UCSR0A = _BV(TXC0); // Transmit is always complete
+uint8_t UCSR0B = 0;
+HostADCSRA ADCSRA = {0};
+uint16_t hostAnalogValue = 0;
+uint32_t hostMicros = 0;
+
+uint8_t hostEEPROM[HOST_EEPROM_SIZE];
+uint32_t hostEEPROMWrites[HOST_EEPROM_SIZE];
+bool hostEEPROMBusy = false;
+
+HardwareSerial Serial;
+SPIClass SPI;
+Host23K256 host23K256;
+
+void pinMode(uint8_t, uint8_t) {
+}
+
+void digitalWrite(uint8_t pin, uint8_t value) {
+  // Slave select of the emulated 23K256 starts and ends instructions
+  if (pin == host23K256.selectPin) {
+    if ((value == LOW) && !host23K256.selected) {
+      host23K256.selected = true;
+      host23K256.step = 0;
+      host23K256.transactions++;
+    }
+    else if (value == HIGH) {
+      host23K256.selected = false;
+    }
+  }
+}
+
+int analogRead(uint8_t) {
+  return hostAnalogValue;
+}
+
+void analogReference(uint8_t) {
+}
+
+unsigned long millis() {
+  return hostMicros / 1000;
+}
+
+unsigned long micros() {
+  return hostMicros;
+}
+
+void delay(unsigned long ms) {
+  hostMicros += ms * 1000;
+}
+
+void HardwareSerial::begin(unsigned long, uint8_t) {
+  rxLength = 0;
+  rxPosition = 0;
+  txLength = 0;
+}
+
+int HardwareSerial::available() {
+  return rxLength - rxPosition;
+}
+
+int HardwareSerial::read() {
+  if (rxPosition >= rxLength) {
+    return -1;
+  }
+  return rxBuffer[rxPosition++];
+}
+
+int HardwareSerial::availableForWrite() {
+  return 63;
+}
+
+size_t HardwareSerial::write(const uint8_t* buffer, size_t size) {
+  for (size_t i = 0; i < size; i++) {
+    write(buffer[i]);
+  }
+  return size;
+}
+
+size_t HardwareSerial::write(uint8_t data) {
+  if (txLength >= sizeof(txBuffer)) {
+    return 0;
+  }
+  txBuffer[txLength++] = data;
+  return 1;
+}
+
+void HardwareSerial::flush() {
+}
+
+void HardwareSerial::hostReceive(const uint8_t* buffer, uint16_t length) {
+  memcpy(rxBuffer, buffer, length);
+  rxLength = length;
+  rxPosition = 0;
+  txLength = 0;
+}
+
+bool eeprom_is_ready() {
+  if (hostEEPROMBusy) {
+    hostEEPROMBusy = false;
+    return false;
+  }
+  return true;
+}
+
+void eeprom_busy_wait() {
+  hostEEPROMBusy = false;
+}
+
+uint8_t eeprom_read_byte(const uint8_t* address) {
+  return hostEEPROM[(uintptr_t)address % HOST_EEPROM_SIZE];
+}
+
+void eeprom_write_byte(uint8_t* address, uint8_t value) {
+  hostEEPROM[(uintptr_t)address % HOST_EEPROM_SIZE] = value;
+  hostEEPROMWrites[(uintptr_t)address % HOST_EEPROM_SIZE]++;
+  hostEEPROMBusy = true;
+}
+
+void eeprom_read_block(void* buffer, const void* address, size_t length) {
+  for (size_t i = 0; i < length; i++) {
+    ((uint8_t*)buffer)[i] = eeprom_read_byte((const uint8_t*)address + i);
+  }
+}
+
+void Host23K256::powerUp(bool connected, uint8_t pin) {
+  // Fill with a pattern so that reads of never written bytes are not zeros
+  for (uint16_t i = 0; i < sizeof(memory); i++) {
+    memory[i] = i * 37 + 11;
+  }
+  status = 0;
+  present = connected;
+  selectPin = pin;
+  selected = false;
+  resetCounters();
+}
+
+void Host23K256::resetCounters() {
+  transactions = 0;
+  bytes = 0;
+  modeWrites = 0;
+  errors = 0;
+}
+
+uint8_t SPIClass::transfer(uint8_t data) {
+  Host23K256& chip = host23K256;
+
+  if (!chip.present || !chip.selected) {
+    return 0xFF;
+  }
+
+  chip.bytes++;
+
+  // Steps: 0 instruction, 1 and 2 address (or 1 status register), 3 first data byte, 4 following data bytes
+  uint8_t step = chip.step;
+  if (chip.step < 4) {
+    chip.step++;
+  }
+
+  if (step == 0) {
+    chip.instruction = data;
+    if ((data != 0x03) && (data != 0x02) && (data != 0x05) && (data != 0x01)) {
+      chip.errors++;
+    }
+    return 0xFF;
+  }
+
+  // RDSR and WRSR take one byte
+  if ((chip.instruction == 0x05) || (chip.instruction == 0x01)) {
+    if (step != 1) {
+      chip.errors++;
+      return 0xFF;
+    }
+    if (chip.instruction == 0x01) {
+      chip.status = data;
+      chip.modeWrites++;
+      return 0xFF;
+    }
+    return chip.status;
+  }
+
+  if ((chip.instruction != 0x03) && (chip.instruction != 0x02)) {
+    return 0xFF;
+  }
+
+  if (step == 1) {
+    chip.address = (data << 8) & 0x7F00;
+    return 0xFF;
+  }
+  if (step == 2) {
+    chip.address |= data;
+    return 0xFF;
+  }
+
+  uint8_t mode = chip.status & 0xC0;
+
+  // Byte mode transfers only one data byte per instruction
+  if ((mode == 0x00) && (step == 4)) {
+    chip.errors++;
+    return 0xFF;
+  }
+
+  uint8_t readByte = chip.memory[chip.address];
+  if (chip.instruction == 0x02) {
+    chip.memory[chip.address] = data;
+  }
+
+  // Page mode wraps within the 32 byte page, sequential mode over the whole chip
+  if (mode == 0x80) {
+    chip.address = (chip.address & 0x7FE0) | ((chip.address + 1) & 0x1F);
+  }
+  else if (mode == 0x40) {
+    chip.address = (chip.address + 1) & 0x7FFF;
+  }
+
+  return (chip.instruction == 0x03) ? readByte : 0xFF;
+}